@@ -32,6 +32,7 @@
 #include <firmware_config.h>
 #include <fw/init.h>
 #include <arch/systick.h>
+#include <platform.h>
 
 #include <stdint.h>
 
@@ -216,9 +217,20 @@ static void do_irq_reset(void)
 }
 
 static uint8_t isr_stack[STACK_SIZE_ISR];
-static uint8_t idle_stack[68];
+// Room for the exception frames and what platform_idle needs
+static uint8_t idle_stack[256];
 static struct thread idle_thread;
-extern void arch_idle_thread(void);
+
+static void arch_idle_thread(void)
+{
+  for (;;) {
+    // The next deadline can't move while interrupts are off, and one that
+    // comes in meanwhile still ends the sleep
+    scheduler_lock();
+    platform_idle(timer_managed_next(default_timer));
+    scheduler_unlock();
+  }
+}
 
 void arch_early_init()
 {
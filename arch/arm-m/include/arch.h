@@ -38,3 +38,27 @@ static ALWAYS_INLINE void arch_disable_irqs()
 {
   __asm volatile ("cpsid i");
 }
+
+/// Orders memory accesses before the barrier against those after it, for
+/// both the compiler and the cpu
+static ALWAYS_INLINE void arch_memory_barrier()
+{
+  __asm volatile ("dmb" ::: "memory");
+}
+
+/// Sleeps until an interrupt is pending, even one that is masked
+static ALWAYS_INLINE void arch_wait_for_interrupt()
+{
+  __asm volatile ("wfi");
+}
+
+/// Like arch_wait_for_interrupt, but lets the platform enter its deep
+/// sleep mode. Most clocks stop there, including SysTick.
+static ALWAYS_INLINE void arch_wait_for_interrupt_deep()
+{
+  volatile uint32_t* scr = (volatile uint32_t*)0xE000ED10;
+
+  *scr |= (1 << 2); // SLEEPDEEP
+  arch_wait_for_interrupt();
+  *scr &= ~(1 << 2);
+}
@@ -4,7 +4,6 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/arch.c \
-	$(LOCAL_DIR)/arch_asm.S \
 	$(LOCAL_DIR)/systick.c 
 
 GLOBAL_INCLUDES += \
@@ -64,14 +64,19 @@ static herz_t systick_clock()
 		return clock_systick_reference();
 }
 
+// Dividing by the ticks per ms keeps the 24 bit counter values from
+// overflowing, which multiplying them by 1000 would do
 static millitime_t systick_get(timer_t _timer)
 {
-  return systick_regs->LOAD * 1000 / systick_clock();
+  return systick_regs->LOAD / (systick_clock() / 1000);
 }
 
 static millitime_t systick_remaining(timer_t _timer)
 {
-  return systick_regs->VAL * 1000 / systick_clock();
+  uint32_t ticks_per_ms = systick_clock() / 1000;
+
+  // Rounded, so the managed timer doesn't drift in one direction
+  return (systick_regs->VAL + ticks_per_ms / 2) / ticks_per_ms;
 }
 
 static void systick_enable(timer_t _timer)
@@ -88,7 +93,7 @@ static void systick_set(timer_t _timer, millitime_t time)
 {
   herz_t clock = systick_clock();
 
-  millitime_t maxPossibleValue = 1000 * kMaxLoadValue/clock;
+  millitime_t maxPossibleValue = kMaxLoadValue / (clock / 1000);
 
   if (time > maxPossibleValue)
     time = maxPossibleValue;
@@ -0,0 +1,209 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "event.h"
+
+#include "malloc.h"
+#include "runtime.h"
+#include "thread.h"
+#include "scheduler.h"
+
+struct event_waitee {
+  list_entry_t queue_entry;
+  thread_t thread;
+  event_t event;
+  event_bits_t bits;
+  event_wait_flags_t flags;
+  struct timer_managed_timeout timeout;
+  /// Set by the event_set that took the waitee off the queue
+  bool woken;
+  /// Set when the timeout fired before the flags were set
+  bool timed_out;
+  /// The flags when the waitee was woken
+  event_bits_t result;
+};
+
+event_t event_create()
+{
+  event_t event = malloc_raw(sizeof(struct event));
+
+  if (!event)
+    return NULL;
+
+  event_init(event);
+
+  return event;
+}
+
+void event_init(event_t event)
+{
+  event->bits = 0;
+  list_init(&event->queue);
+}
+
+void event_destroy(event_t event)
+{
+  event_cleanup(event);
+  free_raw(event, sizeof(struct event));
+}
+
+void event_cleanup(event_t event)
+{
+  assert(list_is_empty(&event->queue) == true, "Trying to clean up an event with waitees");
+}
+
+static bool event_satisfied(event_bits_t set, event_bits_t bits, event_wait_flags_t flags)
+{
+  if (flags & EVENT_WAIT_ALL)
+    return (set & bits) == bits;
+
+  return (set & bits) != 0;
+}
+
+void event_set(event_t event, event_bits_t bits)
+{
+  event_bits_t clear = 0;
+  list_t woken;
+
+  list_init(&woken);
+
+  scheduler_lock();
+  event->bits |= bits;
+
+  list_entry_t* entry = list_first(&event->queue);
+
+  while (entry) {
+    // Get the next one before the entry leaves the list
+    list_entry_t* next = list_next(&event->queue, entry);
+    struct event_waitee* waitee = container_of(entry, struct event_waitee, queue_entry);
+
+    if (event_satisfied(event->bits, waitee->bits, waitee->flags)) {
+      waitee->result = event->bits;
+      waitee->woken = true;
+
+      if (waitee->flags & EVENT_WAIT_CLEAR)
+        clear |= waitee->bits;
+
+      list_delete(&event->queue, entry);
+      list_append(&woken, entry);
+    }
+
+    entry = next;
+  }
+
+  event->bits &= ~clear;
+
+  // Waking may run the waiter right away, after which its waitee is gone
+  while ((entry = list_first(&woken))) {
+    struct event_waitee* waitee = container_of(entry, struct event_waitee, queue_entry);
+    thread_t thread = waitee->thread;
+
+    list_delete(&woken, entry);
+    thread_wakeup(thread);
+  }
+
+  scheduler_unlock();
+}
+
+void event_clear(event_t event, event_bits_t bits)
+{
+  scheduler_lock();
+  event->bits &= ~bits;
+  scheduler_unlock();
+}
+
+event_bits_t event_get(event_t event)
+{
+  return event->bits;
+}
+
+event_bits_t event_wait(event_t event, event_bits_t bits, event_wait_flags_t flags)
+{
+  return event_wait_timeout(event, bits, flags, TIMEOUT_FOREVER);
+}
+
+static void event_timeout_handler(timer_t timer, void* context)
+{
+  struct event_waitee* waitee = context;
+
+  scheduler_lock();
+
+  if (!waitee->woken) {
+    waitee->timed_out = true;
+
+    // Unless it didn't get to queue up yet
+    if (waitee->queue_entry.next != NULL) {
+      list_delete(&waitee->event->queue, &waitee->queue_entry);
+      thread_wakeup(waitee->thread);
+    }
+  }
+
+  scheduler_unlock();
+}
+
+event_bits_t event_wait_timeout(event_t event, event_bits_t bits, event_wait_flags_t flags, millitime_t timeout)
+{
+  struct event_waitee waitee = {
+    .thread = scheduler_current_thread(),
+    .event = event,
+    .bits = bits,
+    .flags = flags,
+    .timed_out = timeout == 0,
+  };
+
+  assert(bits != 0, "Waiting for no flags");
+
+  list_entry_init(&waitee.queue_entry);
+  timer_managed_init(&waitee.timeout, event_timeout_handler, &waitee);
+
+  // Arm it before locking, adding a timeout briefly unlocks the scheduler
+  if (timeout > 0)
+    timer_managed_add(default_timer, &waitee.timeout, timeout, false);
+
+  scheduler_lock();
+
+  // No waiting needed
+  if (event_satisfied(event->bits, bits, flags)) {
+    waitee.woken = true;
+    waitee.result = event->bits;
+
+    if (flags & EVENT_WAIT_CLEAR)
+      event->bits &= ~bits;
+
+    scheduler_unlock();
+  }
+  else if (waitee.timed_out) {
+    scheduler_unlock();
+  }
+  else {
+    assert(!scheduler_in_isr(), "Can not wait in an isr");
+
+    list_append(&event->queue, &waitee.queue_entry);
+    thread_block(); // will also unlock the scheduler
+  }
+
+  if (timer_managed_pending(&waitee.timeout))
+    timer_managed_remove(default_timer, &waitee.timeout);
+
+  return waitee.woken ? waitee.result : 0;
+}
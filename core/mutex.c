@@ -0,0 +1,178 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "mutex.h"
+
+#include "malloc.h"
+#include "runtime.h"
+#include "thread.h"
+#include "scheduler.h"
+
+struct mutex_waitee {
+  list_entry_t queue_entry;
+  thread_t thread;
+};
+
+mutex_t mutex_create()
+{
+  mutex_t mutex = malloc_raw(sizeof(struct mutex));
+
+  if (!mutex)
+    return NULL;
+
+  mutex_init(mutex);
+
+  return mutex;
+}
+
+void mutex_init(mutex_t mutex)
+{
+  mutex->owner = NULL;
+  list_entry_init(&mutex->owner_entry);
+  list_init(&mutex->queue);
+}
+
+void mutex_destroy(mutex_t mutex)
+{
+  mutex_cleanup(mutex);
+  free_raw(mutex, sizeof(struct mutex));
+}
+
+void mutex_cleanup(mutex_t mutex)
+{
+  assert(mutex->owner == NULL, "Trying to clean up a locked mutex");
+}
+
+static void mutex_take(mutex_t mutex, thread_t thread)
+{
+  mutex->owner = thread;
+  list_append(&thread->mutexes, &mutex->owner_entry);
+}
+
+// The waiter of the highest priority, the earliest one among equals
+static struct mutex_waitee* mutex_next_waitee(mutex_t mutex)
+{
+  struct mutex_waitee* next = NULL;
+  struct mutex_waitee* waitee;
+
+  list_foreach_contained(waitee, &mutex->queue, struct mutex_waitee, queue_entry) {
+    if (!next || waitee->thread->priority > next->thread->priority)
+      next = waitee;
+  }
+
+  return next;
+}
+
+thread_priority_t mutex_inherited_priority(thread_t thread)
+{
+  thread_priority_t priority = THREAD_PRIORITY_LOWEST;
+  mutex_t mutex;
+
+  list_foreach_contained(mutex, &thread->mutexes, struct mutex, owner_entry) {
+    struct mutex_waitee* waitee = mutex_next_waitee(mutex);
+
+    if (waitee && waitee->thread->priority > priority)
+      priority = waitee->thread->priority;
+  }
+
+  return priority;
+}
+
+void mutex_lock(mutex_t mutex)
+{
+  assert(!scheduler_in_isr(), "Can not lock a mutex in an isr");
+
+  thread_t thread = scheduler_current_thread();
+  struct mutex_waitee waitee = {
+    .thread = thread,
+  };
+
+  list_entry_init(&waitee.queue_entry);
+
+  scheduler_lock();
+  assert(mutex->owner != thread, "Mutex is already held by this thread");
+
+  if (mutex->owner == NULL) {
+    mutex_take(mutex, thread);
+    scheduler_unlock();
+    return;
+  }
+
+  list_append(&mutex->queue, &waitee.queue_entry);
+  thread->waiting_mutex = mutex;
+
+  // Lend our priority to the owner, the unlock hands the mutex over.
+  // The owner can't run before we are blocked, so the handover can't
+  // come too early.
+  thread_update_priority_locked(mutex->owner);
+  thread_block(); // will also unlock the scheduler
+}
+
+bool mutex_trylock(mutex_t mutex)
+{
+  bool locked = false;
+
+  scheduler_lock();
+
+  if (mutex->owner == NULL) {
+    mutex_take(mutex, scheduler_current_thread());
+    locked = true;
+  }
+
+  scheduler_unlock();
+
+  return locked;
+}
+
+void mutex_unlock(mutex_t mutex)
+{
+  thread_t thread = scheduler_current_thread();
+
+  scheduler_lock();
+  assert(mutex->owner == thread, "Mutex is not held by this thread");
+
+  list_delete(&thread->mutexes, &mutex->owner_entry);
+  mutex->owner = NULL;
+
+  struct mutex_waitee* waitee = mutex_next_waitee(mutex);
+  thread_t next = NULL;
+
+  if (waitee) {
+    next = waitee->thread;
+    list_delete(&mutex->queue, &waitee->queue_entry);
+    next->waiting_mutex = NULL;
+    mutex_take(mutex, next);
+  }
+
+  if (next)
+    thread_update_priority_locked(next);
+
+  // Give up what was inherited through this mutex. The reschedule waits
+  // for the unlock, when the new owner is runnable already.
+  thread_update_priority_locked(thread);
+
+  if (next)
+    thread_wakeup(next); // will also unlock the scheduler
+  else
+    scheduler_unlock();
+}
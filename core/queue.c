@@ -0,0 +1,266 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "queue.h"
+
+#include "runtime.h"
+#include "string.h"
+#include "thread.h"
+#include "scheduler.h"
+
+struct queue_waitee {
+  list_entry_t queue_entry;
+  thread_t thread;
+  /// The senders or receivers list the waitee is in
+  list_t* list;
+  struct timer_managed_timeout timeout;
+  /// Set by the wakeup that took the waitee off its list
+  bool woken;
+  bool timed_out;
+};
+
+void queue_init(queue_t queue, void* slots, size_t slot_size, uint8_t slot_count)
+{
+  assert(slot_count > 0 && slot_count <= 32, "Queues hold 1 to 32 slots");
+
+  queue->slots = slots;
+  queue->slot_size = slot_size;
+  queue->slot_count = slot_count;
+  queue->head = 0;
+  queue->count = 0;
+  queue->reserved = 0;
+  queue->committed = 0;
+  list_init(&queue->senders);
+  list_init(&queue->receivers);
+}
+
+void queue_cleanup(queue_t queue)
+{
+  assert(list_is_empty(&queue->senders) && list_is_empty(&queue->receivers), "Trying to clean up a queue with waitees");
+}
+
+static uint8_t queue_slot_index(queue_t queue, uint8_t offset)
+{
+  return (queue->head + offset) % queue->slot_count;
+}
+
+static void* queue_slot(queue_t queue, uint8_t index)
+{
+  return queue->slots + index * queue->slot_size;
+}
+
+static void queue_timeout_handler(timer_t timer, void* context)
+{
+  struct queue_waitee* waitee = context;
+
+  scheduler_lock();
+  waitee->timed_out = true;
+
+  // A woken waitee is about to run anyway and sees the timeout then
+  if (!waitee->woken) {
+    list_delete(waitee->list, &waitee->queue_entry);
+    thread_wakeup(waitee->thread);
+  }
+
+  scheduler_unlock();
+}
+
+// Arms the timeout of a wait, which spans all the blocking until the
+// queue_wait_end
+static void queue_wait_begin(struct queue_waitee* waitee, list_t* list, millitime_t timeout)
+{
+  waitee->thread = scheduler_current_thread();
+  waitee->list = list;
+  waitee->woken = false;
+  waitee->timed_out = timeout == 0;
+  list_entry_init(&waitee->queue_entry);
+  timer_managed_init(&waitee->timeout, queue_timeout_handler, waitee);
+
+  if (timeout > 0)
+    timer_managed_add(default_timer, &waitee->timeout, timeout, false);
+}
+
+// Called with the scheduler locked, returns with it locked again
+static bool queue_wait_block(struct queue_waitee* waitee)
+{
+  if (waitee->timed_out)
+    return false;
+
+  assert(!scheduler_in_isr(), "Can not wait in an isr");
+
+  waitee->woken = false;
+  list_append(waitee->list, &waitee->queue_entry);
+  thread_block(); // will also unlock the scheduler
+  scheduler_lock();
+
+  return !waitee->timed_out;
+}
+
+// Called with the scheduler locked, like queue_wait_block
+static void queue_wait_end(struct queue_waitee* waitee)
+{
+  timer_managed_remove_locked(default_timer, &waitee->timeout);
+
+  list_delete(waitee->list, &waitee->queue_entry);
+}
+
+// Takes the first waiter off list, called with the scheduler locked.
+// Waking it up would unlock the scheduler, so that is left to
+// queue_wakeup once the queue is consistent again.
+static thread_t queue_dequeue(list_t* list)
+{
+  struct queue_waitee* waitee = container_of(list_first(list), struct queue_waitee, queue_entry);
+
+  if (!waitee)
+    return NULL;
+
+  list_delete(list, &waitee->queue_entry);
+  waitee->woken = true;
+
+  return waitee->thread;
+}
+
+// Lets a dequeued waiter check the queue again
+static void queue_wakeup(thread_t thread)
+{
+  if (thread)
+    thread_wakeup(thread);
+}
+
+static bool queue_full(queue_t queue)
+{
+  return queue->count + queue->reserved == queue->slot_count;
+}
+
+void* queue_reserve(queue_t queue, millitime_t timeout)
+{
+  struct queue_waitee waitee;
+  void* slot = NULL;
+
+  queue_wait_begin(&waitee, &queue->senders, timeout);
+  scheduler_lock();
+
+  while (queue_full(queue) && queue_wait_block(&waitee))
+    ;
+
+  if (!queue_full(queue)) {
+    slot = queue_slot(queue, queue_slot_index(queue, queue->count + queue->reserved));
+    queue->reserved++;
+  }
+
+  queue_wait_end(&waitee);
+
+  // Pass a wakeup on that this waiter didn't use up
+  thread_t sender = !queue_full(queue) ? queue_dequeue(&queue->senders) : NULL;
+
+  scheduler_unlock();
+  queue_wakeup(sender);
+
+  return slot;
+}
+
+void queue_commit(queue_t queue, void* slot)
+{
+  uint8_t index = ((uint8_t*)slot - queue->slots) / queue->slot_size;
+
+  assert(index < queue->slot_count, "Slot is not part of the queue");
+
+  scheduler_lock();
+  queue->committed |= 1 << index;
+
+  // Reservations committed out of order wait for the earlier ones
+  bool added = false;
+
+  while (queue->reserved > 0) {
+    uint32_t bit = 1 << queue_slot_index(queue, queue->count);
+
+    if (!(queue->committed & bit))
+      break;
+
+    queue->committed &= ~bit;
+    queue->reserved--;
+    queue->count++;
+    added = true;
+  }
+
+  thread_t receiver = added ? queue_dequeue(&queue->receivers) : NULL;
+
+  scheduler_unlock();
+  queue_wakeup(receiver);
+}
+
+status_t queue_send(queue_t queue, const void* message, millitime_t timeout)
+{
+  void* slot = queue_reserve(queue, timeout);
+
+  if (!slot)
+    return STATUS_TIMEOUT;
+
+  memcpy(slot, message, queue->slot_size);
+  queue_commit(queue, slot);
+
+  return STATUS_OK;
+}
+
+status_t queue_post(queue_t queue, const void* message)
+{
+  return queue_send(queue, message, 0);
+}
+
+status_t queue_receive(queue_t queue, void* message, millitime_t timeout)
+{
+  struct queue_waitee waitee;
+  status_t status = STATUS_TIMEOUT;
+  thread_t sender = NULL;
+
+  queue_wait_begin(&waitee, &queue->receivers, timeout);
+  scheduler_lock();
+
+  while (queue->count == 0 && queue_wait_block(&waitee))
+    ;
+
+  if (queue->count > 0) {
+    memcpy(message, queue_slot(queue, queue->head), queue->slot_size);
+    queue->head = queue_slot_index(queue, 1);
+    queue->count--;
+    status = STATUS_OK;
+
+    sender = queue_dequeue(&queue->senders);
+  }
+
+  queue_wait_end(&waitee);
+
+  // Pass a wakeup on that this waiter didn't use up
+  thread_t receiver = queue->count > 0 ? queue_dequeue(&queue->receivers) : NULL;
+
+  scheduler_unlock();
+  queue_wakeup(sender);
+  queue_wakeup(receiver);
+
+  return status;
+}
+
+uint8_t queue_count(queue_t queue)
+{
+  return queue->count;
+}
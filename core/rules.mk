@@ -3,8 +3,11 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS := \
+	$(LOCAL_DIR)/event.c \
 	$(LOCAL_DIR)/list.c \
 	$(LOCAL_DIR)/malloc.c \
+	$(LOCAL_DIR)/mutex.c \
+	$(LOCAL_DIR)/queue.c \
 	$(LOCAL_DIR)/runtime.c \
 	$(LOCAL_DIR)/scheduler.c \
 	$(LOCAL_DIR)/semaphore.c \
@@ -12,6 +15,7 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/test.c \
 	$(LOCAL_DIR)/thread.c \
 	$(LOCAL_DIR)/timer.c \
+	$(LOCAL_DIR)/work.c \
 	$(LOCAL_DIR)/file.c 
 
 include make/module.mk
\ No newline at end of file
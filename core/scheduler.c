@@ -24,24 +24,179 @@
 
 #include <scheduler.h>
 #include <thread.h>
+#include <platform.h>
 
 static struct {
   thread_t current_thread;
   thread_t idle_thread;
-  list_t running_queue;
+  /// Bit n is set while ready_queues[n] holds a thread
+  uint32_t ready_mask;
+  /// Runnable threads by priority, the head of each queue runs next
+  list_t ready_queues[THREAD_PRIORITIES];
+#if SCHEDULER_QUANTUM > 0
+  /// Ends the time slice of the current thread
+  struct timer_managed_timeout quantum_timeout;
+#endif
+#if THREAD_STATISTICS
+  /// When the current thread was switched to
+  uint32_t switch_time;
+#endif
 } scheduler;
 
+_Static_assert(THREAD_PRIORITIES <= 32, "The ready mask has only room for 32 priorities");
+
 uint8_t _in_isr_count = 0;
 
+#if SCHEDULER_QUANTUM > 0
+static void scheduler_quantum_expired(timer_t timer, void* context);
+#endif
+
 void scheduler_init()
 {
-  list_init(&scheduler.running_queue);
+  for (thread_priority_t priority = 0; priority < THREAD_PRIORITIES; priority++)
+    list_init(&scheduler.ready_queues[priority]);
+
+#if SCHEDULER_QUANTUM > 0
+  timer_managed_init(&scheduler.quantum_timeout, scheduler_quantum_expired, NULL);
+#endif
 
   scheduler.current_thread = thread_create("main", 0, NULL);
   thread_wakeup(scheduler.current_thread);
   yield();
 }
 
+static void scheduler_ready_insert(thread_t thread)
+{
+  list_append(&scheduler.ready_queues[thread->priority], &thread->scheduler_data.queue_entry);
+  scheduler.ready_mask |= 1 << thread->priority;
+}
+
+// The thread is in the queue of priority, which differs from its
+// own one while the priority changes
+static void scheduler_ready_remove(thread_t thread, thread_priority_t priority)
+{
+  list_t* queue = &scheduler.ready_queues[priority];
+
+  list_delete(queue, &thread->scheduler_data.queue_entry);
+
+  if (list_is_empty(queue))
+    scheduler.ready_mask &= ~(1 << priority);
+}
+
+static thread_t scheduler_next_thread()
+{
+  if (scheduler.ready_mask == 0)
+    return scheduler.idle_thread;
+
+  thread_priority_t priority = 31 - __builtin_clz(scheduler.ready_mask);
+  list_t* queue = &scheduler.ready_queues[priority];
+
+  // Round robin only when the current thread gives up the cpu to a
+  // thread of the same priority. A preempted thread stays at the head
+  // and continues once the higher priority work is done.
+  if (list_first(queue) == &scheduler.current_thread->scheduler_data.queue_entry)
+    list_lrotate(queue);
+
+  return container_of(list_first(queue), struct thread, scheduler_data.queue_entry);
+}
+
+#if SCHEDULER_QUANTUM > 0
+
+// Whether other threads wait for the cpu at the priority of the
+// runnable thread
+static bool scheduler_shares_priority(thread_t thread)
+{
+  list_t* queue = &scheduler.ready_queues[thread->priority];
+
+  return list_first(queue) != list_last(queue);
+}
+
+// The quantum timer only runs while the thread has to share the cpu.
+// Called with the scheduler locked, like scheduler_quantum_switch.
+static void scheduler_quantum_arm(thread_t thread)
+{
+  if (thread == scheduler.idle_thread || timer_managed_pending(&scheduler.quantum_timeout))
+    return;
+
+  if (!scheduler_shares_priority(thread))
+    return;
+
+  if (thread->scheduler_data.quantum <= 0)
+    thread->scheduler_data.quantum = SCHEDULER_QUANTUM;
+
+  timer_managed_add_locked(default_timer, &scheduler.quantum_timeout, thread->scheduler_data.quantum, false);
+}
+
+static void scheduler_quantum_switch(thread_t from, thread_t to)
+{
+  if (from != to && timer_managed_pending(&scheduler.quantum_timeout)) {
+    // Keep what is left for when it runs again
+    from->scheduler_data.quantum = timer_managed_remaining_locked(default_timer, &scheduler.quantum_timeout);
+    timer_managed_remove_locked(default_timer, &scheduler.quantum_timeout);
+  }
+
+  scheduler_quantum_arm(to);
+}
+
+static void scheduler_quantum_expired(timer_t timer, void* context)
+{
+  thread_t thread = scheduler.current_thread;
+
+  thread->scheduler_data.quantum = SCHEDULER_QUANTUM;
+
+  // Move on to the next thread of the same priority
+  if (thread->state == THREAD_STATE_RUNNING && scheduler_shares_priority(thread))
+    yield();
+}
+
+#endif
+
+#if THREAD_STATISTICS
+
+static void scheduler_account_wakeup(thread_t thread)
+{
+  thread->statistics.wakeup_time = platform_timestamp();
+  thread->statistics.woken = true;
+}
+
+static void scheduler_account_switch(thread_t from, thread_t to)
+{
+  uint32_t now = platform_timestamp();
+
+  from->statistics.run_time += now - scheduler.switch_time;
+  scheduler.switch_time = now;
+
+  if (from == to)
+    return;
+
+  to->statistics.switches++;
+
+  // Only the first run after a wakeup counts, not returning from preemption
+  if (to->statistics.woken) {
+    uint32_t latency = now - to->statistics.wakeup_time;
+
+    if (latency > to->statistics.max_latency)
+      to->statistics.max_latency = latency;
+
+    to->statistics.woken = false;
+  }
+}
+
+uint32_t scheduler_thread_run_time(thread_t thread)
+{
+  scheduler_lock();
+  uint32_t run_time = thread->statistics.run_time;
+
+  if (thread == scheduler.current_thread)
+    run_time += platform_timestamp() - scheduler.switch_time;
+
+  scheduler_unlock();
+
+  return run_time;
+}
+
+#endif
+
 stack_t schedule(stack_t stack)
 {
   assert(stack != NULL, "Stack can not be NULL");
@@ -54,13 +209,14 @@ stack_t schedule(stack_t stack)
 #endif
 
   scheduler_lock();
-  if (list_is_empty(&scheduler.running_queue)) {
-    scheduler.current_thread = scheduler.idle_thread;
-  }
-  else {
-    list_lrotate(&scheduler.running_queue);
-    scheduler.current_thread = container_of(list_first(&scheduler.running_queue), struct thread, scheduler_data.queue_entry);
-  }
+  thread_t previous_thread = scheduler.current_thread;
+  scheduler.current_thread = scheduler_next_thread();
+#if SCHEDULER_QUANTUM > 0
+  scheduler_quantum_switch(previous_thread, scheduler.current_thread);
+#endif
+#if THREAD_STATISTICS
+  scheduler_account_switch(previous_thread, scheduler.current_thread);
+#endif
   scheduler_unlock();
 
   stack = thread_get_stack(scheduler.current_thread);
@@ -93,6 +249,14 @@ void delay(millitime_t time)
 void scheduler_thread_data_init(thread_t thread)
 {
   list_entry_init(&thread->scheduler_data.queue_entry);
+  thread->scheduler_data.quantum = SCHEDULER_QUANTUM;
+}
+
+// Whether thread should run instead of the current thread
+static bool scheduler_preempts(thread_t thread)
+{
+  return scheduler.current_thread == scheduler.idle_thread ||
+    thread->priority > scheduler.current_thread->priority;
 }
 
 void scheduler_thread_changed_state(thread_t thread, thread_state_t old_state, thread_state_t new_state)
@@ -100,24 +264,71 @@ void scheduler_thread_changed_state(thread_t thread, thread_state_t old_state, t
   scheduler_lock();
 
   if (old_state == THREAD_STATE_RUNNING && new_state != THREAD_STATE_RUNNING) {
-    list_delete(&scheduler.running_queue, &thread->scheduler_data.queue_entry);
+    scheduler_ready_remove(thread, thread->priority);
 
     // The current thread is no longer running, reschedule is mandetory
     if (thread == scheduler.current_thread)
       yield();
   }
   else if (old_state != THREAD_STATE_RUNNING && new_state == THREAD_STATE_RUNNING) {
-    list_append(&scheduler.running_queue, &thread->scheduler_data.queue_entry);
-  }
+    scheduler_ready_insert(thread);
+#if THREAD_STATISTICS
+    scheduler_account_wakeup(thread);
+#endif
 
-  // if we're currently idily always try to reschudle
-  if (scheduler.current_thread == scheduler.idle_thread)
-    yield();
+    if (scheduler_preempts(thread))
+      yield();
+#if SCHEDULER_QUANTUM > 0
+    else if (thread->priority == scheduler.current_thread->priority)
+      scheduler_quantum_arm(scheduler.current_thread);
+#endif
+  }
 
   scheduler_unlock();
 }
 
+void scheduler_thread_changed_priority(thread_t thread, thread_priority_t old_priority, thread_priority_t new_priority)
+{
+  if (thread->state == THREAD_STATE_RUNNING) {
+    // Move it over to the queue of the new priority
+    scheduler_ready_remove(thread, old_priority);
+    scheduler_ready_insert(thread);
+
+    // A runnable thread may now outrank the current one, or the
+    // current one may have dropped below another
+    if (thread == scheduler.current_thread ? new_priority < old_priority : scheduler_preempts(thread))
+      yield();
+#if SCHEDULER_QUANTUM > 0
+    else
+      scheduler_quantum_arm(scheduler.current_thread);
+#endif
+  }
+}
+
 void scheduler_set_idle_thread(thread_t thread)
 {
   scheduler.idle_thread = thread;
 }
+
+void scheduler_handoff(thread_t thread)
+{
+  scheduler_lock();
+
+  // Wakes the thread like scheduler_thread_changed_state, but without
+  // giving up the lock before it is at the head of its queue
+  if (thread->state != THREAD_STATE_RUNNING) {
+    thread->state = THREAD_STATE_RUNNING;
+    scheduler_ready_insert(thread);
+#if THREAD_STATISTICS
+    scheduler_account_wakeup(thread);
+#endif
+
+    if (scheduler_preempts(thread) || thread->priority == scheduler.current_thread->priority) {
+      // At the head schedule() takes it without rotating the queue
+      list_rrotate(&scheduler.ready_queues[thread->priority]);
+      yield();
+    }
+  }
+
+  scheduler_unlock();
+}
@@ -32,9 +32,15 @@
 struct semaphore_waitee {
   list_entry_t queue_entry;
   thread_t thread;
+  semaphore_t semaphore;
+  struct timer_managed_timeout timeout;
+  /// Set by the signal that took the waitee off the queue
+  bool woken;
+  /// Set when the timeout fired before a signal
+  bool timed_out;
 };
 
-semaphore_t semaphore_create(int8_t initial_value)
+semaphore_t semaphore_create(int32_t initial_value)
 {
   semaphore_t semaphore = malloc_raw(sizeof(struct semaphore));
 
@@ -46,7 +52,7 @@ semaphore_t semaphore_create(int8_t initial_value)
   return semaphore;
 }
 
-void semaphore_init(semaphore_t semaphore, int8_t initial_value)
+void semaphore_init(semaphore_t semaphore, int32_t initial_value)
 {
   semaphore->value = initial_value;
   list_init(&semaphore->queue);
@@ -63,35 +69,109 @@ void semaphore_cleanup(semaphore_t semaphore)
   assert(list_is_empty(&semaphore->queue) == true, "Trying to clean up a semaphore with waitees");
 }
 
-void semaphore_signal(semaphore_t semaphore)
+static void semaphore_wakeup(semaphore_t semaphore, bool handoff)
 {
+  thread_t thread = NULL;
+
+  // The timeout handler changes value and queue from the timer isr
+  scheduler_lock();
   semaphore->value++;
 
   struct semaphore_waitee* waitee = container_of(list_first(&semaphore->queue), struct semaphore_waitee, queue_entry);
 
   if (waitee) {
-    list_delete(&semaphore->queue, list_first(&semaphore->queue));
-    thread_wakeup(waitee->thread);
+    list_delete(&semaphore->queue, &waitee->queue_entry);
+    waitee->woken = true;
+    thread = waitee->thread;
+  }
+
+  scheduler_unlock();
+
+  // Once woken the timeout leaves the waitee alone, so it stays blocked
+  // until this wakeup
+  if (thread) {
+    if (handoff)
+      scheduler_handoff(thread);
+    else
+      thread_wakeup(thread);
   }
 }
 
+void semaphore_signal(semaphore_t semaphore)
+{
+  semaphore_wakeup(semaphore, scheduler_in_isr());
+}
+
+void semaphore_signal_wait(semaphore_t signal, semaphore_t wait)
+{
+  assert(!scheduler_in_isr(), "Can not wait in an isr");
+
+  semaphore_wakeup(signal, true);
+  semaphore_wait(wait);
+}
+
 void semaphore_wait(semaphore_t semaphore)
+{
+  semaphore_wait_timeout(semaphore, TIMEOUT_FOREVER);
+}
+
+static void semaphore_timeout_handler(timer_t timer, void* context)
+{
+  struct semaphore_waitee* waitee = context;
+
+  scheduler_lock();
+
+  if (!waitee->woken) {
+    waitee->timed_out = true;
+
+    // Give back what the waitee took from the value, unless it didn't get
+    // to queue up yet
+    if (waitee->queue_entry.next != NULL) {
+      list_delete(&waitee->semaphore->queue, &waitee->queue_entry);
+      waitee->semaphore->value++;
+      thread_wakeup(waitee->thread);
+    }
+  }
+
+  scheduler_unlock();
+}
+
+status_t semaphore_wait_timeout(semaphore_t semaphore, millitime_t timeout)
 {
   struct semaphore_waitee waitee = {
     .thread = scheduler_current_thread(),
+    .semaphore = semaphore,
+    .timed_out = timeout == 0,
   };
 
   list_entry_init(&waitee.queue_entry);
+  timer_managed_init(&waitee.timeout, semaphore_timeout_handler, &waitee);
+
+  // Arm it before locking, adding a timeout briefly unlocks the scheduler
+  if (timeout > 0)
+    timer_managed_add(default_timer, &waitee.timeout, timeout, false);
 
   scheduler_lock();
   semaphore->value--;
 
   // No waiting needed
   if (semaphore->value >= 0) {
+    waitee.woken = true;
+    scheduler_unlock();
+  }
+  else if (waitee.timed_out) {
+    semaphore->value++;
     scheduler_unlock();
-    return;
   }
+  else {
+    assert(!scheduler_in_isr(), "Can not wait in an isr");
+
+    list_append(&semaphore->queue, &waitee.queue_entry);
+    thread_block(); // will also unlock the scheduler
+  }
+
+  if (timer_managed_pending(&waitee.timeout))
+    timer_managed_remove(default_timer, &waitee.timeout);
 
-  list_append(&semaphore->queue, &waitee.queue_entry);
-  thread_block(); // will also unlock the scheduler
+  return waitee.woken ? STATUS_OK : STATUS_TIMEOUT;
 }
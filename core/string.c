@@ -175,11 +175,11 @@ void* memmove(void* _dst, const void* _src, size_t n)
 		src += n;
 		dst += n;
 
-		for (; n > 0; --n, --src, --dst)
-			*dst = *src;
+		for (; n > 0; --n)
+			*--dst = *--src;
 	}
 
-	return dst;
+	return _dst;
 }
 
 void* __aeabi_memset(void* _b, size_t n, char c)
@@ -194,7 +194,7 @@ void* memset(void* _b, char c, size_t n)
 	for (; n > 0; --n, ++b)
 		*b = c;
 
-	return b;
+	return _b;
 }
 
 const char* strchr(const char *s, int c)
@@ -54,4 +54,14 @@ void test_fail(const char* reason)
 	arch_test_fail(reason);
 }
 
+uint64_t test_cycles()
+{
+	return arch_test_get_cycles();
+}
+
+void test_report_cycles(uint32_t cycles)
+{
+	arch_test_report_cycles(cycles);
+}
+
 #endif
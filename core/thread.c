@@ -23,6 +23,7 @@
 //
 
 #include <thread.h>
+#include <mutex.h>
 #include <malloc.h>
 #include <log.h>
 #include <string.h>
@@ -56,6 +57,8 @@ void thread_struct_init(thread_t thread, const char* name, size_t stack_size, st
 	memset(thread, 0, sizeof(struct thread));
 
 	thread->state = THREAD_STATE_STOPPED;
+	thread->priority = THREAD_PRIORITY_DEFAULT;
+	thread->base_priority = THREAD_PRIORITY_DEFAULT;
 	thread->name = name;
 	thread->tid = next_tid++;
 	thread->stack_protector = NULL;
@@ -81,6 +84,7 @@ void thread_struct_init(thread_t thread, const char* name, size_t stack_size, st
 		}
 	}
 
+	list_init(&thread->mutexes);
 	list_entry_init(&thread->thread_list_entry);
 	list_append(thread_list, &thread->thread_list_entry);
 
@@ -159,6 +163,42 @@ static void thread_set_state(thread_t thread, thread_state_t state)
 	scheduler_thread_changed_state(thread, old_state, state);
 }
 
+void thread_set_priority(thread_t thread, thread_priority_t priority)
+{
+	assert(priority < THREAD_PRIORITIES, "Invalid thread priority");
+
+	thread->base_priority = priority;
+	thread_update_priority(thread);
+}
+
+void thread_update_priority(thread_t thread)
+{
+	scheduler_lock();
+	thread_update_priority_locked(thread);
+	scheduler_unlock();
+}
+
+void thread_update_priority_locked(thread_t thread)
+{
+	thread_priority_t priority = thread->base_priority;
+	thread_priority_t inherited = mutex_inherited_priority(thread);
+
+	if (inherited > priority)
+		priority = inherited;
+
+	if (priority == thread->priority)
+		return;
+
+	thread_priority_t old_priority = thread->priority;
+	thread->priority = priority;
+
+	scheduler_thread_changed_priority(thread, old_priority, priority);
+
+	// Pass it on to the owner of the mutex the thread waits for
+	if (thread->waiting_mutex)
+		thread_update_priority_locked(thread->waiting_mutex->owner);
+}
+
 void thread_block()
 {
 	thread_set_state(scheduler_current_thread(), THREAD_STATE_BLOCKED);
@@ -173,3 +213,37 @@ void thread_wakeup(thread_t thread)
 {
 	thread_set_state(thread, THREAD_STATE_RUNNING);
 }
+
+void thread_notify(thread_t thread, uint32_t bits)
+{
+	scheduler_lock();
+	thread->notify_bits |= bits;
+
+	if (thread->notify_waiting) {
+		thread->notify_waiting = false;
+		thread_wakeup(thread);
+	}
+
+	scheduler_unlock();
+}
+
+uint32_t thread_notify_wait()
+{
+	thread_t thread = scheduler_current_thread();
+
+	assert(!scheduler_in_isr(), "Can not wait in an isr");
+
+	scheduler_lock();
+
+	while (thread->notify_bits == 0) {
+		thread->notify_waiting = true;
+		thread_block(); // will also unlock the scheduler
+		scheduler_lock();
+	}
+
+	uint32_t bits = thread->notify_bits;
+	thread->notify_bits = 0;
+	scheduler_unlock();
+
+	return bits;
+}
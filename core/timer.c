@@ -75,14 +75,6 @@ timer_handler_t timer_get_handler(timer_t timer)
   return timer->handler;
 }
 
-struct timer_managed_timeout {
-  list_entry_t entry;
-  millitime_t remaining;
-  millitime_t reset_time;
-  timer_managedhandler_t handler;
-  void* context;
-};
-
 static void timer_managed_recalculate(timer_t timer)
 {
   struct timer_managed_timeout* t = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
@@ -93,16 +85,11 @@ static void timer_managed_recalculate(timer_t timer)
     timer_disable(timer);
 }
 
-static void timer_managed_update_first(timer_t timer)
+// Time that passed since the timer was last set. It only makes sense
+// while there are timeouts, otherwise the timer does not run.
+static millitime_t timer_managed_elapsed(timer_t timer)
 {
-  // struct timer_managed_timeout* t = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
-  //
-  // if (t) {
-  //   log(LOG_LEVEL_INFO, "get %u remaining %u", timer_get(timer), timer_remaining(timer));
-  //   millitime_t elapsed = timer_get(timer) - timer_remaining(timer);
-  //   t->remaining -= elapsed;
-  //   timer_set(timer, t->remaining);
-  // }
+  return timer_get(timer) - timer_remaining(timer);
 }
 
 static void timer_managed_insert(timer_t timer, struct timer_managed_timeout* timeout)
@@ -111,87 +98,207 @@ static void timer_managed_insert(timer_t timer, struct timer_managed_timeout* ti
   assert(timeout, "Timeout can not be NULL");
 
   if (list_is_empty(&timer->managed_timeouts)) {
-    // log(LOG_LEVEL_INFO, "Insert %p with remaining %u", timeout, timeout->remaining);
     list_append(&timer->managed_timeouts, &timeout->entry);
     timer_managed_recalculate(timer);
     return;
   }
 
-  timer_managed_update_first(timer);
+  // The first timeout is relative to when the timer was set, not to now
+  millitime_t elapsed = timer_managed_elapsed(timer);
 
   struct timer_managed_timeout* t;
   list_foreach_contained(t, &timer->managed_timeouts, struct timer_managed_timeout, entry) {
-    if (timeout->remaining <= t->remaining) {
-      if (&t->entry == list_first(&timer->managed_timeouts)) {
-        list_insert_before(&t->entry, &timeout->entry);
-        list_rrotate(&timer->managed_timeouts);
+    bool first = &t->entry == list_first(&timer->managed_timeouts);
+    millitime_t remaining = first ? t->remaining - elapsed : t->remaining;
 
+    if (timeout->remaining <= remaining) {
+      list_insert_before(&t->entry, &timeout->entry);
+      t->remaining = remaining - timeout->remaining;
+
+      if (first) {
+        list_rrotate(&timer->managed_timeouts);
         timer_managed_recalculate(timer);
       }
-      else {
-        list_insert_before(&t->entry, &timeout->entry);
-      }
-      t->remaining -= timeout->remaining;
       return;
     }
-    timeout->remaining -= t->remaining;
+    timeout->remaining -= remaining;
   }
 
   list_append(&timer->managed_timeouts, &timeout->entry);
 }
 
-void timer_managed_schedule(timer_t timer, millitime_t timeout, bool repeat, timer_managedhandler_t handler, void* context)
+static void timer_managed_setup(timer_t timer)
 {
-  assert(timer, "Timer can not be NULL");
-  assert(timeout > 0, "Timeout can not be negative");
-  assert(handler, "Timeout requires a handler");
-
-  scheduler_lock();
   if (timer_get_handler(timer) != timer_managedhandler) {
     list_init(&timer->managed_timeouts);
     timer_set_handler(timer, timer_managedhandler);
   }
+}
 
-  struct timer_managed_timeout *managed_timeout = malloc_raw(sizeof(struct timer_managed_timeout));
+// Unlinks a pending timeout, the scheduler must be locked
+static void timer_managed_unlink(timer_t timer, struct timer_managed_timeout* timeout)
+{
+  struct timer_managed_timeout* next = container_of(list_next(&timer->managed_timeouts, &timeout->entry), struct timer_managed_timeout, entry);
 
-  list_entry_init(&managed_timeout->entry);
-  managed_timeout->remaining = timeout;
-  managed_timeout->reset_time = repeat ? timeout : 0;
-  managed_timeout->handler = handler;
-  managed_timeout->context = context;
+  // The timer keeps running for the first timeout, the handler then
+  // finds the next one not due yet. Setting the timer again would lose
+  // the time elapsed so far.
+  if (next) {
+    next->remaining += timeout->remaining;
+  }
+
+  list_delete(&timer->managed_timeouts, &timeout->entry);
+}
+
+void timer_managed_init(timer_managed_timeout_t timeout, timer_managedhandler_t handler, void* context)
+{
+  assert(handler, "Timeout requires a handler");
+
+  list_entry_init(&timeout->entry);
+  timeout->remaining = 0;
+  timeout->reset_time = 0;
+  timeout->handler = handler;
+  timeout->context = context;
+  timeout->allocated = false;
+}
+
+void timer_managed_add_locked(timer_t timer, timer_managed_timeout_t timeout, millitime_t time, bool repeat)
+{
+  assert(timer, "Timer can not be NULL");
+  assert(time > 0, "Timeout can not be negative");
+  assert(!timer_managed_pending(timeout), "Timeout is already pending");
 
-  timer_managed_insert(timer, managed_timeout);
+  timer_managed_setup(timer);
+
+  timeout->remaining = time;
+  timeout->reset_time = repeat ? time : 0;
+
+  timer_managed_insert(timer, timeout);
+}
+
+void timer_managed_add(timer_t timer, timer_managed_timeout_t timeout, millitime_t time, bool repeat)
+{
+  scheduler_lock();
+  timer_managed_add_locked(timer, timeout, time, repeat);
   scheduler_unlock();
 }
 
-void timer_managed_cancel(timer_t timer, timer_managedhandler_t handler, void* context)
+void timer_managed_remove_locked(timer_t timer, timer_managed_timeout_t timeout)
 {
   assert(timer, "Timer can not be NULL");
-  assert(handler, "Handler can not be NULL");
 
+  if (timer_managed_pending(timeout))
+    timer_managed_unlink(timer, timeout);
+}
+
+void timer_managed_remove(timer_t timer, timer_managed_timeout_t timeout)
+{
   scheduler_lock();
+  timer_managed_remove_locked(timer, timeout);
+  scheduler_unlock();
+}
+
+millitime_t timer_managed_remaining_locked(timer_t timer, timer_managed_timeout_t timeout)
+{
+  assert(timer_managed_pending(timeout), "Timeout is not pending");
+
+  millitime_t remaining = -timer_managed_elapsed(timer);
 
   struct timer_managed_timeout* t;
   list_foreach_contained(t, &timer->managed_timeouts, struct timer_managed_timeout, entry) {
-    if (t->handler == handler && t->context == context) {
-      bool first = false;
+    remaining += t->remaining;
 
-      if (&t->entry == list_first(&timer->managed_timeouts)) {
-        first = true;
-        timer_managed_update_first(timer);
-      }
+    if (t == timeout)
+      break;
+  }
 
-      struct timer_managed_timeout* next = container_of(list_next(&timer->managed_timeouts, &t->entry), struct timer_managed_timeout, entry);
+  return remaining > 0 ? remaining : 0;
+}
 
-      if (next) {
-        next->remaining += t->remaining;
-      }
+millitime_t timer_managed_remaining(timer_t timer, timer_managed_timeout_t timeout)
+{
+  scheduler_lock();
+  millitime_t remaining = timer_managed_remaining_locked(timer, timeout);
+  scheduler_unlock();
 
-      list_delete(&timer->managed_timeouts, &t->entry);
-      free_raw(t, sizeof(struct timer_managed_timeout));
+  return remaining;
+}
 
-      if (first)
-        timer_managed_recalculate(timer);
+// The functions for the idle path must not lock the scheduler, as
+// unlocking would enable interrupts too early
+
+millitime_t timer_managed_next(timer_t timer)
+{
+  if (timer_get_handler(timer) != timer_managedhandler)
+    return -1;
+
+  struct timer_managed_timeout* t = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
+
+  if (!t)
+    return -1;
+
+  millitime_t remaining = t->remaining - timer_managed_elapsed(timer);
+  return remaining > 0 ? remaining : 0;
+}
+
+void timer_managed_suspend(timer_t timer)
+{
+  if (timer_get_handler(timer) != timer_managedhandler)
+    return;
+
+  struct timer_managed_timeout* t = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
+
+  // Make everything relative to now
+  if (t) {
+    t->remaining -= timer_managed_elapsed(timer);
+    timer_disable(timer);
+  }
+}
+
+void timer_managed_resume(timer_t timer, millitime_t elapsed)
+{
+  if (timer_get_handler(timer) != timer_managedhandler)
+    return;
+
+  struct timer_managed_timeout* t = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
+
+  if (t) {
+    t->remaining -= elapsed;
+
+    // The handler runs from the timer interrupt as usual, which also
+    // fires the timeouts that are overdue
+    timer_set(timer, t->remaining > 0 ? t->remaining : 1);
+  }
+}
+
+void timer_managed_schedule(timer_t timer, millitime_t timeout, bool repeat, timer_managedhandler_t handler, void* context)
+{
+  assert(timer, "Timer can not be NULL");
+  assert(timeout > 0, "Timeout can not be negative");
+  assert(handler, "Timeout requires a handler");
+
+  struct timer_managed_timeout *managed_timeout = malloc_raw(sizeof(struct timer_managed_timeout));
+
+  timer_managed_init(managed_timeout, handler, context);
+  managed_timeout->allocated = true;
+
+  timer_managed_add(timer, managed_timeout, timeout, repeat);
+}
+
+void timer_managed_cancel(timer_t timer, timer_managedhandler_t handler, void* context)
+{
+  assert(timer, "Timer can not be NULL");
+  assert(handler, "Handler can not be NULL");
+
+  scheduler_lock();
+
+  struct timer_managed_timeout* t;
+  list_foreach_contained(t, &timer->managed_timeouts, struct timer_managed_timeout, entry) {
+    if (t->handler == handler && t->context == context) {
+      timer_managed_unlink(timer, t);
+
+      if (t->allocated)
+        free_raw(t, sizeof(struct timer_managed_timeout));
       break;
     }
   }
@@ -210,11 +317,16 @@ static void timer_managedhandler(timer_t timer, millitime_t elapsed_time)
     t->remaining -= elapsed_time;
     scheduler_unlock();
 
-    while (t->remaining <= 0) {
+    while (t && t->remaining <= 0) {
       scheduler_lock();
-      bool free_it = true;
+      bool free_it = t->allocated;
       list_delete(&timer->managed_timeouts, &t->entry);
 
+      // Whatever is overdue goes to the next one
+      struct timer_managed_timeout* next = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
+      if (next)
+        next->remaining += t->remaining;
+
       if (t->reset_time > 0) {
         t->remaining = t->reset_time;
         timer_managed_insert(timer, t);
@@ -229,9 +341,13 @@ static void timer_managedhandler(timer_t timer, millitime_t elapsed_time)
       t = container_of(list_first(&timer->managed_timeouts), struct timer_managed_timeout, entry);
     }
 
+    scheduler_lock();
     timer_managed_recalculate(timer);
+    scheduler_unlock();
   }
   else {
+    // The last timeout was removed while the timer kept running
+    timer_disable(timer);
     scheduler_unlock();
   }
 }
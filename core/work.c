@@ -0,0 +1,114 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "work.h"
+
+#include "runtime.h"
+#include "scheduler.h"
+
+struct work_queue {
+  thread_t thread;
+  list_t items;
+};
+
+static struct work_queue work_queues[THREAD_PRIORITIES];
+
+static void work_worker(struct work_queue* queue)
+{
+  for (;;) {
+    scheduler_lock();
+
+    work_t work = container_of(list_first(&queue->items), struct work, entry);
+
+    if (!work) {
+      thread_block(); // will also unlock the scheduler
+      continue;
+    }
+
+    list_delete(&queue->items, &work->entry);
+    work->pending = false;
+    scheduler_unlock();
+
+    work->func(work);
+  }
+}
+
+void work_init(work_t work, work_func_t func, thread_priority_t priority)
+{
+  assert(priority < THREAD_PRIORITIES, "Invalid thread priority");
+
+  list_entry_init(&work->entry);
+  work->func = func;
+  work->priority = priority;
+  work->pending = false;
+
+  struct work_queue* queue = &work_queues[priority];
+
+  if (queue->thread)
+    return;
+
+  list_init(&queue->items);
+  queue->thread = thread_create("worker", STACK_SIZE_WORKER, NULL);
+  assert(queue->thread, "Could not create worker thread");
+
+  thread_set_priority(queue->thread, priority);
+  thread_set_function(queue->thread, work_worker, 1, queue);
+  thread_wakeup(queue->thread);
+}
+
+bool work_submit(work_t work)
+{
+  struct work_queue* queue = &work_queues[work->priority];
+
+  // The worker clears pending before it calls the work function, so
+  // pending work still sees whatever lead to this submit
+  if (work->pending)
+    return false;
+
+  scheduler_lock();
+
+  if (work->pending) {
+    scheduler_unlock();
+    return false;
+  }
+
+  work->pending = true;
+  list_append(&queue->items, &work->entry);
+  thread_wakeup(queue->thread);
+
+  scheduler_unlock();
+
+  return true;
+}
+
+void work_cancel(work_t work)
+{
+  scheduler_lock();
+
+  if (work->pending) {
+    list_delete(&work_queues[work->priority].items, &work->entry);
+    work->pending = false;
+  }
+
+  scheduler_unlock();
+}
@@ -0,0 +1,99 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/// @file event.h
+/// @defgroup event Event flags
+///
+/// A set of flags threads can wait on, any or all of them. Setting flags
+/// is safe from an isr.
+/// @{
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <list.h>
+#include <runtime.h>
+#include <timer.h>
+
+typedef struct event* event_t;
+typedef uint32_t event_bits_t;
+
+typedef ENUM(uint8_t, event_wait_flags_t) {
+  /// Wait until all the flags are set, instead of any of them
+  EVENT_WAIT_ALL = (1 << 0),
+  /// Clear the flags waited for when returning
+  EVENT_WAIT_CLEAR = (1 << 1),
+};
+
+/// @internal
+struct event {
+  /// Flags currently set
+  event_bits_t bits;
+  /// A list of waiting threads
+  list_t queue;
+};
+
+/// Creates a new heap allocated event
+///
+/// @returns a newly allocated event with no flags set
+/// @retval NULL if allocation failed
+event_t event_create();
+
+/// Initializes an event at a given location
+void event_init(event_t event);
+
+/// Destroys a heap allocated event
+void event_destroy(event_t event);
+
+/// Clean up an event at a given location
+void event_cleanup(event_t event);
+
+/// Sets flags and wakes the threads waiting for them
+///
+/// Waiters that clear on exit clear their flags only after every waiter
+/// satisfied by this call was woken, so all of them see the same flags.
+void event_set(event_t event, event_bits_t bits);
+
+/// Clears flags
+void event_clear(event_t event, event_bits_t bits);
+
+/// Returns the flags currently set
+event_bits_t event_get(event_t event);
+
+/// Wait until any or all of the given flags are set
+///
+/// @param bits flags to wait for
+/// @param flags EVENT_WAIT_ALL and EVENT_WAIT_CLEAR
+///
+/// @returns the flags that were set when the wait was satisfied
+event_bits_t event_wait(event_t event, event_bits_t bits, event_wait_flags_t flags);
+
+/// Like event_wait, for at most timeout ms
+///
+/// A timeout of 0 only checks the flags, and is safe from an isr.
+/// TIMEOUT_FOREVER waits like event_wait.
+///
+/// @retval 0 if the flags weren't set in time
+event_bits_t event_wait_timeout(event_t event, event_bits_t bits, event_wait_flags_t flags, millitime_t timeout);
+
+/// @}
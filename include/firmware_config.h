@@ -40,7 +40,22 @@
 
 #define STACK_SIZE_CONSOLE STACK_SIZE_MAIN
 
+/// Defines the stack size of the work queue threads
+#define STACK_SIZE_WORKER 768
+
 // Enable the possibility to measure the stack utilisation
 #define STACK_UTILISATION 1
 
 #define STACK_CHECK_PROTECTOR 1
+
+/// Number of thread priority levels, at most 32. Each level has its own
+/// ready queue.
+#define THREAD_PRIORITIES 8
+
+/// Time in ms a thread may run while threads of the same priority wait for
+/// the cpu. 0 turns time slicing off.
+#define SCHEDULER_QUANTUM 10
+
+/// Keep per thread cpu time, switch counts and wakeup latencies. They are
+/// measured with platform_timestamp on every context switch.
+#define THREAD_STATISTICS 1
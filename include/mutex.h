@@ -0,0 +1,83 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/// @file mutex.h
+/// @defgroup mutex
+/// @{
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <list.h>
+#include <thread.h>
+
+typedef struct mutex* mutex_t;
+
+/// @internal
+struct mutex {
+  /// The thread holding the mutex, NULL if it is unlocked
+  thread_t owner;
+  /// Entry in the list of mutexes held by the owner
+  list_entry_t owner_entry;
+  /// Threads waiting for the mutex. The most important one gets it next.
+  list_t queue;
+};
+
+/// Creates a new heap allocated mutex
+///
+/// @returns a newly allocated mutex
+/// @retval NULL if allocation failed
+mutex_t mutex_create();
+
+/// Initializes a mutex at a given location
+void mutex_init(mutex_t mutex);
+
+/// Destroys a heap allocated mutex
+void mutex_destroy(mutex_t mutex);
+
+/// Clean up a mutex at a given location
+void mutex_cleanup(mutex_t mutex);
+
+/// Lock a mutex, waiting indefinitly if another thread holds it
+///
+/// While waiting the owner runs at least at the priority of the calling
+/// thread, so threads in between can't hold it off. Locking a mutex
+/// the calling thread already holds is an error.
+void mutex_lock(mutex_t mutex);
+
+/// Lock a mutex only if it is free
+///
+/// @retval true the mutex is now held by the calling thread
+bool mutex_trylock(mutex_t mutex);
+
+/// Unlock a mutex held by the calling thread
+///
+/// The most important waiter becomes the new owner and a priority
+/// inherited through the mutex is given up.
+void mutex_unlock(mutex_t mutex);
+
+/// @internal
+/// The highest priority of threads waiting for mutexes held by thread
+thread_priority_t mutex_inherited_priority(thread_t thread);
+
+/// @}
@@ -24,9 +24,28 @@
 
 #pragma once
 
+#include <timer.h>
+
 void platform_early_init();
 void platform_init();
 
+/// Sleeps until an interrupt is pending
+///
+/// Called by the idle thread with interrupts disabled, an interrupt that is
+/// pending wakes the mcu nonetheless and runs once the idle thread enables
+/// interrupts again. Platforms pick the sleep depth by the time until the
+/// next timeout on default_timer is due. When a deeper sleep stops the
+/// default timer, they correct the time base with timer_managed_resume.
+///
+/// @param idle_time time in ms until the next timeout, or -1 when none is
+/// pending
+void platform_idle(millitime_t idle_time);
+
+/// Free running time in microseconds, wrapping around after 2^32 us
+///
+/// Used for thread statistics. Platforms without a spare timer return 0.
+uint32_t platform_timestamp();
+
 #if __has_include_next(<platform.h>)
 #include_next<platform.h>
 #endif
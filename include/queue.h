@@ -0,0 +1,106 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/// @file queue.h
+/// @defgroup queue Message queues
+///
+/// Passes fixed size messages between threads and from interrupts. The
+/// messages live in a ring of slots provided by the caller. Producers can
+/// reserve a slot, fill it in place and commit it, instead of copying a
+/// message in.
+///
+/// Timeouts are in ms, 0 returns right away when the call would block and
+/// TIMEOUT_FOREVER waits as long as it takes. Calls with a timeout of 0
+/// are safe from an isr.
+/// @{
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list.h>
+#include <runtime.h>
+#include <timer.h>
+
+typedef struct queue* queue_t;
+
+/// @internal
+struct queue {
+  uint8_t* slots;
+  size_t slot_size;
+  uint8_t slot_count;
+  /// Slot of the oldest message
+  uint8_t head;
+  /// Committed messages, starting at head
+  uint8_t count;
+  /// Reserved slots following the committed messages
+  uint8_t reserved;
+  /// Bit n is set when slot n is committed but an earlier reservation
+  /// is not yet
+  uint32_t committed;
+  /// Threads waiting for a free slot
+  list_t senders;
+  /// Threads waiting for a message
+  list_t receivers;
+};
+
+/// Initializes a queue at a given location
+///
+/// @param slots storage for slot_count messages of slot_size bytes, must
+/// stay valid while the queue is used
+/// @param slot_count number of slots, at most 32
+void queue_init(queue_t queue, void* slots, size_t slot_size, uint8_t slot_count);
+
+/// Clean up a queue at a given location
+void queue_cleanup(queue_t queue);
+
+/// Reserves the next free slot to write a message into
+///
+/// @returns the slot, which has to be committed with queue_commit
+/// @retval NULL if no slot became free in time
+void* queue_reserve(queue_t queue, millitime_t timeout);
+
+/// Makes a reserved slot available to receivers
+///
+/// Messages are received in the order their slots were reserved.
+void queue_commit(queue_t queue, void* slot);
+
+/// Copies a message into the queue
+///
+/// @retval STATUS_TIMEOUT if no slot became free in time
+status_t queue_send(queue_t queue, const void* message, millitime_t timeout);
+
+/// Copies a message into the queue if a slot is free, safe from an isr
+///
+/// @retval STATUS_TIMEOUT if the queue is full
+status_t queue_post(queue_t queue, const void* message);
+
+/// Takes the oldest message out of the queue
+///
+/// @param message buffer of slot_size bytes the message is copied to
+/// @retval STATUS_TIMEOUT if no message arrived in time
+status_t queue_receive(queue_t queue, void* message, millitime_t timeout);
+
+/// Returns the number of messages ready to be received
+uint8_t queue_count(queue_t queue);
+
+/// @}
@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/// @file ring.h
+/// @defgroup ring Ring buffers
+///
+/// A ring of fixed size records between one producer and one consumer, for
+/// example an isr and a thread. Neither side disables interrupts: the
+/// producer only writes head and the consumer only writes tail. Both
+/// indices run freely and are masked into the ring, which is why the
+/// number of records must be a power of two.
+/// @{
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <runtime.h>
+#include <arch.h>
+
+typedef struct ring* ring_t;
+
+/// @internal
+struct ring {
+  uint8_t* records;
+  uint16_t record_size;
+  /// Number of records minus one
+  uint16_t mask;
+  /// Records put so far, only written by the producer
+  volatile uint16_t head;
+  /// Records got so far, only written by the consumer
+  volatile uint16_t tail;
+};
+
+/// Initializes a ring at a given location
+///
+/// @param records storage for count records of record_size bytes
+/// @param count number of records, a power of two up to 2^15
+static inline void ring_init(ring_t ring, void* records, uint16_t record_size, uint16_t count)
+{
+  assert(count > 0 && count <= (1 << 15) && (count & (count - 1)) == 0, "Ring size must be a power of two");
+
+  ring->records = records;
+  ring->record_size = record_size;
+  ring->mask = count - 1;
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+/// Returns the number of records waiting to be got
+static ALWAYS_INLINE uint16_t ring_count(ring_t ring)
+{
+  return (uint16_t)(ring->head - ring->tail);
+}
+
+static ALWAYS_INLINE bool ring_is_empty(ring_t ring)
+{
+  return ring->head == ring->tail;
+}
+
+static ALWAYS_INLINE bool ring_is_full(ring_t ring)
+{
+  return ring_count(ring) > ring->mask;
+}
+
+/// Producer: returns the record to fill next, or NULL when the ring is
+/// full. It is handed to the consumer by ring_push.
+static ALWAYS_INLINE void* ring_reserve(ring_t ring)
+{
+  if (ring_is_full(ring))
+    return NULL;
+
+  return ring->records + (ring->head & ring->mask) * ring->record_size;
+}
+
+/// Producer: hands the reserved record to the consumer
+static ALWAYS_INLINE void ring_push(ring_t ring)
+{
+  // The record has to be written before the consumer sees it
+  arch_memory_barrier();
+  ring->head++;
+}
+
+/// Consumer: returns the oldest record, or NULL when the ring is empty.
+/// It stays valid until ring_pop.
+static ALWAYS_INLINE void* ring_peek(ring_t ring)
+{
+  if (ring_is_empty(ring))
+    return NULL;
+
+  arch_memory_barrier();
+  return ring->records + (ring->tail & ring->mask) * ring->record_size;
+}
+
+/// Consumer: gives the oldest record back to the producer
+static ALWAYS_INLINE void ring_pop(ring_t ring)
+{
+  // Done reading the record before the producer may overwrite it
+  arch_memory_barrier();
+  ring->tail++;
+}
+
+/// Producer: copies a record in
+///
+/// @retval false the ring is full
+static inline bool ring_put(ring_t ring, const void* record)
+{
+  void* slot = ring_reserve(ring);
+
+  if (!slot)
+    return false;
+
+  memcpy(slot, record, ring->record_size);
+  ring_push(ring);
+
+  return true;
+}
+
+/// Consumer: copies the oldest record out
+///
+/// @retval false the ring is empty
+static inline bool ring_get(ring_t ring, void* record)
+{
+  void* slot = ring_peek(ring);
+
+  if (!slot)
+    return false;
+
+  memcpy(record, slot, ring->record_size);
+  ring_pop(ring);
+
+  return true;
+}
+
+/// Producer: puts a byte into a ring of one byte records
+static ALWAYS_INLINE bool ring_put_byte(ring_t ring, uint8_t byte)
+{
+  if (ring_is_full(ring))
+    return false;
+
+  ring->records[ring->head & ring->mask] = byte;
+  ring_push(ring);
+
+  return true;
+}
+
+/// Consumer: gets a byte from a ring of one byte records
+static ALWAYS_INLINE bool ring_get_byte(ring_t ring, uint8_t* byte)
+{
+  if (ring_is_empty(ring))
+    return false;
+
+  arch_memory_barrier();
+  *byte = ring->records[ring->tail & ring->mask];
+  ring_pop(ring);
+
+  return true;
+}
+
+/// @}
@@ -78,6 +78,8 @@ static ALWAYS_INLINE void scheduler_leave_isr() {
 
 struct scheduler_thread_data {
   list_entry_t queue_entry;
+  /// Time left of the threads time slice
+  millitime_t quantum;
 };
 typedef struct scheduler_thread_data scheduler_thread_data_t;
 
@@ -98,5 +100,22 @@ void scheduler_thread_data_init(thread_t thread);
 
 void scheduler_thread_changed_state(thread_t thread, thread_state_t old_state, thread_state_t new_state);
 
+/// Called with the scheduler locked, which it keeps
+void scheduler_thread_changed_priority(thread_t thread, thread_priority_t old_priority, thread_priority_t new_priority);
+
 void scheduler_set_idle_thread(thread_t thread);
 
+/// Wakes a thread and lets it run next, without waiting for the threads of
+/// its priority to take their turn
+///
+/// Only when it doesn't rank below the current thread, otherwise it is a
+/// plain thread_wakeup.
+void scheduler_handoff(thread_t thread);
+
+#if THREAD_STATISTICS
+
+/// The cpu time of a thread, including the running time slice of the
+/// current thread
+uint32_t scheduler_thread_run_time(thread_t thread);
+
+#endif
@@ -30,13 +30,14 @@
 #include <stdint.h>
 #include <list.h>
 #include <runtime.h>
+#include <timer.h>
 
 typedef struct semaphore* semaphore_t;
 
 /// @internal
 struct semaphore {
-  /// The current value of the semaphore
-  int8_t value;
+  /// The current value of the semaphore, negative by the number of waiters
+  int32_t value;
   /// A list of waiting threads. Should be woken in the order they arrived.
   list_t queue;
 };
@@ -47,10 +48,10 @@ struct semaphore {
 ///
 /// @returns a newly allocated semaphore
 /// @retval NULL if allocation failed
-semaphore_t semaphore_create(int8_t initial_value);
+semaphore_t semaphore_create(int32_t initial_value);
 
 /// Initializes a semaphore at a given location
-void semaphore_init(semaphore_t semaphore, int8_t initial_value);
+void semaphore_init(semaphore_t semaphore, int32_t initial_value);
 
 /// Destroys a heap allocated sempahore
 void semaphore_destory(semaphore_t semaphore);
@@ -59,9 +60,26 @@ void semaphore_destory(semaphore_t semaphore);
 void semaphore_cleanup(semaphore_t semaphore);
 
 /// Signal a given semaphore
+///
+/// From an isr, the cpu is handed over to the woken waiter right away when
+/// it doesn't rank below the interrupted thread.
 void semaphore_signal(semaphore_t semaphore);
 
+/// Signal a semaphore and wait on another one, like a request is answered
+///
+/// The waiter of signal runs next, ahead of threads of its priority, as the
+/// calling thread is about to block anyway.
+void semaphore_signal_wait(semaphore_t signal, semaphore_t wait);
+
 /// Wait on a semaphore if needed indefinitly
 void semaphore_wait(semaphore_t semaphore);
 
+/// Wait on a semaphore for at most timeout ms
+///
+/// A timeout of 0 only takes the semaphore when that needs no waiting, and
+/// is safe from an isr. TIMEOUT_FOREVER waits like semaphore_wait.
+///
+/// @retval STATUS_TIMEOUT if the semaphore wasn't signaled in time
+status_t semaphore_wait_timeout(semaphore_t semaphore, millitime_t timeout);
+
 /// @}
@@ -24,6 +24,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 typedef enum {
 	TEST_AFTER_ARCH_EARLY_INIT,
 	TEST_AFTER_ARCH_LATE_INIT,
@@ -47,12 +49,20 @@ struct test test_##_func __attribute__ ((section (".tests." # _func))) = { \
 void test_do(test_type type);
 void test_fail(const char* reason);
 
+/// Returns a free running cycle counter to benchmark code with
+uint64_t test_cycles();
+
+/// Reports the cycles a benchmark took with the test result
+void test_report_cycles(uint32_t cycles);
+
 #define test_assert(expr, desc) if (!(expr)) { test_fail(desc); }
 
 #else
 
 static void test_do(test_type type) {};
 static void test_fail(const char* reason) {};
+static uint64_t test_cycles() { return 0; };
+static void test_report_cycles(uint32_t cycles) {};
 
 #define test_assert(expr, desc) 
 
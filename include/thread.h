@@ -41,14 +41,53 @@ typedef enum {
 typedef struct thread* thread_t;
 typedef void (*entry_func)();
 typedef uint8_t tid_t;
+typedef uint8_t thread_priority_t;
+
+/// Higher values are more important. The idle thread runs only when no
+/// thread of any priority is runnable.
+enum {
+	THREAD_PRIORITY_LOWEST  = 0,
+	THREAD_PRIORITY_DEFAULT = THREAD_PRIORITIES / 2,
+	THREAD_PRIORITY_HIGHEST = THREAD_PRIORITIES - 1,
+};
 
 #include <scheduler.h>
 
+#if THREAD_STATISTICS
+
+/// Kept by the scheduler, times are in platform_timestamp microseconds
+struct thread_statistics {
+	/// Time spent on the cpu
+	uint32_t run_time;
+	/// Number of times the thread was switched to
+	uint32_t switches;
+	/// Longest time between a wakeup and running
+	uint32_t max_latency;
+	/// When the thread was woken up, valid while woken is set
+	uint32_t wakeup_time;
+	bool woken;
+};
+
+#endif
+
 struct thread {
 	list_entry_t thread_list_entry;
 
 	tid_t tid;
 	thread_state_t state;
+	/// The priority the thread is scheduled with, raised above
+	/// base_priority while it holds a mutex a more important thread waits for
+	thread_priority_t priority;
+	/// The priority set with thread_set_priority
+	thread_priority_t base_priority;
+	/// Mutexes currently held by the thread
+	list_t mutexes;
+	/// The mutex the thread is blocked on, if any
+	struct mutex* waiting_mutex;
+	/// Notifications not yet taken by thread_notify_wait
+	uint32_t notify_bits;
+	/// Set while blocked in thread_notify_wait
+	bool notify_waiting;
 	stack_t stack;
 	stack_t stack_protector;
 #if STACK_UTILISATION
@@ -57,6 +96,9 @@ struct thread {
 	const char* name;
 
 	scheduler_thread_data_t scheduler_data;
+#if THREAD_STATISTICS
+	struct thread_statistics statistics;
+#endif
 };
 
 
@@ -92,11 +134,25 @@ static ALWAYS_INLINE stack_t thread_get_stack(const thread_t thread)
 	return thread->stack;
 }
 
+/// Changes the priority of a thread, which may preempt the current thread
+///
+/// While the thread holds a mutex it may keep running at an inherited
+/// higher priority until the mutex is unlocked.
+void thread_set_priority(thread_t thread, thread_priority_t priority);
+
+/// Recomputes the priority of a thread from its base priority and the
+/// waiters of the mutexes it holds
+void thread_update_priority(thread_t thread);
+
+/// Like thread_update_priority, for callers that hold the scheduler lock
+///
+/// A reschedule it causes waits until the lock is released.
+void thread_update_priority_locked(thread_t thread);
+
 /// Blocks the current thread.
 ///
 /// This call will only resume when another thread or an interrupt  woke it up
 /// with thread_wakeup
-///
 void thread_block();
 
 /// Stops a given thread.
@@ -108,3 +164,14 @@ void thread_stop(thread_t thread);
 ///
 /// Does nothing if the thread is not blocked or stopped.
 void thread_wakeup(thread_t thread);
+
+/// Sets bits in the notification word of a thread and wakes it when it
+/// waits in thread_notify_wait. Safe to call from an isr.
+///
+/// Lighter than a semaphore when only this thread ever waits.
+void thread_notify(thread_t thread, uint32_t bits);
+
+/// Waits until the notification word of the current thread is not empty
+///
+/// @returns the notification word, which is cleared
+uint32_t thread_notify_wait();
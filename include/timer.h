@@ -36,6 +36,9 @@ typedef struct timer* timer_t;
 // will overflow approx. every 24days
 typedef int32_t millitime_t;
 
+/// Timeout of blocking calls that wait as long as it takes
+#define TIMEOUT_FOREVER ((millitime_t)-1)
+
 typedef void (*timer_handler_t)(timer_t timer, millitime_t elapsed_time);
 typedef void (*timer_managedhandler_t)(timer_t timer, void* context);
 
@@ -92,6 +95,77 @@ timer_handler_t timer_get_handler(timer_t timer);
 // A default managed timer
 extern timer_t default_timer;
 
+/// A managed timeout
+///
+/// timer_managed_schedule allocates them, callers that can't allocate (like
+/// the scheduler) embed their own and use timer_managed_add.
+///
+struct timer_managed_timeout {
+  list_entry_t entry;
+  /// Time left after the timeout before it in the list
+  millitime_t remaining;
+  /// Time to rearm with, 0 for a one shot timeout
+  millitime_t reset_time;
+  timer_managedhandler_t handler;
+  void* context;
+  /// Allocated by timer_managed_schedule and freed once done
+  bool allocated;
+};
+typedef struct timer_managed_timeout* timer_managed_timeout_t;
+
+/// Initializes a caller owned timeout
+void timer_managed_init(timer_managed_timeout_t timeout, timer_managedhandler_t handler, void* context);
+
+/// Arms a caller owned timeout, which must not be pending already.
+///
+/// Puts the timer in the managed mode if not already.
+///
+/// @param timer to operate on
+/// @param timeout the timeout to arm, must stay valid until it fired or was removed
+/// @param time time after which the handler should be called
+/// @param repeat true if the handler should be called repeatilly
+void timer_managed_add(timer_t timer, timer_managed_timeout_t timeout, millitime_t time, bool repeat);
+
+/// Disarms a caller owned timeout, nothing happens when it is not pending.
+void timer_managed_remove(timer_t timer, timer_managed_timeout_t timeout);
+
+/// Variants of timer_managed_add, timer_managed_remove and
+/// timer_managed_remaining for callers that already hold the scheduler lock
+///
+/// The lock does not nest, taking it again would enable interrupts when
+/// released.
+void timer_managed_add_locked(timer_t timer, timer_managed_timeout_t timeout, millitime_t time, bool repeat);
+void timer_managed_remove_locked(timer_t timer, timer_managed_timeout_t timeout);
+millitime_t timer_managed_remaining_locked(timer_t timer, timer_managed_timeout_t timeout);
+
+/// Returns true while the timeout waits to fire
+static ALWAYS_INLINE bool timer_managed_pending(timer_managed_timeout_t timeout) {
+  return timeout->entry.next != NULL;
+}
+
+/// Returns the time until a pending timeout fires
+millitime_t timer_managed_remaining(timer_t timer, timer_managed_timeout_t timeout);
+
+/// Returns the time until the next managed timeout fires, or -1 when
+/// there is none
+///
+/// @note Call with interrupts disabled
+millitime_t timer_managed_next(timer_t timer);
+
+/// Stops a managed timer, e.g. before a sleep mode that stops its clock
+///
+/// @note Call with interrupts disabled, until timer_managed_resume
+void timer_managed_suspend(timer_t timer);
+
+/// Restarts a managed timer stopped by timer_managed_suspend
+///
+/// Timeouts that became due meanwhile fire right away.
+///
+/// @param timer Timer to operate on
+/// @param elapsed time that passed since suspending, as measured by a clock
+/// that kept running
+void timer_managed_resume(timer_t timer, millitime_t elapsed);
+
 /// Schedules a call to timer_handler after a specified timeout.
 ///
 /// Puts the timer in the managed mode if not already.
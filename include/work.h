@@ -0,0 +1,70 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/// @file work.h
+/// @defgroup work Work queues
+///
+/// Defers work out of interrupts into a worker thread. There is one worker
+/// per priority in use, it runs the submitted work items in order.
+/// @{
+
+#pragma once
+
+#include <stdbool.h>
+#include <list.h>
+#include <thread.h>
+
+typedef struct work* work_t;
+typedef void (*work_func_t)(work_t work);
+
+/// A work item, owned by the caller. Embed it into your own struct and
+/// use container_of in the work function to get at it.
+struct work {
+  /// @internal
+  list_entry_t entry;
+  work_func_t func;
+  /// Priority of the worker thread running it
+  thread_priority_t priority;
+  /// Set from the submit until the work function is called
+  bool pending;
+};
+
+/// Initializes a work item, starting the worker for priority if needed
+///
+/// @note Call from thread context, as it may create the worker thread
+void work_init(work_t work, work_func_t func, thread_priority_t priority);
+
+/// Queues a work item to run on its worker, safe to call from an isr
+///
+/// Submitting it again while it waits to run does nothing, so the work
+/// function has to handle everything that happend since it was submitted.
+/// Once the work function is called, the item may be submitted again.
+///
+/// @retval true the work was queued
+/// @retval false the work was pending already
+bool work_submit(work_t work);
+
+/// Removes a pending work item from its queue, does nothing if the work
+/// is not pending
+void work_cancel(work_t work);
+
+/// @}
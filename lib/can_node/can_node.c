@@ -27,7 +27,8 @@
 #include <string.h>
 #include <config/config.h>
 #include <scheduler.h>
-#include <semaphore.h>
+#include <event.h>
+#include <work.h>
 #include <sensor.h>
 #include <log.h>
 #include <platform/gpio.h>
@@ -39,11 +40,20 @@ bool can_node_valid_id(can_node_id_t id)
 
 #define assert_can_node_id(id) assert(can_node_valid_id(id), "Can node id can only be 10 bit.")
 
-typedef ENUM(uint32_t, can_node_work_req_t) {
+typedef ENUM(event_bits_t, can_node_work_req_t) {
 	kCanNodeWorkReqSensors = (1 << 0),
 	kCanNodeWorkReqOutput = (1 << 1),
 	kCanNodeWorkReqOutputResponse = (1 << 2),
 	kCanNodeWorkReqSaveConfig = (1 << 3),
+
+	kCanNodeWorkReqAll = kCanNodeWorkReqSensors | kCanNodeWorkReqOutput |
+		kCanNodeWorkReqOutputResponse | kCanNodeWorkReqSaveConfig,
+};
+
+typedef ENUM(uint8_t, can_node_reject_t) {
+	kCanNodeRejectNodeId,
+	kCanNodeRejectLength,
+	kCanNodeRejectIndex,
 };
 
 struct _output_src {
@@ -59,22 +69,23 @@ struct _output {
 
 struct _can_node {
 	can_node_id_t node_id;
-	struct semaphore sem;
-	can_node_work_req_t reqs;
+	// Work requests for can_node_loop
+	struct event reqs;
 	struct _output outputs[CAN_NODE_NUM_OUTPUT];
-};
 
-static struct _can_node can_node;
+	// Answers discovery requests outside of the isr
+	struct work discovery_work;
+	can_node_id_t discovery_to;
 
-static can_node_work_req_t can_node_fetch_clear_reqs()
-{
-	scheduler_lock();
-	can_node_work_req_t reqs = can_node.reqs;
-	can_node.reqs = 0;
-	scheduler_unlock();
+#if CAN_NODE_NUM_OUTPUT > 0
+	// Logs a rejected output frame outside of the isr
+	struct work reject_work;
+	can_node_reject_t reject;
+	uint32_t reject_value;
+#endif
+};
 
-	return reqs;
-}
+static struct _can_node can_node;
 
 static can_id_t can_id_build(can_node_id_t from, can_node_id_t to, can_node_topic_t topic)
 {
@@ -109,13 +120,28 @@ static void can_node_send_discovery_response(can_node_id_t to)
 	can_node_send(511, to, sizeof(data), data);
 }
 
-static void can_node_discovery_callback(const can_frame_t frame, void* context)
+static void can_node_discovery_work(work_t work)
 {
-	// TODO: better don't respond in the isr
+	scheduler_lock();
+	can_node_id_t to = can_node.discovery_to;
+	scheduler_unlock();
+
+	can_node_send_discovery_response(to);
+}
 
+static void can_node_discovery_callback(const can_frame_t frame, void* context)
+{
 	// Request
 	if ((frame.data[0] & (1 << 0)) == 0 && (can_id_extract_to(frame.id) == CAN_NODE_BROADCAST_ID || can_id_extract_to(frame.id) == can_node.node_id)) {
-		can_node_send_discovery_response(can_id_extract_from(frame.id));
+		can_node_id_t from = can_id_extract_from(frame.id);
+
+		// Requests of several nodes before we got to respond get a
+		// single broadcast response
+		if (can_node.discovery_work.pending && can_node.discovery_to != from)
+			from = CAN_NODE_BROADCAST_ID;
+
+		can_node.discovery_to = from;
+		work_submit(&can_node.discovery_work);
 	}
 }
 
@@ -138,13 +164,11 @@ static void can_node_sensor_callback(const can_frame_t frame, void* context)
 
 					if (src->state && value < conf->off_value) {
 						src->state = false;
-						can_node.reqs |= kCanNodeWorkReqOutput;
-						semaphore_signal(&can_node.sem);
+						event_set(&can_node.reqs, kCanNodeWorkReqOutput);
 					}
 					else if (!src->state && value > conf->on_value) {
 						src->state = true;
-						can_node.reqs |= kCanNodeWorkReqOutput;
-						semaphore_signal(&can_node.sem);
+						event_set(&can_node.reqs, kCanNodeWorkReqOutput);
 					}
 				}
 
@@ -154,28 +178,57 @@ static void can_node_sensor_callback(const can_frame_t frame, void* context)
 	}
 }
 
+static void can_node_reject_work(work_t work)
+{
+	scheduler_lock();
+	can_node_reject_t reject = can_node.reject;
+	uint32_t value = can_node.reject_value;
+	scheduler_unlock();
+
+	switch (reject) {
+	case kCanNodeRejectNodeId:
+		log(LOG_LEVEL_WARN, "Got output callback to an node other than use: %x", value);
+		break;
+	case kCanNodeRejectLength:
+		log(LOG_LEVEL_WARN, "Output frame has wrong length: %d", value);
+		break;
+	case kCanNodeRejectIndex:
+		log(LOG_LEVEL_WARN, "Output request for unkown output index: %d", value);
+		break;
+	}
+}
+
+// Only the latest rejection is logged when they come in faster
+static void can_node_output_reject(can_node_reject_t reject, uint32_t value)
+{
+	can_node.reject = reject;
+	can_node.reject_value = value;
+	work_submit(&can_node.reject_work);
+}
+
 static void can_node_output_callback(const can_frame_t frame, void* context)
 {
 	can_node_id_t to = can_id_extract_to(frame.id);
 
 	if (to != can_node.node_id) {
-		log(LOG_LEVEL_WARN, "Got output callback to an node other than use: %x", to);
+		can_node_output_reject(kCanNodeRejectNodeId, to);
 		return;
 	}
 
 	if (frame.data_length != 2) {
-		log(LOG_LEVEL_WARN, "Output frame has wrong length: %d", frame.data_length);
+		can_node_output_reject(kCanNodeRejectLength, frame.data_length);
 		return;
 	}
 
 	uint8_t idx = frame.data[0];
 
 	if (idx >= CAN_NODE_NUM_OUTPUT) {
-		log(LOG_LEVEL_WARN, "Output request for unkown output index: %d", idx);
+		can_node_output_reject(kCanNodeRejectIndex, idx);
 		return;
 	}
 
 	can_node_output_mode_t new_mode;
+	can_node_work_req_t reqs = kCanNodeWorkReqOutput | kCanNodeWorkReqOutputResponse;
 
 	// Manual flag is set
 	// so change output to desired state
@@ -191,11 +244,10 @@ static void can_node_output_callback(const can_frame_t frame, void* context)
 
 	if (new_mode != config.can_node.outputs[idx].mode) {
 		config.can_node.outputs[idx].mode = new_mode;
-		can_node.reqs |= kCanNodeWorkReqSaveConfig;
+		reqs |= kCanNodeWorkReqSaveConfig;
 	}
 
-	can_node.reqs |= kCanNodeWorkReqOutput | kCanNodeWorkReqOutputResponse;
-	semaphore_signal(&can_node.sem);
+	event_set(&can_node.reqs, reqs);
 }
 #endif
 
@@ -210,7 +262,11 @@ status_t can_node_init(can_node_id_t node_id, can_speed_t speed)
 
 	can_node.node_id = node_id;
 
-	semaphore_init(&can_node.sem, 0);
+	event_init(&can_node.reqs);
+	work_init(&can_node.discovery_work, can_node_discovery_work, THREAD_PRIORITY_DEFAULT);
+#if CAN_NODE_NUM_OUTPUT > 0
+	work_init(&can_node.reject_work, can_node_reject_work, THREAD_PRIORITY_DEFAULT);
+#endif
 
 	can_node_send_discovery_response(CAN_NODE_BROADCAST_ID);
 	can_set_receive_callback(can_id_build(CAN_NODE_BROADCAST_ID, CAN_NODE_BROADCAST_ID, 511),
@@ -331,8 +387,7 @@ static bool can_node_loop_publish_sensor(sensor_t sensor, void* context)
 
 static void can_node_post_sensor_req()
 {
-	can_node.reqs |= kCanNodeWorkReqSensors;
-	semaphore_signal(&can_node.sem);
+	event_set(&can_node.reqs, kCanNodeWorkReqSensors);
 }
 
 void can_node_loop()
@@ -340,9 +395,7 @@ void can_node_loop()
 	timer_managed_schedule(default_timer, config.can_node.sensor_interval, true, can_node_post_sensor_req, NULL);
 
 	for (;;) {
-		semaphore_wait(&can_node.sem);
-
-		can_node_work_req_t reqs = can_node_fetch_clear_reqs();
+		can_node_work_req_t reqs = event_wait(&can_node.reqs, kCanNodeWorkReqAll, EVENT_WAIT_CLEAR) & kCanNodeWorkReqAll;
 
 		if (reqs & kCanNodeWorkReqSensors) {
 			uint8_t idx = 0;
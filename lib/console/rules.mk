@@ -3,7 +3,8 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS := \
-	$(LOCAL_DIR)/console.c
+	$(LOCAL_DIR)/console.c \
+	$(LOCAL_DIR)/top_cmd.c
 
 GLOBAL_DEFINES += \
 	HAVE_CONSOLE=1
@@ -0,0 +1,103 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <console.h>
+#include <thread.h>
+#include <scheduler.h>
+#include <platform.h>
+#include <string.h>
+
+#if THREAD_STATISTICS
+
+// Time in ms over which the cpu usage is measured
+static const millitime_t kTopDefaultWindow = 1000;
+
+static int top_cmd(int argc, const char** argv)
+{
+  millitime_t window = kTopDefaultWindow;
+
+  if (argc > 1)
+    window = atoi(argv[1]);
+
+  if (window <= 0) {
+    printf("usage: top [window in ms]\r\n");
+    return -1;
+  }
+
+  size_t count = 0;
+  thread_t thread;
+
+  {
+    list_foreach_contained(thread, thread_list, struct thread, thread_list_entry)
+      count++;
+  }
+
+  // Threads created while measuring are left out
+  uint32_t run_times[count];
+  size_t i = 0;
+
+  uint32_t start = platform_timestamp();
+  {
+    list_foreach_contained(thread, thread_list, struct thread, thread_list_entry) {
+      if (i < count)
+        run_times[i++] = scheduler_thread_run_time(thread);
+    }
+  }
+
+  delay(window);
+
+  uint32_t elapsed = (platform_timestamp() - start) / 1000;
+  if (elapsed == 0) {
+    printf("no timestamps on this platform\r\n");
+    return -1;
+  }
+
+  printf("tid prio  cpu%%  switches  latency   stack name\r\n");
+
+  i = 0;
+  list_foreach_contained(thread, thread_list, struct thread, thread_list_entry) {
+    if (i >= count)
+      break;
+
+    // Per mille of the window
+    uint32_t load = (scheduler_thread_run_time(thread) - run_times[i++]) / elapsed;
+
+    printf("%3u %4u %3u.%u %9u %6uus ", thread->tid, thread->priority,
+      load / 10, load % 10, thread->statistics.switches, thread->statistics.max_latency);
+
+#if STACK_UTILISATION
+    if (thread->stack_protector)
+      printf("%7u ", thread_stack_utilisation(thread));
+    else
+#endif
+      printf("      - ");
+
+    printf("%s\r\n", thread->name);
+  }
+
+  return 0;
+}
+
+CONSOLE_CMD(top, top_cmd);
+
+#endif
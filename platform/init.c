@@ -23,6 +23,8 @@
 //
 
 #include <runtime.h>
+#include <arch.h>
+#include <platform.h>
 
 WEAK void platform_early_init()
 {
@@ -30,4 +32,16 @@ WEAK void platform_early_init()
 
 WEAK void platform_init()
 {
-}
\ No newline at end of file
+}
+
+// Sleep mode keeps the default timer running, so it works for any
+// idle time
+WEAK void platform_idle(millitime_t idle_time)
+{
+  arch_wait_for_interrupt();
+}
+
+WEAK uint32_t platform_timestamp()
+{
+  return 0;
+}
@@ -27,13 +27,15 @@
 #include <malloc.h>
 #include <log.h>
 #include <semaphore.h>
+#include <mutex.h>
+#include <work.h>
 #include <runtime.h>
 #include <platform/irq.h>
 
 #include "LPC11xx.h"
 
 struct i2c_dev {
-	struct semaphore lock;
+	struct mutex lock;
 
 	// Current transfer
 	struct semaphore done;
@@ -45,6 +47,11 @@ struct i2c_dev {
 	uint8_t* readBuffer;
 	size_t readBufferIndex;
 	size_t readBufferLength;
+
+	// Failed transfers are logged by error_work outside of the isr
+	struct work error_work;
+	uint8_t error_state;
+	i2c_addr_t error_addr;
 };
 
 enum CONSET {
@@ -67,8 +74,33 @@ static const uint32_t kSCLH = 0x180;
 // SCL Duty Cycle Low
 static const uint32_t kSCLL = 0x180;
 
+// Time in ms a transfer may take before the bus is considered stuck
+static const millitime_t kTransferTimeout = 100;
+
 static i2c_dev_t* global_dev;
 
+static void i2c_dev_error_work(work_t work)
+{
+	i2c_dev_t* dev = container_of(work, i2c_dev_t, error_work);
+
+	scheduler_lock();
+	uint8_t state = dev->error_state;
+	i2c_addr_t addr = dev->error_addr;
+	scheduler_unlock();
+
+	if (state == 0x20 || state == 0x48)
+		log(LOG_LEVEL_INFO, "Stop, no ack from %x", addr);
+	else
+		log(LOG_LEVEL_ERROR, "Unhandled I2C state: %x %u", addr, state);
+}
+
+static void i2c_dev_error(uint8_t state)
+{
+	global_dev->error_state = state;
+	global_dev->error_addr = global_dev->addr;
+	work_submit(&global_dev->error_work);
+}
+
 static void i2c_dev_isr(void)
 {
 	uint8_t state = LPC_I2C->STAT;
@@ -159,10 +191,10 @@ static void i2c_dev_isr(void)
 		LPC_I2C->CONCLR = kCONCLR_SIC;
 		global_dev->status = STATUS_ERR(0);
 		semaphore_signal(&global_dev->done);
-		log(LOG_LEVEL_INFO, "Stop %x %x", global_dev->writeBuffer[0], global_dev->writeBuffer[1]);
+		i2c_dev_error(state);
 		break;
 	default:
-		log(LOG_LEVEL_ERROR, "Unhandled I2C state: %x %u", global_dev->writeBuffer[0], state);
+		i2c_dev_error(state);
 		LPC_I2C->CONSET = kCONSET_STO;
 		LPC_I2C->CONCLR = kCONCLR_SIC;
 		global_dev->status = STATUS_ERR(0);
@@ -177,8 +209,9 @@ i2c_dev_t* i2c_dev_create()
 	if (!dev)
 		return NULL;
 
-	semaphore_init(&dev->lock, 1);
+	mutex_init(&dev->lock);
 	semaphore_init(&dev->done, 0);
+	work_init(&dev->error_work, i2c_dev_error_work, THREAD_PRIORITY_LOWEST);
 
 	LPC_SYSCON->PRESETCTRL |= (0x1<<1);
 
@@ -211,7 +244,13 @@ i2c_dev_t* i2c_dev_create()
 
 status_t i2c_dev_transfer(i2c_dev_t* dev, i2c_addr_t addr, const uint8_t* writeBuffer, size_t writeBufferLength, uint8_t* readBuffer, size_t readBufferLength)
 {
-	semaphore_wait(&dev->lock);
+	mutex_lock(&dev->lock);
+
+	// Drop a completion of an earlier transfer that came in after it
+	// timed out
+	while (semaphore_wait_timeout(&dev->done, 0) == STATUS_OK)
+		;
+
 	// Configure transfer
 	dev->addr = addr;
 	dev->writeBuffer = writeBuffer;
@@ -223,8 +262,17 @@ status_t i2c_dev_transfer(i2c_dev_t* dev, i2c_addr_t addr, const uint8_t* writeB
 	LPC_I2C->CONSET = kCONSET_STA;
 
 	// Wait for transfer to complete
-	semaphore_wait(&dev->done);
-	status_t status = dev->status;
-	semaphore_signal(&dev->lock);
+	status_t status = semaphore_wait_timeout(&dev->done, kTransferTimeout);
+
+	if (status == STATUS_OK) {
+		status = dev->status;
+	}
+	else {
+		// Release the bus, the caller may retry
+		LPC_I2C->CONSET = kCONSET_STO;
+		LPC_I2C->CONCLR = kCONCLR_SIC | kCONCLR_STAC;
+	}
+
+	mutex_unlock(&dev->lock);
 	return status;
 }
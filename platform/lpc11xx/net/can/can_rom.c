@@ -30,6 +30,9 @@
 #include <platform/clock.h>
 #include <scheduler.h>
 #include <semaphore.h>
+#include <mutex.h>
+#include <work.h>
+#include <ring.h>
 #include <string.h>
 
 #include "LPC11xx.h"
@@ -98,14 +101,32 @@ struct _lpc11_can_receive_conf {
 	void* context;
 };
 
+// Received frames waiting to be handed to the callbacks, more are dropped
+#define CAN_RX_SIZE 8
+
+struct _lpc11_can_rx {
+	can_frame_t frame;
+	uint8_t msgobj;
+};
+
 struct _can {
 	// LPC11 supports 32 message objects, msg object with id 0
 	// is reserved for sending.
 	struct _lpc11_can_receive_conf receive_conf[31];
 
-	struct semaphore send_lock;
-	struct semaphore send_done;
-	bool send_async;
+	// Filled by the isr, rx_work runs the callbacks
+	struct ring rx;
+	struct _lpc11_can_rx rx_buf[CAN_RX_SIZE];
+	struct work rx_work;
+
+	// Threads take turns on the message object, send_idle is
+	// given back by the interrupt once the frame is out.
+	struct mutex send_lock;
+	struct semaphore send_idle;
+
+	// Errors reported by the interrupt, printed by error_work
+	struct work error_work;
+	uint32_t error_info;
 };
 
 static struct _can can;
@@ -120,6 +141,23 @@ static can_rom_driver_t can_rom_driver;
 
 #define LPC11_CAN_EXT_FLAG 0x20000000UL
 
+// Time in ms a frame may take to go out before the bus is considered stuck
+static const millitime_t kSendTimeout = 100;
+
+static void can_rom_rx_work(work_t work)
+{
+	struct _lpc11_can_rx* rx;
+
+	while ((rx = ring_peek(&can.rx))) {
+		struct _lpc11_can_receive_conf* conf = &can.receive_conf[rx->msgobj - 1];
+
+		if (conf->callback)
+			conf->callback(rx->frame, conf->context);
+
+		ring_pop(&can.rx);
+	}
+}
+
 static void can_rom_callback_rx(uint8_t msg_obj_num)
 {
 	can_rom_msg_t msg;
@@ -127,31 +165,31 @@ static void can_rom_callback_rx(uint8_t msg_obj_num)
 	msg.msgobj = msg_obj_num;
 	can_rom_driver->can_receive(&msg);
 
-	struct _lpc11_can_receive_conf* conf = &can.receive_conf[msg_obj_num - 1];
+	struct _lpc11_can_rx* rx = ring_reserve(&can.rx);
 
-	if (conf->callback) {
-		can_frame_t frame;
+	if (!rx)
+		return;
 
-		frame.id = msg.mode_id;
-		frame.data_length = msg.dlc;
+	rx->msgobj = msg_obj_num;
+	rx->frame.id = msg.mode_id;
+	rx->frame.flags = 0;
+	rx->frame.data_length = msg.dlc;
 
-		if (msg.mode_id & LPC11_CAN_EXT_FLAG) {
-			frame.id &= ~LPC11_CAN_EXT_FLAG;
-			frame.flags = CAN_FRAME_FLAG_EXT;
-		}
-		memcpy(frame.data, msg.data, frame.data_length);
-		conf->callback(frame, conf->context);
+	if (msg.mode_id & LPC11_CAN_EXT_FLAG) {
+		rx->frame.id &= ~LPC11_CAN_EXT_FLAG;
+		rx->frame.flags = CAN_FRAME_FLAG_EXT;
 	}
+	memcpy(rx->frame.data, msg.data, rx->frame.data_length);
+
+	ring_push(&can.rx);
+	work_submit(&can.rx_work);
 }
 
 static void can_rom_callback_tx(uint8_t msg_obj_num)
 {
 	assert(msg_obj_num == 0, "Wrong tx callback?!");
 
-	semaphore_signal(&can.send_done);
-	if (can.send_async) {
-		semaphore_signal(&can.send_lock);
-	}
+	semaphore_signal(&can.send_idle);
 }
 
 #define CAN_ERROR_NONE 0x00000000UL
@@ -165,8 +203,13 @@ static void can_rom_callback_tx(uint8_t msg_obj_num)
 #define CAN_ERROR_BIT0 0x00000080UL 
 #define CAN_ERROR_CRC 0x00000100UL
 
-static void can_rom_callback_error(uint32_t error_info)
+static void can_rom_error_work(work_t work)
 {
+	scheduler_lock();
+	uint32_t error_info = can.error_info;
+	can.error_info = 0;
+	scheduler_unlock();
+
 	printf("CAN ERROR %x", error_info);
 
 	if (error_info & CAN_ERROR_PASS)
@@ -190,6 +233,13 @@ static void can_rom_callback_error(uint32_t error_info)
 	printf("\r\n");
 }
 
+static void can_rom_callback_error(uint32_t error_info)
+{
+	// Errors until the work runs are reported together
+	can.error_info |= error_info;
+	work_submit(&can.error_work);
+}
+
 static const can_rom_callbacks_t can_rom_callbacks = {
 	.rx = can_rom_callback_rx,
 	.tx = can_rom_callback_tx,
@@ -261,8 +311,11 @@ status_t can_init(can_speed_t speed)
 	// LPC_CAN->CNTL |= (1<<7);
 	// LPC_CAN->TEST |= (1<<4);
 
-	semaphore_init(&can.send_lock, 1);
-	semaphore_init(&can.send_done, 0);
+	mutex_init(&can.send_lock);
+	semaphore_init(&can.send_idle, 1);
+	work_init(&can.error_work, can_rom_error_work, THREAD_PRIORITY_LOWEST);
+	ring_init(&can.rx, can.rx_buf, sizeof(struct _lpc11_can_rx), CAN_RX_SIZE);
+	work_init(&can.rx_work, can_rom_rx_work, THREAD_PRIORITY_HIGHEST);
 
 	irq_enable(IRQ13);
 
@@ -276,10 +329,20 @@ void can_reset(can_speed_t speed)
 
 status_t can_send(const can_frame_t frame, can_flags_t flags)
 {
-	if (scheduler_in_isr())
+	bool in_isr = scheduler_in_isr();
+
+	if (in_isr)
 		flags |= CAN_FLAG_NOWAIT;
+	else
+		mutex_lock(&can.send_lock);
+
+	// An isr can't wait for the message object to become idle
+	if (semaphore_wait_timeout(&can.send_idle, in_isr ? 0 : kSendTimeout) != STATUS_OK) {
+		if (!in_isr)
+			mutex_unlock(&can.send_lock);
 
-	semaphore_wait(&can.send_lock);
+		return STATUS_TIMEOUT;
+	}
 
 	can_rom_msg_t send;
 	send.msgobj  = 0;
@@ -292,20 +355,23 @@ status_t can_send(const can_frame_t frame, can_flags_t flags)
 	send.dlc     = frame.data_length;
 	memcpy(&send.data, &frame.data, 8);
 
-	if (flags & CAN_FLAG_NOWAIT) {
-		can.send_async = true;
-		can_rom_driver->can_transmit(&send);
+	can_rom_driver->can_transmit(&send);
 
-		return STATUS_OK;
-	}
-	else {
-		can.send_async = false;
-		can_rom_driver->can_transmit(&send);
-		semaphore_wait(&can.send_done);
-		semaphore_signal(&can.send_lock);
+	status_t status = STATUS_OK;
 
-		return STATUS_OK;
+	if (!(flags & CAN_FLAG_NOWAIT)) {
+		// Wait for the frame to go out and leave the object idle. When it
+		// doesn't, the tx interrupt gives the object back once it does.
+		status = semaphore_wait_timeout(&can.send_idle, kSendTimeout);
+
+		if (status == STATUS_OK)
+			semaphore_signal(&can.send_idle);
 	}
+
+	if (!in_isr)
+		mutex_unlock(&can.send_lock);
+
+	return status;
 }
 
 status_t can_set_receive_callback(can_id_t id, can_id_t id_mask, can_frame_flag_t flags, can_receive_callback_t callback, void* context)
@@ -28,6 +28,8 @@
 #include "system_LPC11xx.h"
 #include <string.h>
 #include <semaphore.h>
+#include <mutex.h>
+#include <ring.h>
 #include <scheduler.h>
 #include <platform/irq.h>
 #include <log.h>
@@ -55,12 +57,19 @@ enum {
   kIIRReceiveDataAvailable = 0x4
 };
 
+// Bytes received while no one reads, more are dropped
+#define UART_RX_SIZE 32
+
 struct uart {
-  char read_buf;
+  // Filled by the isr, emptied by read_op
+  struct ring rx;
+  uint8_t rx_buf[UART_RX_SIZE];
+  // Set by a reader before it waits on read_sem
+  volatile bool read_waiting;
   struct semaphore read_sem;
-  struct semaphore read_lock;
+  struct mutex read_lock;
   struct semaphore write_sem;
-  struct semaphore write_lock;
+  struct mutex write_lock;
 };
 
 static struct uart uart;
@@ -70,9 +79,13 @@ static void uart_isr()
   uint32_t status = LPC_UART->IIR;
 
   if ((status & IIR_RBR) == IIR_RBR) {
-    LPC_UART->IER &= ~IER_RBR;
-    uart.read_buf = LPC_UART->RBR;
-    semaphore_signal(&uart.read_sem);
+    while (LPC_UART->LSR & LSR_RDR)
+      ring_put_byte(&uart.rx, LPC_UART->RBR);
+
+    if (uart.read_waiting) {
+      uart.read_waiting = false;
+      semaphore_signal(&uart.read_sem);
+    }
   }
   if ((status & IIR_THRE) == IIR_THRE) {
     semaphore_signal(&uart.write_sem);
@@ -107,7 +120,7 @@ void printk_init(uint32_t baud)
   }
 
   LPC_UART->LCR = 0x03;       /* DLAB = 0 */
-  LPC_UART->FCR = 0x07;     /* Enable and reset TX and RX FIFO. */
+  LPC_UART->FCR = 0x47;     /* Enable and reset TX and RX FIFO, interrupt at 4 bytes. */
 
   /* Read to clear the line status. */
   uint32_t regVal = LPC_UART->LSR;
@@ -124,13 +137,18 @@ void printk_init(uint32_t baud)
 //   // Enable interrupt
 //   NVIC_EnableIRQ(UART_IRQn);
 
+  ring_init(&uart.rx, uart.rx_buf, 1, UART_RX_SIZE);
   semaphore_init(&uart.read_sem, 0);
   semaphore_init(&uart.write_sem, 0);
-  semaphore_init(&uart.read_lock, 1);
-  semaphore_init(&uart.write_lock, 1);
+  mutex_init(&uart.read_lock);
+  mutex_init(&uart.write_lock);
 
   assert(irq_register(IRQ21, uart_isr), "Could not register uart irq");
   irq_enable(IRQ21);
+
+  // Receive in the background, the character timeout picks up the bytes
+  // below the fifo trigger level
+  LPC_UART->IER |= IER_RBR;
 }
 
 static int write_op(file_t f, const void* buf, size_t nbytes)
@@ -143,14 +161,14 @@ static int write_op(file_t f, const void* buf, size_t nbytes)
     }
   }
   else {
-    semaphore_wait(&uart.write_lock);
+    mutex_lock(&uart.write_lock);
     for (size_t i = 0; i < nbytes; i++, buf++) {
       LPC_UART->IER |= IER_THRE;
       semaphore_wait(&uart.write_sem);
       LPC_UART->THR = *(char*)buf;
       LPC_UART->IER &= ~IER_THRE;
     }
-    semaphore_signal(&uart.write_lock);
+    mutex_unlock(&uart.write_lock);
   }
   return nbytes;
 }
@@ -161,6 +179,9 @@ static int read_op(file_t f, void* buf, size_t nbytes)
 
   if (scheduler_in_isr()) {
     for (n = 0; n < nbytes; n++, buf++) {
+      if (ring_get_byte(&uart.rx, buf))
+        continue;
+
       while (!(LPC_UART->LSR & LSR_RDR))
         ;
 
@@ -168,14 +189,22 @@ static int read_op(file_t f, void* buf, size_t nbytes)
     }
   }
   else {
-    semaphore_wait(&uart.read_lock);
+    mutex_lock(&uart.read_lock);
     for (n = 0; n < nbytes; n++, buf++) {
-      LPC_UART->IER |= IER_RBR;
-      semaphore_wait(&uart.read_sem);
-
-      *(char *)buf = uart.read_buf;
+      while (!ring_get_byte(&uart.rx, buf)) {
+        uart.read_waiting = true;
+
+        // A byte may have come in before the flag was set
+        if (!ring_is_empty(&uart.rx)) {
+          uart.read_waiting = false;
+          continue;
+        }
+
+        // A stray signal only costs another look at the ring
+        semaphore_wait(&uart.read_sem);
+      }
     }
-    semaphore_signal(&uart.read_lock);
+    mutex_unlock(&uart.read_lock);
   }
 
   return n;
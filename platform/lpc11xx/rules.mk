@@ -18,6 +18,7 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/printk.c \
 	$(LOCAL_DIR)/i2c.c \
 	$(LOCAL_DIR)/adc.c \
+	$(LOCAL_DIR)/timestamp.c \
 	$(LOCAL_DIR)/CMSIS/src/core_cm0.c \
 	$(LOCAL_DIR)/CMSIS/src/system_LPC11xx.c 
 
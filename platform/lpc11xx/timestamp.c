@@ -0,0 +1,47 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <platform.h>
+#include <platform/clock.h>
+#include <fw/init.h>
+
+#include "LPC11xx.h"
+
+// CT32B1 runs freely at 1 MHz for platform_timestamp
+static void timestamp_init(fw_init_level_t level)
+{
+	// Enable CT32B1 clock
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1<<10);
+
+	LPC_TMR32B1->TCR = 0x2;
+	LPC_TMR32B1->PR = clock_get_main() / 1000000 - 1;
+	LPC_TMR32B1->MCR = 0;
+	LPC_TMR32B1->TCR = 0x1;
+}
+
+FW_INIT_HOOK(timestamp, kFWInitLevelEarliest, timestamp_init);
+
+uint32_t platform_timestamp()
+{
+	return LPC_TMR32B1->TC;
+}
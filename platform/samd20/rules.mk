@@ -16,6 +16,8 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/gpio.c \
 	$(LOCAL_DIR)/printk.c \
 	$(LOCAL_DIR)/pinmux.c \
+	$(LOCAL_DIR)/sleep.c \
+	$(LOCAL_DIR)/timestamp.c \
 	$(LOCAL_DIR)/cmsis/source/system_samd20.c
 
 GLOBAL_INCLUDES += \
@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <platform.h>
+#include <platform/clock.h>
+#include <platform/irq.h>
+#include <fw/init.h>
+#include <arch.h>
+
+// The RTC measures the time in standby, as SysTick stops there. It runs
+// from the ultra low power oscillator divided down to 1024 Hz.
+static const uint8_t kRTCGenerator = 2;
+static const uint32_t kRTCFrequency = 1024;
+
+// Waking up from standby takes the clocks a while to come back, shorter
+// idle times are spent in idle mode.
+static const millitime_t kStandbyMinTime = 50;
+
+static inline void sleep_rtc_sync()
+{
+  while (RTC->MODE0.STATUS.reg & RTC_STATUS_SYNCBUSY)
+    ;
+}
+
+static inline void sleep_gclk_sync()
+{
+  while (GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY)
+    ;
+}
+
+static void sleep_rtc_isr()
+{
+  RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP(1);
+}
+
+static void sleep_init(fw_init_level_t level)
+{
+  // 32768 Hz / 2^(4 + 1)
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID(kRTCGenerator) | GCLK_GENDIV_DIV(4);
+  sleep_gclk_sync();
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(kRTCGenerator) | GCLK_GENCTRL_SRC(GCLK_SOURCE_OSCULP32K) |
+    GCLK_GENCTRL_DIVSEL | GCLK_GENCTRL_GENEN | GCLK_GENCTRL_RUNSTDBY;
+  sleep_gclk_sync();
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID(RTC_GCLK_ID) | GCLK_CLKCTRL_GEN(kRTCGenerator) | GCLK_CLKCTRL_CLKEN;
+
+  PM->APBAMASK.reg |= PM_APBAMASK_RTC;
+
+  RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_MODE_COUNT32 | RTC_MODE0_CTRL_PRESCALER_DIV1;
+  sleep_rtc_sync();
+  RTC->MODE0.CTRL.reg |= RTC_MODE0_CTRL_ENABLE;
+  sleep_rtc_sync();
+
+  // Keep COUNT synchronized, so reading it doesn't stall
+  RTC->MODE0.READREQ.reg = RTC_READREQ_RREQ | RTC_READREQ_RCONT | RTC_READREQ_ADDR(RTC_MODE0_COUNT_OFFSET);
+
+  assert(irq_register(IRQ0 + RTC_IRQn, sleep_rtc_isr), "Could not register rtc irq");
+  irq_enable(IRQ0 + RTC_IRQn);
+  RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_CMP(1);
+}
+
+FW_INIT_HOOK(sleep, kFWInitLevelThreading, sleep_init);
+
+static void sleep_standby(millitime_t idle_time)
+{
+  timer_managed_suspend(default_timer);
+
+  uint32_t start = RTC->MODE0.COUNT.reg;
+
+  // Nothing to wake up for, only an interrupt ends the sleep then
+  if (idle_time >= 0) {
+    RTC->MODE0.COMP[0].reg = start + (uint64_t)idle_time * kRTCFrequency / 1000;
+    sleep_rtc_sync();
+  }
+
+  arch_wait_for_interrupt_deep();
+
+  millitime_t slept = (uint64_t)(RTC->MODE0.COUNT.reg - start) * 1000 / kRTCFrequency;
+
+  timer_managed_resume(default_timer, slept);
+}
+
+static bool sleep_source_runs_in_standby(uint8_t source)
+{
+  switch (source) {
+    case GCLK_SOURCE_OSCULP32K:
+      return true;
+    case GCLK_SOURCE_OSC8M:
+      return SYSCTRL->OSC8M.reg & SYSCTRL_OSC8M_RUNSTDBY;
+    case GCLK_SOURCE_OSC32K:
+      return SYSCTRL->OSC32K.reg & SYSCTRL_OSC32K_RUNSTDBY;
+    case GCLK_SOURCE_XOSC:
+      return SYSCTRL->XOSC.reg & SYSCTRL_XOSC_RUNSTDBY;
+    case GCLK_SOURCE_XOSC32K:
+      return SYSCTRL->XOSC32K.reg & SYSCTRL_XOSC32K_RUNSTDBY;
+    case GCLK_SOURCE_DFLL48M:
+      return SYSCTRL->DFLLCTRL.reg & SYSCTRL_DFLLCTRL_RUNSTDBY;
+    default:
+      return false;
+  }
+}
+
+// Whether the generic clock channel keeps ticking in standby, that is its
+// generator and the generator's source are configured to run there.
+static bool sleep_gclk_runs_in_standby(uint8_t channel)
+{
+  *((uint8_t*)&GCLK->CLKCTRL.reg) = channel;
+  uint8_t generator = GCLK->CLKCTRL.bit.GEN;
+
+  *((uint8_t*)&GCLK->GENCTRL.reg) = generator;
+  sleep_gclk_sync();
+  uint32_t genctrl = GCLK->GENCTRL.reg;
+
+  if (!(genctrl & GCLK_GENCTRL_RUNSTDBY))
+    return false;
+
+  return sleep_source_runs_in_standby((genctrl & GCLK_GENCTRL_SRC_Msk) >> GCLK_GENCTRL_SRC_Pos);
+}
+
+// Standby gates every generic clock that is not explicitly kept running,
+// which silently stops enabled peripherals like the UART receiver or the
+// timestamp counter. Only go there when all of them survive it.
+static bool sleep_standby_allowed()
+{
+  Sercom* const sercoms[] = SERCOM_INSTS;
+  for (uint8_t i = 0; i < sizeof(sercoms)/sizeof(*sercoms); i++) {
+    uint32_t ctrla = sercoms[i]->USART.CTRLA.reg;
+
+    if (!(ctrla & SERCOM_USART_CTRLA_ENABLE))
+      continue;
+
+    if (!(ctrla & SERCOM_USART_CTRLA_RUNSTDBY) || !sleep_gclk_runs_in_standby(SERCOM0_GCLK_ID_CORE + i))
+      return false;
+  }
+
+  // Two neighbouring TCs share one generic clock channel
+  Tc* const tcs[] = TC_INSTS;
+  for (uint8_t i = 0; i < sizeof(tcs)/sizeof(*tcs); i++) {
+    uint16_t ctrla = tcs[i]->COUNT16.CTRLA.reg;
+
+    if (!(ctrla & TC_CTRLA_ENABLE))
+      continue;
+
+    if (!(ctrla & TC_CTRLA_RUNSTDBY) || !sleep_gclk_runs_in_standby(TC0_GCLK_ID + i / 2))
+      return false;
+  }
+
+  return true;
+}
+
+void platform_idle(millitime_t idle_time)
+{
+  if ((idle_time >= 0 && idle_time < kStandbyMinTime) || !sleep_standby_allowed()) {
+    PM->SLEEP.reg = PM_SLEEP_IDLE(0);
+    arch_wait_for_interrupt();
+  }
+  else {
+    sleep_standby(idle_time);
+  }
+}
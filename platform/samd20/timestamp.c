@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <platform.h>
+#include <platform/clock.h>
+#include <fw/init.h>
+
+// TC4 and TC5 form a free running 32 bit counter for platform_timestamp,
+// clocked with 1 MHz from the 8 MHz oscillator.
+static const uint8_t kTimestampGenerator = 3;
+
+static inline void timestamp_gclk_sync()
+{
+  while (GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY)
+    ;
+}
+
+static inline void timestamp_tc_sync()
+{
+  while (TC4->COUNT32.STATUS.reg & TC_STATUS_SYNCBUSY)
+    ;
+}
+
+static void timestamp_init(fw_init_level_t level)
+{
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID(kTimestampGenerator) | GCLK_GENDIV_DIV(clock_get_source(CLOCK_SOURCE_OSC8M) / 1000000);
+  timestamp_gclk_sync();
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(kTimestampGenerator) | GCLK_GENCTRL_SRC(GCLK_SOURCE_OSC8M) | GCLK_GENCTRL_GENEN;
+  timestamp_gclk_sync();
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID(TC4_GCLK_ID) | GCLK_CLKCTRL_GEN(kTimestampGenerator) | GCLK_CLKCTRL_CLKEN;
+
+  PM->APBCMASK.reg |= PM_APBCMASK_TC4 | PM_APBCMASK_TC5;
+
+  TC4->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32;
+  timestamp_tc_sync();
+  TC4->COUNT32.CTRLA.reg |= TC_CTRLA_ENABLE;
+  timestamp_tc_sync();
+
+  // Keep COUNT synchronized, so reading it doesn't stall
+  TC4->COUNT32.READREQ.reg = TC_READREQ_RREQ | TC_READREQ_RCONT | TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+}
+
+FW_INIT_HOOK(timestamp, kFWInitLevelEarliest, timestamp_init);
+
+uint32_t platform_timestamp()
+{
+  return TC4->COUNT32.COUNT.reg;
+}
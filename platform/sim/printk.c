@@ -23,13 +23,28 @@
 //
 
 #include "printk.h"
+#include "semihosting.h"
+
+static uint32_t console = -1;
+
+static int read_op(file_t f, void* buf, size_t nbytes)
+{
+  uint32_t args[3] = { console, (uint32_t)buf, nbytes };
+
+  // Returns the number of bytes not read
+  return nbytes - semihosting_call(SYS_READ, args);
+}
 
 static int write_op(file_t f, const void* buf, size_t nbytes)
 {
-  return 0;
+  uint32_t args[3] = { console, (uint32_t)buf, nbytes };
+
+  // Returns the number of bytes not written
+  return nbytes - semihosting_call(SYS_WRITE, args);
 }
 
 static const struct file_operations ops = {
+  .read = read_op,
   .write = write_op,
 };
 
@@ -41,8 +56,13 @@ file_t debug_serial = &_debug_serial;
 
 void printk_init(uint32_t baud)
 {
+  static const char name[] = ":tt";
+  uint32_t args[3] = { (uint32_t)name, SYS_OPEN_MODE_W, sizeof(name) - 1 };
+
+  console = semihosting_call(SYS_OPEN, args);
 }
 
 void printk(const char* str)
 {
+  semihosting_call(SYS_WRITE0, str);
 }
@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+/// ARM semihosting operations understood by the simulator
+enum {
+	SYS_OPEN          = 0x01,
+	SYS_CLOSE         = 0x02,
+	SYS_WRITE0        = 0x04,
+	SYS_WRITE         = 0x05,
+	SYS_READ          = 0x06,
+	SYS_CLOCK         = 0x10,
+	SYS_EXIT          = 0x18,
+	SYS_EXIT_EXTENDED = 0x20,
+};
+
+/// Modes for SYS_OPEN, these are the fopen modes
+enum {
+	SYS_OPEN_MODE_R = 0,
+	SYS_OPEN_MODE_W = 4,
+	SYS_OPEN_MODE_A = 8,
+};
+
+/// Traps into the host
+///
+/// @param op the operation to perform
+/// @param arg the argument of the operation, mostly a pointer
+///		to a block of parameters
+///
+/// @return the result of the operation
+static inline uint32_t semihosting_call(uint32_t op, const void* arg)
+{
+	register uint32_t r0 __asm("r0") = op;
+	register const void* r1 __asm("r1") = arg;
+
+	__asm volatile ("bkpt 0xAB" : "+r" (r0) : "r" (r1) : "memory");
+
+	return r0;
+}
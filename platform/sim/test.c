@@ -31,7 +31,11 @@ enum {
 	STATUS_OFFSET       = 0x12,
 	STATUS_DESC_OFFSET  = 0x16,
 
-	SIZE                = 0x20,
+	CYCLES_LOW_OFFSET   = 0x20,
+	CYCLES_HIGH_OFFSET  = 0x24,
+	REPORT_CYCLES_OFFSET = 0x28,
+
+	SIZE                = 0x30,
 };
 
 enum {
@@ -63,6 +67,20 @@ void arch_test_set_desc(const char* desc)
 	UNITTEST(STATUS_OFFSET) = STATUS_RUNNING;
 }
 
+uint64_t arch_test_get_cycles()
+{
+	// Reading the low word latches the high word
+	uint32_t low = UNITTEST(CYCLES_LOW_OFFSET);
+	uint32_t high = UNITTEST(CYCLES_HIGH_OFFSET);
+
+	return ((uint64_t)high << 32) | low;
+}
+
+void arch_test_report_cycles(uint32_t cycles)
+{
+	UNITTEST(REPORT_CYCLES_OFFSET) = cycles;
+}
+
 void arch_test_skip(const char* reason)
 {
 	UNITTEST(STATUS_DESC_OFFSET) = (uint32_t)reason;
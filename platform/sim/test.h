@@ -32,6 +32,12 @@ int32_t arch_test_get_test_current();
 
 void arch_test_set_desc(const char* desc);
 
+/// Returns the cycles the simulated cpu executed since it was created
+uint64_t arch_test_get_cycles();
+
+/// Reports a measured number of cycles together with the test result
+void arch_test_report_cycles(uint32_t cycles);
+
 void arch_test_skip(const char* reason) NO_RETURN;
 void arch_test_pass(const char* reason) NO_RETURN;
 void arch_test_fail(const char* reason) NO_RETURN;
@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <test.h>
+#include <malloc.h>
+
+#ifdef TESTS_SUPPORTED
+
+enum {
+	BENCH_ITERATIONS = 32,
+	BENCH_SIZE = 24,
+};
+
+static void bench_malloc_raw() {
+	void* blocks[BENCH_ITERATIONS];
+
+	uint64_t start = test_cycles();
+
+	for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+		blocks[i] = malloc_raw(BENCH_SIZE);
+		test_assert(blocks[i] != NULL, "malloc_raw failed");
+	}
+
+	for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+		free_raw(blocks[i], BENCH_SIZE);
+
+	test_report_cycles((test_cycles() - start) / BENCH_ITERATIONS);
+}
+
+DECLARE_TEST("malloc_raw/free_raw cycles per pair", TEST_IN_MAIN_TASK, bench_malloc_raw);
+
+static void bench_test_cycles() {
+	uint64_t first = test_cycles();
+	uint64_t second = test_cycles();
+
+	test_assert(second > first, "cycle counter does not advance");
+
+	test_report_cycles(second - first);
+}
+
+DECLARE_TEST("cycle counter overhead", TEST_AFTER_ARCH_LATE_INIT, bench_test_cycles);
+
+#endif // TESTS_SUPPORTED
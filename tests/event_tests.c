@@ -0,0 +1,221 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <test.h>
+#include <event.h>
+#include <thread.h>
+#include <scheduler.h>
+
+#ifdef TESTS_SUPPORTED
+
+enum {
+	EVENT_TEST_STACK_SIZE = 512,
+};
+
+struct event_test_waiter {
+	event_t event;
+	event_bits_t bits;
+	event_wait_flags_t flags;
+	millitime_t timeout;
+	event_bits_t result;
+	bool done;
+};
+
+static void event_test_wait(struct event_test_waiter* waiter) {
+	waiter->result = event_wait_timeout(waiter->event, waiter->bits, waiter->flags, waiter->timeout);
+	waiter->done = true;
+
+	// Threads can't return, nobody wakes this one up again
+	thread_block();
+}
+
+static void event_test_set_later(event_t event) {
+	delay(5);
+	event_set(event, 1 << 0);
+
+	thread_block();
+}
+
+struct event_test_notified {
+	uint32_t bits;
+	bool done;
+};
+
+static void event_test_notify_wait(struct event_test_notified* notified) {
+	notified->bits = thread_notify_wait();
+	notified->done = true;
+
+	thread_block();
+}
+
+static thread_t event_test_thread(entry_func func, void* arg) {
+	thread_t thread = thread_create("event test", EVENT_TEST_STACK_SIZE, NULL);
+
+	test_assert(thread != NULL, "Could not create a thread");
+
+	// Runs right away until it blocks
+	thread_set_function(thread, func, 1, arg);
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT + 1);
+	thread_wakeup(thread);
+
+	return thread;
+}
+
+static void test_event_wait_any() {
+	struct event event;
+	struct event_test_waiter waiter = { .event = &event, .bits = (1 << 0) | (1 << 1), .timeout = TIMEOUT_FOREVER };
+
+	event_init(&event);
+	event_test_thread(event_test_wait, &waiter);
+
+	event_set(&event, 1 << 2);
+	test_assert(!waiter.done, "Waiter should ignore other flags");
+
+	event_set(&event, 1 << 1);
+	test_assert(waiter.done, "Waiter should wake up on any of its flags");
+	test_assert(waiter.result == ((1 << 1) | (1 << 2)), "Waiter should see all flags set");
+	test_assert(event_get(&event) == ((1 << 1) | (1 << 2)), "Flags should stay set");
+
+	event_cleanup(&event);
+}
+
+DECLARE_TEST("test event wait any", TEST_IN_MAIN_TASK, test_event_wait_any);
+
+static void test_event_wait_all() {
+	struct event event;
+	struct event_test_waiter waiter = { .event = &event, .bits = (1 << 0) | (1 << 1), .flags = EVENT_WAIT_ALL, .timeout = TIMEOUT_FOREVER };
+
+	event_init(&event);
+	event_test_thread(event_test_wait, &waiter);
+
+	event_set(&event, 1 << 0);
+	test_assert(!waiter.done, "Waiter should wait for all of its flags");
+
+	event_set(&event, 1 << 1);
+	test_assert(waiter.done, "Waiter should wake up once all of its flags are set");
+	test_assert(waiter.result == ((1 << 0) | (1 << 1)), "Waiter should see its flags set");
+
+	event_cleanup(&event);
+}
+
+DECLARE_TEST("test event wait all", TEST_IN_MAIN_TASK, test_event_wait_all);
+
+static void test_event_wait_clear() {
+	struct event event;
+	struct event_test_waiter waiter = { .event = &event, .bits = (1 << 0) | (1 << 1), .flags = EVENT_WAIT_ALL | EVENT_WAIT_CLEAR, .timeout = TIMEOUT_FOREVER };
+
+	event_init(&event);
+
+	event_set(&event, 1 << 0);
+	test_assert(event_wait(&event, 1 << 0, EVENT_WAIT_CLEAR) == (1 << 0), "Wait for a set flag should return right away");
+	test_assert(event_get(&event) == 0, "Wait should clear the flag on exit");
+
+	event_test_thread(event_test_wait, &waiter);
+
+	event_set(&event, (1 << 0) | (1 << 2));
+	test_assert(!waiter.done, "Waiter should wait for all of its flags");
+
+	event_set(&event, 1 << 1);
+	test_assert(waiter.done, "Waiter should wake up once all of its flags are set");
+	test_assert(waiter.result == ((1 << 0) | (1 << 1) | (1 << 2)), "Waiter should see the flags before they are cleared");
+	test_assert(event_get(&event) == (1 << 2), "Only the flags waited for should be cleared");
+
+	event_cleanup(&event);
+}
+
+DECLARE_TEST("test event clear on exit", TEST_IN_MAIN_TASK, test_event_wait_clear);
+
+static void test_event_multiple_waiters() {
+	struct event event;
+	struct event_test_waiter first = { .event = &event, .bits = 1 << 0, .flags = EVENT_WAIT_CLEAR, .timeout = TIMEOUT_FOREVER };
+	struct event_test_waiter second = { .event = &event, .bits = 1 << 0, .flags = EVENT_WAIT_CLEAR, .timeout = TIMEOUT_FOREVER };
+	struct event_test_waiter third = { .event = &event, .bits = 1 << 1, .timeout = TIMEOUT_FOREVER };
+
+	event_init(&event);
+
+	event_test_thread(event_test_wait, &first);
+	event_test_thread(event_test_wait, &second);
+	event_test_thread(event_test_wait, &third);
+
+	// Both see the flag, even though the first one clears it
+	event_set(&event, 1 << 0);
+	test_assert(first.done && first.result == (1 << 0), "First waiter should see the flag");
+	test_assert(second.done && second.result == (1 << 0), "Second waiter should see the flag as well");
+	test_assert(!third.done, "Waiter for another flag should keep waiting");
+	test_assert(event_get(&event) == 0, "Flag should be cleared after all waiters saw it");
+
+	event_set(&event, 1 << 1);
+	test_assert(third.done && third.result == (1 << 1), "Third waiter should see its flag");
+
+	event_cleanup(&event);
+}
+
+DECLARE_TEST("test event multiple waiters", TEST_IN_MAIN_TASK, test_event_multiple_waiters);
+
+static void test_event_wait_timeout() {
+	struct event event;
+	event_bits_t result;
+
+	event_init(&event);
+
+	test_assert(event_wait_timeout(&event, 1 << 0, 0, 0) == 0, "Wait without a timeout should fail right away");
+	test_assert(event_wait_timeout(&event, 1 << 0, 0, 10) == 0, "Wait for a flag never set should time out");
+	test_assert(list_is_empty(&event.queue), "Timed out waiter should leave the event");
+
+	event_set(&event, 1 << 0);
+	scheduler_enter_isr();
+	result = event_wait_timeout(&event, 1 << 0, EVENT_WAIT_CLEAR, 0);
+	scheduler_leave_isr();
+	test_assert(result == (1 << 0), "Wait for a set flag in an isr failed");
+	test_assert(event_get(&event) == 0, "Wait in an isr should clear the flag on exit");
+
+	event_test_thread(event_test_set_later, &event);
+
+	test_assert(event_wait_timeout(&event, 1 << 0, 0, 1000) == (1 << 0), "Wait for a flag set in time failed");
+
+	event_cleanup(&event);
+}
+
+DECLARE_TEST("test event wait timeout", TEST_IN_MAIN_TASK, test_event_wait_timeout);
+
+static void test_thread_notify() {
+	struct event_test_notified notified = {};
+
+	thread_t thread = event_test_thread(event_test_notify_wait, &notified);
+	test_assert(!notified.done, "Thread should wait for a notification");
+
+	thread_notify(thread, (1 << 0) | (1 << 2));
+	test_assert(notified.done, "Notification should wake the thread");
+	test_assert(notified.bits == ((1 << 0) | (1 << 2)), "Thread got the wrong notification");
+	test_assert(thread->notify_bits == 0, "Notification should be taken");
+
+	// A notification while not waiting is kept for the next wait
+	thread_notify(scheduler_current_thread(), 1 << 1);
+	thread_notify(scheduler_current_thread(), 1 << 3);
+	test_assert(thread_notify_wait() == ((1 << 1) | (1 << 3)), "Pending notifications should be returned right away");
+}
+
+DECLARE_TEST("test thread notify", TEST_IN_MAIN_TASK, test_thread_notify);
+
+#endif // TESTS_SUPPORTED
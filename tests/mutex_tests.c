@@ -0,0 +1,139 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <test.h>
+#include <mutex.h>
+#include <thread.h>
+#include <scheduler.h>
+
+#ifdef TESTS_SUPPORTED
+
+enum {
+	MUTEX_TEST_STACK_SIZE = 512,
+	MUTEX_TEST_PRIORITY_MEDIUM = THREAD_PRIORITY_DEFAULT + 1,
+	MUTEX_TEST_PRIORITY_HIGH = THREAD_PRIORITY_DEFAULT + 2,
+};
+
+struct mutex_test_locker {
+	mutex_t mutex;
+	bool owned;
+	bool done;
+};
+
+static void mutex_test_lock(struct mutex_test_locker* locker) {
+	mutex_lock(locker->mutex);
+	locker->owned = locker->mutex->owner == scheduler_current_thread();
+	mutex_unlock(locker->mutex);
+	locker->done = true;
+
+	// Threads can't return, nobody wakes this one up again
+	thread_block();
+}
+
+static void mutex_test_run(bool* ran) {
+	*ran = true;
+
+	thread_block();
+}
+
+static void mutex_test_thread(entry_func func, void* arg, thread_priority_t priority) {
+	thread_t thread = thread_create("mutex test", MUTEX_TEST_STACK_SIZE, NULL);
+
+	test_assert(thread != NULL, "Could not create a thread");
+
+	// Runs right away until it blocks, when it outranks the caller
+	thread_set_function(thread, func, 1, arg);
+	thread_set_priority(thread, priority);
+	thread_wakeup(thread);
+}
+
+static void test_mutex_priority_inheritance() {
+	thread_t thread = scheduler_current_thread();
+	struct mutex mutex;
+	struct mutex_test_locker high = { .mutex = &mutex };
+	bool medium_ran = false;
+
+	mutex_init(&mutex);
+	mutex_lock(&mutex);
+
+	test_assert(thread->priority == THREAD_PRIORITY_DEFAULT, "Owner should run at its own priority while nobody waits");
+
+	mutex_test_thread(mutex_test_lock, &high, MUTEX_TEST_PRIORITY_HIGH);
+
+	test_assert(!high.done, "High priority thread should wait for the mutex");
+	test_assert(thread->priority == MUTEX_TEST_PRIORITY_HIGH, "Owner should inherit the priority of the waiter");
+	test_assert(thread->base_priority == THREAD_PRIORITY_DEFAULT, "Inheriting should leave the base priority alone");
+
+	// Would preempt the owner without the inherited priority
+	mutex_test_thread(mutex_test_run, &medium_ran, MUTEX_TEST_PRIORITY_MEDIUM);
+	test_assert(!medium_ran, "Medium priority thread should not run ahead of the boosted owner");
+
+	// Hands the mutex over, after which both threads outrank us again
+	mutex_unlock(&mutex);
+
+	test_assert(high.done && high.owned, "Mutex should have been handed over to the waiter");
+	test_assert(medium_ran, "Medium priority thread should run once the owner dropped its priority");
+	test_assert(thread->priority == THREAD_PRIORITY_DEFAULT, "Owner should drop back to its base priority");
+	test_assert(mutex.owner == NULL, "Mutex should be unlocked");
+
+	mutex_cleanup(&mutex);
+}
+
+DECLARE_TEST("test mutex priority inheritance", TEST_IN_MAIN_TASK, test_mutex_priority_inheritance);
+
+static void test_mutex_priority_drop() {
+	thread_t thread = scheduler_current_thread();
+	struct mutex contended, other;
+	struct mutex_test_locker high = { .mutex = &contended };
+
+	mutex_init(&contended);
+	mutex_init(&other);
+	mutex_lock(&contended);
+	mutex_lock(&other);
+
+	mutex_test_thread(mutex_test_lock, &high, MUTEX_TEST_PRIORITY_HIGH);
+	test_assert(thread->priority == MUTEX_TEST_PRIORITY_HIGH, "Owner should inherit the priority of the waiter");
+
+	// The priority is still inherited through the other mutex
+	mutex_unlock(&other);
+	test_assert(thread->priority == MUTEX_TEST_PRIORITY_HIGH, "Unlocking an uncontended mutex should keep the inherited priority");
+
+	// Only takes effect once nothing is inherited anymore
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT - 1);
+	test_assert(thread->priority == MUTEX_TEST_PRIORITY_HIGH, "Lowering the base priority should keep the inherited priority");
+	test_assert(thread->base_priority == THREAD_PRIORITY_DEFAULT - 1, "Base priority should change");
+
+	mutex_unlock(&contended);
+	test_assert(high.done && high.owned, "Mutex should have been handed over to the waiter");
+	test_assert(thread->priority == THREAD_PRIORITY_DEFAULT - 1, "Owner should drop to its new base priority");
+
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT);
+
+	mutex_cleanup(&contended);
+	mutex_cleanup(&other);
+}
+
+DECLARE_TEST("test mutex priority drop on unlock", TEST_IN_MAIN_TASK, test_mutex_priority_drop);
+
+#endif // TESTS_SUPPORTED
@@ -0,0 +1,202 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <test.h>
+#include <queue.h>
+#include <thread.h>
+#include <scheduler.h>
+
+#ifdef TESTS_SUPPORTED
+
+enum {
+	QUEUE_SLOTS = 3,
+	QUEUE_TEST_STACK_SIZE = 512,
+};
+
+struct queue_test_receiver {
+	queue_t queue;
+	millitime_t timeout;
+	status_t status;
+	uint32_t message;
+	bool done;
+};
+
+static void queue_test_receive(struct queue_test_receiver* receiver) {
+	receiver->status = queue_receive(receiver->queue, &receiver->message, receiver->timeout);
+	receiver->done = true;
+
+	// Threads can't return, nobody wakes this one up again
+	thread_block();
+}
+
+static void queue_test_send_later(queue_t queue) {
+	uint32_t message = 42;
+
+	delay(5);
+	queue_send(queue, &message, TIMEOUT_FOREVER);
+
+	thread_block();
+}
+
+static void queue_test_thread(entry_func func, void* arg) {
+	thread_t thread = thread_create("queue test", QUEUE_TEST_STACK_SIZE, NULL);
+
+	test_assert(thread != NULL, "Could not create a thread");
+
+	// Runs right away until it blocks
+	thread_set_function(thread, func, 1, arg);
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT + 1);
+	thread_wakeup(thread);
+}
+
+static void test_queue_commit_out_of_order() {
+	struct queue queue;
+	uint32_t slots[QUEUE_SLOTS];
+	uint32_t message;
+
+	queue_init(&queue, slots, sizeof(uint32_t), QUEUE_SLOTS);
+
+	uint32_t* a = queue_reserve(&queue, 0);
+	uint32_t* b = queue_reserve(&queue, 0);
+	uint32_t* c = queue_reserve(&queue, 0);
+
+	test_assert(a && b && c, "Reserving the free slots failed");
+	test_assert(queue_reserve(&queue, 0) == NULL, "Reserve with every slot reserved should fail");
+
+	*c = 3;
+	queue_commit(&queue, c);
+	test_assert(queue_count(&queue) == 0, "Slot committed before an earlier reservation should not be ready");
+
+	*a = 1;
+	queue_commit(&queue, a);
+	test_assert(queue_count(&queue) == 1, "Only the first slot should be ready");
+
+	*b = 2;
+	queue_commit(&queue, b);
+	test_assert(queue_count(&queue) == 3, "Every slot should be ready");
+	test_assert(queue.committed == 0, "No slot should be left waiting for an earlier one");
+
+	for (uint32_t i = 1; i <= QUEUE_SLOTS; i++) {
+		test_assert(queue_receive(&queue, &message, 0) == STATUS_OK, "Receive from a filled queue failed");
+		test_assert(message == i, "Messages should arrive in reservation order");
+	}
+
+	queue_cleanup(&queue);
+}
+
+DECLARE_TEST("test queue commit out of order", TEST_IN_MAIN_TASK, test_queue_commit_out_of_order);
+
+static void test_queue_post_full_in_isr() {
+	struct queue queue;
+	uint32_t slots[QUEUE_SLOTS];
+	uint32_t message;
+	status_t status;
+
+	queue_init(&queue, slots, sizeof(uint32_t), QUEUE_SLOTS);
+
+	for (message = 0; message < QUEUE_SLOTS; message++)
+		test_assert(queue_post(&queue, &message) == STATUS_OK, "Post to a queue with space failed");
+
+	message = 42;
+	scheduler_enter_isr();
+	status = queue_post(&queue, &message);
+	scheduler_leave_isr();
+
+	test_assert(status == STATUS_TIMEOUT, "Post to a full queue from an isr should time out");
+	test_assert(queue_count(&queue) == QUEUE_SLOTS, "Failed post should not change the queue");
+
+	test_assert(queue_receive(&queue, &message, 0) == STATUS_OK, "Receive from a full queue failed");
+	test_assert(message == 0, "Failed post should not overwrite a message");
+
+	message = 42;
+	scheduler_enter_isr();
+	status = queue_post(&queue, &message);
+	scheduler_leave_isr();
+
+	test_assert(status == STATUS_OK, "Post from an isr with a free slot failed");
+	test_assert(queue_count(&queue) == QUEUE_SLOTS, "Post from an isr did not add the message");
+
+	queue_cleanup(&queue);
+}
+
+DECLARE_TEST("test queue post to a full queue in an isr", TEST_IN_MAIN_TASK, test_queue_post_full_in_isr);
+
+static void test_queue_receive_timeout() {
+	struct queue queue;
+	uint32_t slots[QUEUE_SLOTS];
+	uint32_t message = 0;
+
+	queue_init(&queue, slots, sizeof(uint32_t), QUEUE_SLOTS);
+
+	test_assert(queue_receive(&queue, &message, 0) == STATUS_TIMEOUT, "Receive from an empty queue should fail right away");
+	test_assert(queue_receive(&queue, &message, 10) == STATUS_TIMEOUT, "Receive from an empty queue should time out");
+	test_assert(list_is_empty(&queue.receivers), "Timed out receiver should leave the queue");
+
+	queue_test_thread(queue_test_send_later, &queue);
+
+	test_assert(queue_receive(&queue, &message, 1000) == STATUS_OK, "Receive of a message sent in time failed");
+	test_assert(message == 42, "Received the wrong message");
+
+	queue_cleanup(&queue);
+}
+
+DECLARE_TEST("test queue receive timeout", TEST_IN_MAIN_TASK, test_queue_receive_timeout);
+
+static void test_queue_receiver_handoff() {
+	struct queue queue;
+	uint32_t slots[QUEUE_SLOTS];
+	struct queue_test_receiver first = { .queue = &queue, .timeout = TIMEOUT_FOREVER };
+	struct queue_test_receiver second = { .queue = &queue, .timeout = TIMEOUT_FOREVER };
+
+	queue_init(&queue, slots, sizeof(uint32_t), QUEUE_SLOTS);
+
+	queue_test_thread(queue_test_receive, &first);
+	queue_test_thread(queue_test_receive, &second);
+
+	test_assert(!first.done && !second.done, "Receivers should wait for a message");
+
+	uint32_t* a = queue_reserve(&queue, 0);
+	uint32_t* b = queue_reserve(&queue, 0);
+
+	*b = 2;
+	queue_commit(&queue, b);
+	test_assert(!first.done && !second.done, "Receivers should still wait for the earlier reservation");
+
+	// Makes two messages ready at once, but wakes only the first receiver,
+	// which has to pass the wakeup on to the second one
+	*a = 1;
+	queue_commit(&queue, a);
+
+	test_assert(first.done && first.status == STATUS_OK, "First receiver got no message");
+	test_assert(first.message == 1, "First receiver got the wrong message");
+	test_assert(second.done && second.status == STATUS_OK, "Second receiver got no message");
+	test_assert(second.message == 2, "Second receiver got the wrong message");
+	test_assert(queue_count(&queue) == 0, "Queue should be empty");
+
+	queue_cleanup(&queue);
+}
+
+DECLARE_TEST("test queue hands wakeups on to the next receiver", TEST_IN_MAIN_TASK, test_queue_receiver_handoff);
+
+#endif // TESTS_SUPPORTED
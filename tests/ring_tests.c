@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <test.h>
+#include <ring.h>
+
+#ifdef TESTS_SUPPORTED
+
+enum {
+	RING_COUNT = 4,
+};
+
+static void test_ring_fill() {
+	struct ring ring;
+	uint32_t records[RING_COUNT];
+	uint32_t value;
+
+	ring_init(&ring, records, sizeof(uint32_t), RING_COUNT);
+
+	test_assert(ring_is_empty(&ring), "New ring should be empty");
+	test_assert(ring_count(&ring) == 0, "New ring should have no records");
+
+	for (uint32_t i = 0; i < RING_COUNT; i++) {
+		test_assert(!ring_is_full(&ring), "Ring should not be full yet");
+		test_assert(ring_put(&ring, &i), "Put into a ring with space failed");
+		test_assert(ring_count(&ring) == i + 1, "Ring count is wrong");
+	}
+
+	test_assert(ring_is_full(&ring), "Ring should be full");
+
+	for (uint32_t i = 0; i < RING_COUNT; i++) {
+		test_assert(ring_get(&ring, &value), "Get from a filled ring failed");
+		test_assert(value == i, "Records should come out in order");
+	}
+
+	test_assert(ring_is_empty(&ring), "Ring should be empty again");
+}
+
+DECLARE_TEST("test ring fill", TEST_AFTER_ARCH_LATE_INIT, test_ring_fill);
+
+static void test_ring_full() {
+	struct ring ring;
+	uint32_t records[RING_COUNT];
+	uint32_t value = 0;
+
+	ring_init(&ring, records, sizeof(uint32_t), RING_COUNT);
+
+	for (uint32_t i = 0; i < RING_COUNT; i++)
+		ring_put(&ring, &i);
+
+	value = 42;
+	test_assert(!ring_put(&ring, &value), "Put into a full ring should fail");
+	test_assert(ring_reserve(&ring) == NULL, "Reserve in a full ring should fail");
+	test_assert(ring_count(&ring) == RING_COUNT, "Failed put should not change the ring");
+
+	test_assert(ring_get(&ring, &value), "Get from a full ring failed");
+	test_assert(value == 0, "Failed put should not overwrite the oldest record");
+
+	value = 42;
+	test_assert(ring_put(&ring, &value), "Put after a get should succeed");
+}
+
+DECLARE_TEST("test ring push when full", TEST_AFTER_ARCH_LATE_INIT, test_ring_full);
+
+static void test_ring_empty() {
+	struct ring ring;
+	uint8_t records[RING_COUNT];
+	uint8_t byte = 42;
+
+	ring_init(&ring, records, sizeof(uint8_t), RING_COUNT);
+
+	test_assert(ring_peek(&ring) == NULL, "Peek into an empty ring should fail");
+	test_assert(!ring_get(&ring, &byte), "Get from an empty ring should fail");
+	test_assert(!ring_get_byte(&ring, &byte), "Get byte from an empty ring should fail");
+	test_assert(byte == 42, "Failed get should not touch the record");
+
+	test_assert(ring_put_byte(&ring, 7), "Put byte failed");
+	test_assert(ring_get_byte(&ring, &byte), "Get byte failed");
+	test_assert(byte == 7, "Got the wrong byte");
+
+	test_assert(!ring_get_byte(&ring, &byte), "Get byte from an emptied ring should fail");
+	test_assert(ring_count(&ring) == 0, "Failed get should not change the ring");
+}
+
+DECLARE_TEST("test ring pop when empty", TEST_AFTER_ARCH_LATE_INIT, test_ring_empty);
+
+static void test_ring_wrap_around() {
+	struct ring ring;
+	uint32_t records[RING_COUNT];
+	uint32_t value;
+
+	ring_init(&ring, records, sizeof(uint32_t), RING_COUNT);
+
+	// Run the indices around the ring a few times, keeping it partly
+	// filled so records straddle the end of the storage
+	uint32_t put = 0, got = 0;
+
+	for (uint32_t round = 0; round < 5 * RING_COUNT; round++) {
+		while (!ring_is_full(&ring)) {
+			uint32_t* slot = ring_reserve(&ring);
+			test_assert(slot != NULL, "Reserve in a ring with space failed");
+			test_assert(slot >= records && slot < records + RING_COUNT, "Reserved slot is outside the ring");
+			*slot = put++;
+			ring_push(&ring);
+		}
+
+		for (uint32_t i = 0; i < RING_COUNT - 1; i++) {
+			uint32_t* slot = ring_peek(&ring);
+			test_assert(slot != NULL, "Peek into a filled ring failed");
+			test_assert(*slot == got, "Records should come out in order across the wrap");
+			ring_pop(&ring);
+			got++;
+		}
+
+		test_assert(ring_count(&ring) == 1, "Ring count is wrong after the wrap");
+	}
+
+	test_assert(ring_get(&ring, &value), "Get of the last record failed");
+	test_assert(value == got, "Last record is wrong");
+	test_assert(ring_is_empty(&ring), "Ring should be empty at the end");
+}
+
+DECLARE_TEST("test ring wrap around", TEST_AFTER_ARCH_LATE_INIT, test_ring_wrap_around);
+
+static void test_ring_index_overflow() {
+	struct ring ring;
+	uint8_t records[RING_COUNT];
+	uint8_t byte;
+
+	ring_init(&ring, records, sizeof(uint8_t), RING_COUNT);
+
+	// The free running indices wrap at 2^16, count and full must not care
+	ring.head = ring.tail = UINT16_MAX - 1;
+
+	for (uint8_t i = 0; i < RING_COUNT; i++)
+		test_assert(ring_put_byte(&ring, i), "Put byte across the index overflow failed");
+
+	test_assert(ring_is_full(&ring), "Ring should be full across the index overflow");
+	test_assert(ring_count(&ring) == RING_COUNT, "Ring count is wrong across the index overflow");
+
+	for (uint8_t i = 0; i < RING_COUNT; i++) {
+		test_assert(ring_get_byte(&ring, &byte), "Get byte across the index overflow failed");
+		test_assert(byte == i, "Got the wrong byte across the index overflow");
+	}
+
+	test_assert(ring_is_empty(&ring), "Ring should be empty across the index overflow");
+}
+
+DECLARE_TEST("test ring index overflow", TEST_AFTER_ARCH_LATE_INIT, test_ring_index_overflow);
+
+#endif // TESTS_SUPPORTED
@@ -0,0 +1,148 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <test.h>
+#include <semaphore.h>
+#include <thread.h>
+#include <scheduler.h>
+#include <timer.h>
+
+#ifdef TESTS_SUPPORTED
+
+enum {
+	SEMAPHORE_TEST_STACK_SIZE = 512,
+};
+
+struct semaphore_test_waiter {
+	semaphore_t semaphore;
+	millitime_t timeout;
+	status_t status;
+	bool done;
+};
+
+static void semaphore_test_wait(struct semaphore_test_waiter* waiter) {
+	waiter->status = semaphore_wait_timeout(waiter->semaphore, waiter->timeout);
+	waiter->done = true;
+
+	// Threads can't return, nobody wakes this one up again
+	thread_block();
+}
+
+static void semaphore_test_timeout(timer_t timer, void* context) {
+}
+
+// Keeps the cpu until the timeouts armed before have fired
+static void semaphore_test_spin(millitime_t time) {
+	struct timer_managed_timeout timeout;
+
+	timer_managed_init(&timeout, semaphore_test_timeout, NULL);
+	timer_managed_add(default_timer, &timeout, time, false);
+
+	while (timer_managed_pending(&timeout))
+		;
+}
+
+static void test_semaphore_timeout() {
+	struct semaphore semaphore;
+
+	semaphore_init(&semaphore, 0);
+
+	test_assert(semaphore_wait_timeout(&semaphore, 10) == STATUS_TIMEOUT, "Wait on an unsignaled semaphore should time out");
+	test_assert(semaphore.value == 0, "Timed out wait should give back its count");
+	test_assert(list_is_empty(&semaphore.queue), "Timed out waiter should leave the semaphore");
+
+	// Not lost to the waiter that gave up
+	semaphore_signal(&semaphore);
+	test_assert(semaphore_wait_timeout(&semaphore, 10) == STATUS_OK, "Signal after a timeout should be kept");
+	test_assert(semaphore.value == 0, "Semaphore value is wrong");
+
+	semaphore_cleanup(&semaphore);
+}
+
+DECLARE_TEST("test semaphore wait timeout", TEST_IN_MAIN_TASK, test_semaphore_timeout);
+
+static void test_semaphore_timeout_after_signal() {
+	struct semaphore semaphore;
+	struct semaphore_test_waiter waiter = { .semaphore = &semaphore, .timeout = 10 };
+
+	semaphore_init(&semaphore, 0);
+
+	thread_t thread = thread_create("semaphore test", SEMAPHORE_TEST_STACK_SIZE, NULL);
+	test_assert(thread != NULL, "Could not create a thread");
+
+	// Let it block on the semaphore right away, then keep it from running
+	// once woken
+	thread_set_function(thread, semaphore_test_wait, 1, &waiter);
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT + 1);
+	thread_wakeup(thread);
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT - 1);
+
+	test_assert(!waiter.done, "Waiter should wait for the semaphore");
+
+	semaphore_signal(&semaphore);
+
+	// The timeout fires after the signal woke the waiter, but before it ran
+	semaphore_test_spin(20);
+	test_assert(!waiter.done, "Waiter should not have run yet");
+
+	thread_set_priority(thread, THREAD_PRIORITY_DEFAULT + 1);
+
+	test_assert(waiter.done, "Waiter should have run");
+	test_assert(waiter.status == STATUS_OK, "Signal before the timeout should win");
+	test_assert(semaphore.value == 0, "Late timeout should not give back the count");
+	test_assert(list_is_empty(&semaphore.queue), "Semaphore should have no waiters");
+
+	semaphore_cleanup(&semaphore);
+}
+
+DECLARE_TEST("test semaphore timeout after signal", TEST_IN_MAIN_TASK, test_semaphore_timeout_after_signal);
+
+static void test_semaphore_timeout_in_isr() {
+	struct semaphore semaphore;
+	status_t status;
+
+	semaphore_init(&semaphore, 0);
+
+	scheduler_enter_isr();
+	status = semaphore_wait_timeout(&semaphore, 0);
+	scheduler_leave_isr();
+
+	test_assert(status == STATUS_TIMEOUT, "Wait on an unsignaled semaphore in an isr should fail right away");
+	test_assert(semaphore.value == 0, "Failed wait in an isr should not change the semaphore");
+
+	semaphore_signal(&semaphore);
+
+	scheduler_enter_isr();
+	status = semaphore_wait_timeout(&semaphore, 0);
+	scheduler_leave_isr();
+
+	test_assert(status == STATUS_OK, "Wait on a signaled semaphore in an isr failed");
+	test_assert(semaphore.value == 0, "Wait in an isr should take the semaphore");
+
+	semaphore_cleanup(&semaphore);
+}
+
+DECLARE_TEST("test semaphore timeout of 0 in an isr", TEST_IN_MAIN_TASK, test_semaphore_timeout_in_isr);
+
+#endif // TESTS_SUPPORTED
@@ -0,0 +1,394 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <mcu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Code is tracked in pages of 1 KiB, allocated when they first
+// execute. A two level directory covers the whole address space.
+#define MCU_COVERAGE_PAGE_SHIFT 10
+#define MCU_COVERAGE_TABLE_SHIFT 11
+#define MCU_COVERAGE_HALFWORDS (1 << (MCU_COVERAGE_PAGE_SHIFT - 1))
+#define MCU_COVERAGE_TABLE_LENGTH (1 << MCU_COVERAGE_TABLE_SHIFT)
+#define MCU_COVERAGE_DIRECTORY_LENGTH (1 << (32 - MCU_COVERAGE_PAGE_SHIFT - MCU_COVERAGE_TABLE_SHIFT))
+
+// One bit per halfword and event
+struct mcu_coverage_page {
+	uint64_t executed[MCU_COVERAGE_HALFWORDS / 64];
+	uint64_t taken[MCU_COVERAGE_HALFWORDS / 64];
+	uint64_t not_taken[MCU_COVERAGE_HALFWORDS / 64];
+};
+
+typedef struct mcu_coverage_page* mcu_coverage_page_t;
+
+struct mcu_coverage {
+	mcu_coverage_page_t* tables[MCU_COVERAGE_DIRECTORY_LENGTH];
+};
+
+bool mcu_coverage_start(mcu_t mcu)
+{
+	if (mcu->coverage)
+		return true;
+
+	mcu->coverage = calloc(1, sizeof(struct mcu_coverage));
+
+	if (!mcu->coverage) {
+		perror("Could not allocate mcu_coverage structure");
+		return false;
+	}
+
+	// Decoded instructions carry what coverage waits for
+	mcu_decode_cache_flush(mcu);
+
+	return true;
+}
+
+void mcu_coverage_stop(mcu_t mcu)
+{
+	mcu_coverage_t coverage = mcu->coverage;
+
+	if (!coverage)
+		return;
+
+	mcu->coverage = NULL;
+	mcu_decode_cache_flush(mcu);
+
+	for (uint32_t i = 0; i < MCU_COVERAGE_DIRECTORY_LENGTH; i++) {
+		if (!coverage->tables[i])
+			continue;
+
+		for (uint32_t j = 0; j < MCU_COVERAGE_TABLE_LENGTH; j++)
+			free(coverage->tables[i][j]);
+
+		free(coverage->tables[i]);
+	}
+
+	free(coverage);
+}
+
+static mcu_coverage_page_t mcu_coverage_page(mcu_coverage_t coverage, uint32_t addr, bool create)
+{
+	uint32_t page = addr >> MCU_COVERAGE_PAGE_SHIFT;
+	mcu_coverage_page_t* table = coverage->tables[page >> MCU_COVERAGE_TABLE_SHIFT];
+
+	if (!table) {
+		if (!create)
+			return NULL;
+
+		table = calloc(MCU_COVERAGE_TABLE_LENGTH, sizeof(mcu_coverage_page_t));
+
+		if (!table) {
+			perror("Could not allocate coverage table");
+			return NULL;
+		}
+
+		coverage->tables[page >> MCU_COVERAGE_TABLE_SHIFT] = table;
+	}
+
+	mcu_coverage_page_t* entry = &table[page & (MCU_COVERAGE_TABLE_LENGTH - 1)];
+
+	if (!*entry && create) {
+		*entry = calloc(1, sizeof(struct mcu_coverage_page));
+
+		if (!*entry)
+			perror("Could not allocate coverage page");
+	}
+
+	return *entry;
+}
+
+static inline bool mcu_coverage_bit(const uint64_t* bits, uint32_t addr)
+{
+	uint32_t index = (addr >> 1) & (MCU_COVERAGE_HALFWORDS - 1);
+
+	return bits[index / 64] & (1ULL << (index % 64));
+}
+
+static inline void mcu_coverage_set_bit(uint64_t* bits, uint32_t addr)
+{
+	uint32_t index = (addr >> 1) & (MCU_COVERAGE_HALFWORDS - 1);
+
+	bits[index / 64] |= 1ULL << (index % 64);
+}
+
+// Events recorded for addr
+static uint8_t mcu_coverage_recorded(mcu_coverage_t coverage, uint32_t addr)
+{
+	mcu_coverage_page_t page = mcu_coverage_page(coverage, addr, false);
+	uint8_t events = 0;
+
+	if (!page)
+		return 0;
+
+	if (mcu_coverage_bit(page->executed, addr))
+		events |= mcu_coverage_executed;
+	if (mcu_coverage_bit(page->taken, addr))
+		events |= mcu_coverage_taken;
+	if (mcu_coverage_bit(page->not_taken, addr))
+		events |= mcu_coverage_not_taken;
+
+	return events;
+}
+
+uint8_t mcu_coverage_pending(mcu_t mcu, uint32_t addr, bool branch)
+{
+	uint8_t wanted = mcu_coverage_executed;
+
+	if (!mcu->coverage)
+		return 0;
+
+	if (branch)
+		wanted |= mcu_coverage_taken | mcu_coverage_not_taken;
+
+	return wanted & ~mcu_coverage_recorded(mcu->coverage, addr);
+}
+
+void mcu_coverage_record(mcu_t mcu, uint32_t addr, uint8_t events)
+{
+	if (!mcu->coverage)
+		return;
+
+	mcu_coverage_page_t page = mcu_coverage_page(mcu->coverage, addr, true);
+
+	if (!page)
+		return;
+
+	if (events & mcu_coverage_executed)
+		mcu_coverage_set_bit(page->executed, addr);
+	if (events & mcu_coverage_taken)
+		mcu_coverage_set_bit(page->taken, addr);
+	if (events & mcu_coverage_not_taken)
+		mcu_coverage_set_bit(page->not_taken, addr);
+}
+
+// What lcov gets to see of a single line
+struct mcu_coverage_line {
+	uint32_t line;
+	bool executed;
+};
+
+struct mcu_coverage_branch {
+	uint32_t line;
+	uint8_t events;
+};
+
+static int mcu_coverage_line_compare(const void* _a, const void* _b)
+{
+	const struct mcu_coverage_line* a = _a;
+	const struct mcu_coverage_line* b = _b;
+
+	return (a->line > b->line) - (a->line < b->line);
+}
+
+static int mcu_coverage_branch_compare(const void* _a, const void* _b)
+{
+	const struct mcu_coverage_branch* a = _a;
+	const struct mcu_coverage_branch* b = _b;
+
+	return (a->line > b->line) - (a->line < b->line);
+}
+
+static bool mcu_coverage_is_branch(uint16_t instr)
+{
+	// B<c>, the condition 0xE is undefined and 0xF is svc
+	return (instr & 0xF000) == 0xD000 && ((instr >> 8) & 0xF) < 0xE;
+}
+
+static void mcu_coverage_write_file(mcu_t mcu, FILE* out, uint32_t file)
+{
+	struct mcu_coverage_line* lines = NULL;
+	struct mcu_coverage_branch* branches = NULL;
+	uint32_t line_count = 0;
+	uint32_t branch_count = 0;
+	uint32_t capacity = 0;
+	uint32_t branch_capacity = 0;
+
+	for (uint32_t i = 0; i < mcu->line_count; i++) {
+		mcu_line_t line = &mcu->lines[i];
+
+		if (line->file != file)
+			continue;
+
+		if (line_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			void* grown = realloc(lines, capacity * sizeof(struct mcu_coverage_line));
+
+			if (!grown) {
+				perror("Could not write coverage");
+				free(lines);
+				free(branches);
+				return;
+			}
+
+			lines = grown;
+		}
+
+		struct mcu_coverage_line* entry = &lines[line_count++];
+
+		entry->line = line->line;
+		entry->executed = line->start == line->end &&
+			(mcu_coverage_recorded(mcu->coverage, line->start) & mcu_coverage_executed);
+
+		// Walk the instructions, literal pools are never executed
+		// but don't spoil the line either
+		for (uint32_t addr = line->start; addr < line->end; ) {
+			uint16_t instr;
+			uint8_t events = mcu_coverage_recorded(mcu->coverage, addr);
+
+			if (!mcu_fetch16(mcu, addr, &instr))
+				break;
+
+			if (events & mcu_coverage_executed)
+				entry->executed = true;
+
+			if (mcu_coverage_is_branch(instr)) {
+				if (branch_count == branch_capacity) {
+					branch_capacity = branch_capacity ? branch_capacity * 2 : 64;
+					void* grown = realloc(branches, branch_capacity * sizeof(struct mcu_coverage_branch));
+
+					if (!grown) {
+						perror("Could not write coverage");
+						free(lines);
+						free(branches);
+						return;
+					}
+
+					branches = grown;
+				}
+
+				branches[branch_count++] = (struct mcu_coverage_branch){ line->line, events };
+			}
+
+			if ((instr & 0xF800) == 0xF800 || (instr & 0xF800) == 0xE800 || (instr & 0xF800) == 0xF000)
+				addr += 4;
+			else
+				addr += 2;
+		}
+	}
+
+	if (line_count == 0)
+		return;
+
+	qsort(lines, line_count, sizeof(struct mcu_coverage_line), mcu_coverage_line_compare);
+
+	if (branch_count > 0)
+		qsort(branches, branch_count, sizeof(struct mcu_coverage_branch), mcu_coverage_branch_compare);
+
+	fprintf(out, "TN:\nSF:%s\n", mcu->files[file]);
+
+	uint32_t functions = 0;
+	uint32_t functions_hit = 0;
+
+	for (uint32_t i = 0; i < mcu->symbol_count; i++) {
+		mcu_symbol_t symbol = &mcu->symbols[i];
+		mcu_line_t line = mcu_line_at(mcu, symbol->addr);
+
+		if (!symbol->function || !line || line->file != file)
+			continue;
+
+		bool executed = mcu_coverage_recorded(mcu->coverage, symbol->addr) & mcu_coverage_executed;
+
+		fprintf(out, "FN:%u,%s\nFNDA:%u,%s\n", line->line, symbol->name, executed, symbol->name);
+		functions++;
+		functions_hit += executed;
+	}
+
+	fprintf(out, "FNF:%u\nFNH:%u\n", functions, functions_hit);
+
+	uint32_t branches_hit = 0;
+	uint32_t block = 0;
+
+	for (uint32_t i = 0; i < branch_count; i++) {
+		struct mcu_coverage_branch* branch = &branches[i];
+
+		block = (i > 0 && branches[i - 1].line == branch->line) ? block + 1 : 0;
+
+		if (branch->events & mcu_coverage_executed) {
+			bool taken = branch->events & mcu_coverage_taken;
+			bool not_taken = branch->events & mcu_coverage_not_taken;
+
+			fprintf(out, "BRDA:%u,%u,0,%u\nBRDA:%u,%u,1,%u\n",
+				branch->line, block, taken, branch->line, block, not_taken);
+			branches_hit += taken + not_taken;
+		}
+		else {
+			fprintf(out, "BRDA:%u,%u,0,-\nBRDA:%u,%u,1,-\n", branch->line, block, branch->line, block);
+		}
+	}
+
+	fprintf(out, "BRF:%u\nBRH:%u\n", branch_count * 2, branches_hit);
+
+	uint32_t lines_found = 0;
+	uint32_t lines_hit = 0;
+
+	for (uint32_t i = 0; i < line_count; ) {
+		uint32_t line = lines[i].line;
+		bool executed = false;
+
+		// A line can be spread over several ranges
+		for (; i < line_count && lines[i].line == line; i++)
+			executed |= lines[i].executed;
+
+		fprintf(out, "DA:%u,%u\n", line, executed);
+		lines_found++;
+		lines_hit += executed;
+	}
+
+	fprintf(out, "LF:%u\nLH:%u\nend_of_record\n", lines_found, lines_hit);
+
+	free(lines);
+	free(branches);
+}
+
+bool mcu_coverage_write_lcov(mcu_t mcu, const char* path)
+{
+	if (!mcu->coverage) {
+		printf("No coverage recorded\n");
+		return false;
+	}
+
+	if (mcu->line_count == 0)
+		printf("Firmware has no line table, coverage will be empty\n");
+
+	FILE* out = fopen(path, "w");
+
+	if (!out) {
+		perror("Could not open coverage file");
+		return false;
+	}
+
+	for (uint32_t file = 0; file < mcu->file_count; file++)
+		mcu_coverage_write_file(mcu, out, file);
+
+	if (fclose(out) != 0) {
+		perror("Could not write coverage file");
+		return false;
+	}
+
+	return true;
+}
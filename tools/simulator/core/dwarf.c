@@ -0,0 +1,601 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "dwarf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if 0
+#define dwarf_debug(...) printf("[DWARF] "__VA_ARGS__)
+#else
+#define dwarf_debug(...)
+#endif
+
+enum {
+	DW_LNS_copy               = 1,
+	DW_LNS_advance_pc         = 2,
+	DW_LNS_advance_line       = 3,
+	DW_LNS_set_file           = 4,
+	DW_LNS_set_column         = 5,
+	DW_LNS_negate_stmt        = 6,
+	DW_LNS_set_basic_block    = 7,
+	DW_LNS_const_add_pc       = 8,
+	DW_LNS_fixed_advance_pc   = 9,
+};
+
+enum {
+	DW_LNE_end_sequence       = 1,
+	DW_LNE_set_address        = 2,
+	DW_LNE_define_file        = 3,
+};
+
+enum {
+	DW_LNCT_path              = 1,
+	DW_LNCT_directory_index   = 2,
+};
+
+enum {
+	DW_FORM_data2             = 0x05,
+	DW_FORM_data4             = 0x06,
+	DW_FORM_data8             = 0x07,
+	DW_FORM_string            = 0x08,
+	DW_FORM_block             = 0x09,
+	DW_FORM_data1             = 0x0b,
+	DW_FORM_strp              = 0x0e,
+	DW_FORM_udata             = 0x0f,
+	DW_FORM_data16            = 0x1e,
+	DW_FORM_line_strp         = 0x1f,
+};
+
+// Bounds checked reading, errors stick until the unit is done
+struct dwarf_reader {
+	const uint8_t* data;
+	size_t length;
+	size_t pos;
+	bool error;
+};
+
+static uint64_t dwarf_read(struct dwarf_reader* reader, uint8_t size)
+{
+	uint64_t value = 0;
+
+	if (reader->error || reader->length - reader->pos < size) {
+		reader->error = true;
+		return 0;
+	}
+
+	// Little endian, like the cortex-m0
+	for (uint8_t i = 0; i < size; i++)
+		value |= (uint64_t)reader->data[reader->pos + i] << (8 * i);
+
+	reader->pos += size;
+
+	return value;
+}
+
+static uint64_t dwarf_read_uleb(struct dwarf_reader* reader)
+{
+	uint64_t value = 0;
+	uint8_t shift = 0;
+	uint8_t byte;
+
+	do {
+		byte = dwarf_read(reader, 1);
+
+		if (shift < 64)
+			value |= (uint64_t)(byte & 0x7F) << shift;
+
+		shift += 7;
+	} while (byte & 0x80);
+
+	return value;
+}
+
+static int64_t dwarf_read_sleb(struct dwarf_reader* reader)
+{
+	int64_t value = 0;
+	uint8_t shift = 0;
+	uint8_t byte;
+
+	do {
+		byte = dwarf_read(reader, 1);
+
+		if (shift < 64)
+			value |= (int64_t)(byte & 0x7F) << shift;
+
+		shift += 7;
+	} while (byte & 0x80);
+
+	if (shift < 64 && (byte & 0x40))
+		value |= -((int64_t)1 << shift);
+
+	return value;
+}
+
+static const char* dwarf_read_string(struct dwarf_reader* reader)
+{
+	if (reader->error)
+		return NULL;
+
+	const char* string = (const char*)reader->data + reader->pos;
+	const char* end = memchr(string, '\0', reader->length - reader->pos);
+
+	if (!end) {
+		reader->error = true;
+		return NULL;
+	}
+
+	reader->pos += end - string + 1;
+
+	return string;
+}
+
+static void dwarf_skip(struct dwarf_reader* reader, uint64_t size)
+{
+	if (reader->length - reader->pos < size)
+		reader->error = true;
+	else
+		reader->pos += size;
+}
+
+// Strings in .debug_str and .debug_line_str
+static const char* dwarf_section_string(const uint8_t* section, size_t length, uint64_t offset)
+{
+	if (!section || offset >= length || !memchr(section + offset, '\0', length - offset))
+		return NULL;
+
+	return (const char*)section + offset;
+}
+
+// Reads an attribute of a DWARF 5 directory or file entry, strings
+// end up in string, everything else in value
+static void dwarf_read_form(struct dwarf_reader* reader, const struct dwarf_sections* sections,
+	uint64_t form, bool dwarf64, const char** string, uint64_t* value)
+{
+	*string = NULL;
+	*value = 0;
+
+	switch (form) {
+		case DW_FORM_string:
+			*string = dwarf_read_string(reader);
+			break;
+		case DW_FORM_line_strp:
+			*string = dwarf_section_string(sections->line_str, sections->line_str_length, dwarf_read(reader, dwarf64 ? 8 : 4));
+			break;
+		case DW_FORM_strp:
+			*string = dwarf_section_string(sections->str, sections->str_length, dwarf_read(reader, dwarf64 ? 8 : 4));
+			break;
+		case DW_FORM_udata:
+			*value = dwarf_read_uleb(reader);
+			break;
+		case DW_FORM_data1:
+			*value = dwarf_read(reader, 1);
+			break;
+		case DW_FORM_data2:
+			*value = dwarf_read(reader, 2);
+			break;
+		case DW_FORM_data4:
+			*value = dwarf_read(reader, 4);
+			break;
+		case DW_FORM_data8:
+			*value = dwarf_read(reader, 8);
+			break;
+		case DW_FORM_data16:
+			dwarf_skip(reader, 16);
+			break;
+		case DW_FORM_block:
+			dwarf_skip(reader, dwarf_read_uleb(reader));
+			break;
+		default:
+			dwarf_debug("Unsupported form 0x%llx\n", (unsigned long long)form);
+			reader->error = true;
+			break;
+	}
+}
+
+// The file and directory tables of one unit
+struct dwarf_files {
+	const char** directories;
+	uint32_t directory_count;
+
+	// Indices into the files of the mcu
+	uint32_t* files;
+	uint32_t file_count;
+};
+
+static bool dwarf_add_directory(struct dwarf_files* files, const char* name)
+{
+	const char** directories = realloc(files->directories, (files->directory_count + 1) * sizeof(const char*));
+
+	if (!directories) {
+		perror("Could not allocate directory");
+		return false;
+	}
+
+	files->directories = directories;
+	files->directories[files->directory_count++] = name ? name : "";
+
+	return true;
+}
+
+static bool dwarf_add_file(mcu_t mcu, struct dwarf_files* files, const char* name, uint64_t directory)
+{
+	uint32_t* indices = realloc(files->files, (files->file_count + 1) * sizeof(uint32_t));
+
+	if (!indices) {
+		perror("Could not allocate file");
+		return false;
+	}
+
+	files->files = indices;
+
+	if (!name)
+		name = "";
+
+	// Relative names are relative to their directory
+	if (name[0] != '/' && directory < files->directory_count && files->directories[directory][0] != '\0') {
+		const char* dir = files->directories[directory];
+		char* path = malloc(strlen(dir) + strlen(name) + 2);
+
+		if (!path) {
+			perror("Could not allocate file");
+			return false;
+		}
+
+		sprintf(path, "%s/%s", dir, name);
+		files->files[files->file_count++] = mcu_add_source_file(mcu, path);
+		free(path);
+	}
+	else {
+		files->files[files->file_count++] = mcu_add_source_file(mcu, name);
+	}
+
+	return true;
+}
+
+// Reads a DWARF 5 directory or file table
+static bool dwarf_read_entries(mcu_t mcu, struct dwarf_reader* reader, const struct dwarf_sections* sections,
+	bool dwarf64, struct dwarf_files* files, bool directories)
+{
+	uint8_t format_count = dwarf_read(reader, 1);
+	uint64_t formats[16][2];
+
+	if (format_count > 16)
+		return false;
+
+	for (uint8_t i = 0; i < format_count; i++) {
+		formats[i][0] = dwarf_read_uleb(reader);
+		formats[i][1] = dwarf_read_uleb(reader);
+	}
+
+	uint64_t count = dwarf_read_uleb(reader);
+
+	for (uint64_t i = 0; i < count && !reader->error; i++) {
+		const char* name = NULL;
+		uint64_t directory = 0;
+
+		for (uint8_t j = 0; j < format_count; j++) {
+			const char* string;
+			uint64_t value;
+
+			dwarf_read_form(reader, sections, formats[j][1], dwarf64, &string, &value);
+
+			if (formats[j][0] == DW_LNCT_path)
+				name = string;
+			else if (formats[j][0] == DW_LNCT_directory_index)
+				directory = value;
+		}
+
+		if (directories ? !dwarf_add_directory(files, name) : !dwarf_add_file(mcu, files, name, directory))
+			return false;
+	}
+
+	return !reader->error;
+}
+
+// Rows of the state machine turn into ranges once the next row
+// tells where they end
+struct dwarf_row {
+	uint64_t addr;
+	uint32_t file;
+	uint32_t line;
+	bool valid;
+};
+
+static void dwarf_emit_row(mcu_t mcu, struct dwarf_files* files, struct dwarf_row* previous,
+	uint64_t addr, uint32_t file, uint32_t line, bool end_sequence)
+{
+	// Sequences at 0 belong to functions the linker removed. Rows
+	// sharing their address with the next one stay as empty ranges.
+	if (previous->valid && addr >= previous->addr && previous->addr != 0 &&
+		previous->file < files->file_count && previous->line != 0 && addr <= UINT32_MAX)
+		mcu_add_line(mcu, previous->addr, addr, files->files[previous->file], previous->line);
+
+	previous->addr = addr;
+	previous->file = file;
+	previous->line = line;
+	previous->valid = !end_sequence;
+}
+
+static bool dwarf_load_unit(mcu_t mcu, struct dwarf_reader* reader, const struct dwarf_sections* sections)
+{
+	bool dwarf64 = false;
+	uint64_t unit_length = dwarf_read(reader, 4);
+
+	if (unit_length == 0xFFFFFFFF) {
+		dwarf64 = true;
+		unit_length = dwarf_read(reader, 8);
+	}
+
+	if (reader->error || unit_length > reader->length - reader->pos)
+		return false;
+
+	struct dwarf_reader unit = {
+		.data = reader->data + reader->pos,
+		.length = unit_length,
+	};
+
+	reader->pos += unit_length;
+
+	uint16_t version = dwarf_read(&unit, 2);
+
+	if (version < 2 || version > 5) {
+		dwarf_debug("Unsupported line table version %u\n", version);
+		return true;
+	}
+
+	if (version >= 5)
+		dwarf_skip(&unit, 2);
+
+	uint64_t header_length = dwarf_read(&unit, dwarf64 ? 8 : 4);
+	size_t program = unit.pos + header_length;
+
+	uint8_t min_inst_length = dwarf_read(&unit, 1);
+
+	if (version >= 4)
+		dwarf_skip(&unit, 1);
+
+	bool default_is_stmt = dwarf_read(&unit, 1);
+	int8_t line_base = dwarf_read(&unit, 1);
+	uint8_t line_range = dwarf_read(&unit, 1);
+	uint8_t opcode_base = dwarf_read(&unit, 1);
+	uint8_t opcode_lengths[256] = {};
+
+	(void)default_is_stmt;
+
+	if (line_range == 0 || opcode_base == 0)
+		return false;
+
+	for (uint8_t i = 1; i < opcode_base; i++)
+		opcode_lengths[i] = dwarf_read(&unit, 1);
+
+	struct dwarf_files files = {};
+	bool success = false;
+
+	if (version >= 5) {
+		if (!dwarf_read_entries(mcu, &unit, sections, dwarf64, &files, true) ||
+			!dwarf_read_entries(mcu, &unit, sections, dwarf64, &files, false))
+			goto out;
+	}
+	else {
+		// Directory 0 is the compilation directory, which is only
+		// known to .debug_info. File 0 does not exist before DWARF 5.
+		if (!dwarf_add_directory(&files, NULL) || !dwarf_add_file(mcu, &files, NULL, 0))
+			goto out;
+
+		for (const char* name = dwarf_read_string(&unit); name && name[0] != '\0'; name = dwarf_read_string(&unit))
+			if (!dwarf_add_directory(&files, name))
+				goto out;
+
+		for (const char* name = dwarf_read_string(&unit); name && name[0] != '\0'; name = dwarf_read_string(&unit)) {
+			uint64_t directory = dwarf_read_uleb(&unit);
+
+			dwarf_read_uleb(&unit);
+			dwarf_read_uleb(&unit);
+
+			if (!dwarf_add_file(mcu, &files, name, directory))
+				goto out;
+		}
+	}
+
+	if (unit.error || program > unit.length)
+		goto out;
+
+	unit.pos = program;
+
+	uint64_t addr = 0;
+	uint32_t file = 1;
+	int64_t line = 1;
+	struct dwarf_row previous = {};
+
+	while (unit.pos < unit.length && !unit.error) {
+		uint8_t opcode = dwarf_read(&unit, 1);
+
+		if (opcode >= opcode_base) {
+			uint8_t adjusted = opcode - opcode_base;
+
+			addr += (adjusted / line_range) * min_inst_length;
+			line += line_base + adjusted % line_range;
+			dwarf_emit_row(mcu, &files, &previous, addr, file, line, false);
+			continue;
+		}
+
+		switch (opcode) {
+			case 0: {
+				uint64_t length = dwarf_read_uleb(&unit);
+				size_t end = unit.pos + length;
+
+				if (length == 0 || length > unit.length - unit.pos) {
+					unit.error = true;
+					break;
+				}
+
+				switch (dwarf_read(&unit, 1)) {
+					case DW_LNE_end_sequence:
+						dwarf_emit_row(mcu, &files, &previous, addr, file, line, true);
+						addr = 0;
+						file = 1;
+						line = 1;
+						break;
+					case DW_LNE_set_address:
+						addr = dwarf_read(&unit, length - 1 > 8 ? 8 : length - 1);
+						break;
+					case DW_LNE_define_file: {
+						const char* name = dwarf_read_string(&unit);
+						uint64_t directory = dwarf_read_uleb(&unit);
+
+						if (!dwarf_add_file(mcu, &files, name, directory))
+							goto out;
+						break;
+					}
+				}
+
+				unit.pos = end;
+				break;
+			}
+			case DW_LNS_copy:
+				dwarf_emit_row(mcu, &files, &previous, addr, file, line, false);
+				break;
+			case DW_LNS_advance_pc:
+				addr += dwarf_read_uleb(&unit) * min_inst_length;
+				break;
+			case DW_LNS_advance_line:
+				line += dwarf_read_sleb(&unit);
+				break;
+			case DW_LNS_set_file:
+				file = dwarf_read_uleb(&unit);
+				break;
+			case DW_LNS_const_add_pc:
+				addr += ((255 - opcode_base) / line_range) * min_inst_length;
+				break;
+			case DW_LNS_fixed_advance_pc:
+				addr += dwarf_read(&unit, 2);
+				break;
+			default:
+				// Everything else only changes state we don't keep
+				for (uint8_t i = 0; i < opcode_lengths[opcode]; i++)
+					dwarf_read_uleb(&unit);
+				break;
+		}
+	}
+
+	success = !unit.error;
+
+out:
+	free(files.directories);
+	free(files.files);
+
+	return success;
+}
+
+bool dwarf_load_lines(mcu_t mcu, const struct dwarf_sections* sections)
+{
+	struct dwarf_reader reader = {
+		.data = sections->line,
+		.length = sections->line_length,
+	};
+
+	mcu_clear_lines(mcu);
+
+	while (reader.pos < reader.length) {
+		if (!dwarf_load_unit(mcu, &reader, sections)) {
+			printf("Malformed line table, source lines are incomplete\n");
+			return false;
+		}
+	}
+
+	dwarf_debug("%u lines in %u files\n", mcu->line_count, mcu->file_count);
+
+	return true;
+}
+
+uint32_t mcu_add_source_file(mcu_t mcu, const char* name)
+{
+	for (uint32_t i = 0; i < mcu->file_count; i++)
+		if (strcmp(mcu->files[i], name) == 0)
+			return i;
+
+	char** files = realloc(mcu->files, (mcu->file_count + 1) * sizeof(char*));
+
+	if (!files) {
+		perror("Could not allocate source file");
+		return 0;
+	}
+
+	mcu->files = files;
+	mcu->files[mcu->file_count] = strdup(name);
+
+	if (!mcu->files[mcu->file_count]) {
+		perror("Could not allocate source file");
+		return 0;
+	}
+
+	return mcu->file_count++;
+}
+
+bool mcu_add_line(mcu_t mcu, uint32_t start, uint32_t end, uint32_t file, uint32_t line)
+{
+	mcu_line_t lines = realloc(mcu->lines, (mcu->line_count + 1) * sizeof(struct mcu_line));
+
+	if (!lines) {
+		perror("Could not allocate line");
+		return false;
+	}
+
+	mcu->lines = lines;
+	mcu->lines[mcu->line_count++] = (struct mcu_line){
+		.start = start,
+		.end = end,
+		.file = file,
+		.line = line,
+	};
+
+	return true;
+}
+
+void mcu_clear_lines(mcu_t mcu)
+{
+	for (uint32_t i = 0; i < mcu->file_count; i++)
+		free(mcu->files[i]);
+
+	free(mcu->files);
+	free(mcu->lines);
+
+	mcu->files = NULL;
+	mcu->file_count = 0;
+	mcu->lines = NULL;
+	mcu->line_count = 0;
+}
+
+mcu_line_t mcu_line_at(mcu_t mcu, uint32_t addr)
+{
+	for (uint32_t i = 0; i < mcu->line_count; i++)
+		if (mcu->lines[i].start <= addr && addr < mcu->lines[i].end)
+			return &mcu->lines[i];
+
+	return NULL;
+}
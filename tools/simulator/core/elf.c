@@ -23,10 +23,14 @@
 //
 
 #include "elf.h"
+#include "dwarf.h"
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #if 0
 #define elf_debug(...) printf("[ELF] "__VA_ARGS__)
@@ -103,6 +107,137 @@ struct elf_prog_header {
 	uint32_t align;
 };
 
+enum {
+	ELF_SECTION_TYPE_SYMTAB = 2,
+};
+
+struct elf_section_header {
+	uint32_t name;
+	uint32_t type;
+	uint32_t flags;
+	uint32_t addr;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t link;
+	uint32_t info;
+	uint32_t addralign;
+	uint32_t entsize;
+};
+
+enum {
+	ELF_SYMBOL_TYPE_OBJECT = 1,
+	ELF_SYMBOL_TYPE_FUNC   = 2,
+};
+
+struct elf_symbol {
+	uint32_t name;
+	uint32_t value;
+	uint32_t size;
+	uint8_t info;
+	uint8_t other;
+	uint16_t shndx;
+};
+
+static bool elf_section_header(const uint8_t* data, size_t length, const struct elf_header* elf_header, uint32_t index, struct elf_section_header* sh)
+{
+	size_t offset = elf_header->shoff + (size_t)index * elf_header->shentsize;
+
+	if (index >= elf_header->shnum || offset + sizeof(*sh) > length)
+		return false;
+
+	memcpy(sh, data + offset, sizeof(*sh));
+
+	return (size_t)sh->offset + sh->size <= length;
+}
+
+static bool elf_section_named(const uint8_t* data, size_t length, const struct elf_header* elf_header, const char* name, struct elf_section_header* sh)
+{
+	struct elf_section_header names;
+
+	if (!elf_section_header(data, length, elf_header, elf_header->shstrndex, &names))
+		return false;
+
+	for (uint16_t i = 0; i < elf_header->shnum; i++) {
+		if (!elf_section_header(data, length, elf_header, i, sh) || sh->name >= names.size)
+			continue;
+
+		const char* section = (const char*)data + names.offset + sh->name;
+
+		if (strncmp(section, name, names.size - sh->name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static void elf_load_lines(mcu_t mcu, const uint8_t* data, size_t length, const struct elf_header* elf_header)
+{
+	struct dwarf_sections sections = {};
+	struct elf_section_header sh;
+
+	if (!elf_section_named(data, length, elf_header, ".debug_line", &sh)) {
+		mcu_clear_lines(mcu);
+		return;
+	}
+
+	sections.line = data + sh.offset;
+	sections.line_length = sh.size;
+
+	if (elf_section_named(data, length, elf_header, ".debug_line_str", &sh)) {
+		sections.line_str = data + sh.offset;
+		sections.line_str_length = sh.size;
+	}
+
+	if (elf_section_named(data, length, elf_header, ".debug_str", &sh)) {
+		sections.str = data + sh.offset;
+		sections.str_length = sh.size;
+	}
+
+	dwarf_load_lines(mcu, &sections);
+}
+
+// Function and object symbols are kept for hooks and tools,
+// a stripped file simply has none
+static void elf_load_symbols(mcu_t mcu, const uint8_t* data, size_t length, const struct elf_header* elf_header)
+{
+	mcu_clear_symbols(mcu);
+
+	for (uint16_t i = 0; i < elf_header->shnum; i++) {
+		struct elf_section_header symtab;
+		struct elf_section_header strtab;
+
+		if (!elf_section_header(data, length, elf_header, i, &symtab) || symtab.type != ELF_SECTION_TYPE_SYMTAB)
+			continue;
+
+		if (!elf_section_header(data, length, elf_header, symtab.link, &strtab))
+			continue;
+
+		for (uint32_t offset = 0; offset + sizeof(struct elf_symbol) <= symtab.size; offset += sizeof(struct elf_symbol)) {
+			struct elf_symbol symbol;
+
+			memcpy(&symbol, data + symtab.offset + offset, sizeof(symbol));
+
+			uint8_t type = symbol.info & 0xF;
+
+			if ((type != ELF_SYMBOL_TYPE_FUNC && type != ELF_SYMBOL_TYPE_OBJECT) || symbol.name >= strtab.size)
+				continue;
+
+			const char* name = (const char*)data + strtab.offset + symbol.name;
+
+			if (!memchr(name, '\0', strtab.size - symbol.name))
+				continue;
+
+			// Thumb functions have the lowest bit set
+			if (type == ELF_SYMBOL_TYPE_FUNC)
+				symbol.value &= ~1;
+
+			elf_debug("SYM %s at %x:%x\n", name, symbol.value, symbol.size);
+
+			mcu_add_symbol(mcu, name, symbol.value, symbol.size, type == ELF_SYMBOL_TYPE_FUNC);
+		}
+	}
+}
+
 bool elf_load(mcu_t mcu, const char* file)
 {
 	int fd = open(file, O_RDONLY);
@@ -122,18 +257,53 @@ bool elf_load(mcu_t mcu, const char* file)
 
 bool elf_load_fd(mcu_t mcu, int fd)
 {
-	struct elf_header elf_header;
+	struct stat st;
 
-	if (lseek(fd, 0, SEEK_SET) < 0) {
-		perror("lseek");
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
 		return false;
 	}
 
-	if (read(fd, &elf_header, sizeof(elf_header)) < 0) {
-		perror("read");
+	uint8_t* data = malloc(st.st_size);
+
+	if (!data) {
+		perror("malloc");
 		return false;
 	}
 
+	size_t filled = 0;
+
+	while (filled < (size_t)st.st_size) {
+		ssize_t r = pread(fd, data + filled, st.st_size - filled, filled);
+
+		if (r <= 0) {
+			perror("read");
+			free(data);
+			return false;
+		}
+
+		filled += r;
+	}
+
+	bool success = elf_load_buffer(mcu, data, filled);
+
+	free(data);
+
+	return success;
+}
+
+bool elf_load_buffer(mcu_t mcu, const void* _data, size_t length)
+{
+	const uint8_t* data = _data;
+	struct elf_header elf_header;
+
+	if (length < sizeof(elf_header)) {
+		printf("Not an elf file!\n");
+		return false;
+	}
+
+	memcpy(&elf_header, data, sizeof(elf_header));
+
 	if (elf_header.ident[ELF_IDENT_MAGIC0] != ELF_MAGIC0 ||
 		elf_header.ident[ELF_IDENT_MAGIC1] != ELF_MAGIC1 ||
 		elf_header.ident[ELF_IDENT_MAGIC2] != ELF_MAGIC2 ||
@@ -146,38 +316,27 @@ bool elf_load_fd(mcu_t mcu, int fd)
 
 	for (uint16_t i = 0; i < elf_header.phnum; i++) {
 		struct elf_prog_header ph;
+		size_t offset = elf_header.phoff + i * elf_header.phentsize;
 
-		if (lseek(fd, elf_header.phoff + i * elf_header.phentsize, SEEK_SET) < 0) {
-			perror("lseek");
+		if (offset + sizeof(ph) > length) {
+			printf("Program header %u out of bounds\n", i);
 			mcu_lock(mcu);
 			return false;
 		}
 
-		if (read(fd, &ph, sizeof(ph)) < 0) {
-			perror("read");
-			mcu_lock(mcu);
-			return false;
-		}
+		memcpy(&ph, data + offset, sizeof(ph));
 
 		if (ph.type == ELF_PROG_TYPE_LOAD) {
 			elf_debug("[ELF] LOAD %x:%x to %x:%x\n", ph.offset, ph.filesz, ph.paddr, ph.memz);
 
-			if (lseek(fd, ph.offset, SEEK_SET) < 0) {
-				perror("lseek");
+			if ((size_t)ph.offset + ph.filesz > length) {
+				printf("Segment %u out of bounds\n", i);
 				mcu_lock(mcu);
 				return false;
 			}
 
 			for (uint32_t j = 0; j < ph.filesz; j++) {
-				uint8_t byte;
-
-				if (read(fd, &byte, 1) < 0) {
-					perror("read");
-					mcu_lock(mcu);
-					return false;
-				}
-
-				if (!mcu_util_write8(mcu, ph.paddr + j, byte)) {
+				if (!mcu_util_write8(mcu, ph.paddr + j, data[ph.offset + j])) {
 					mcu_lock(mcu);
 					return false;
 				}
@@ -187,5 +346,8 @@ bool elf_load_fd(mcu_t mcu, int fd)
 
 	mcu_lock(mcu);
 
+	elf_load_symbols(mcu, data, length, &elf_header);
+	elf_load_lines(mcu, data, length, &elf_header);
+
 	return true;
 }
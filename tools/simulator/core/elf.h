@@ -29,3 +29,6 @@
 bool elf_load(mcu_t mcu, const char* file);
 
 bool elf_load_fd(mcu_t mcu, int fd);
+
+/// Loads an elf image that is already in memory
+bool elf_load_buffer(mcu_t mcu, const void* data, size_t length);
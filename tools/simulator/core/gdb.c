@@ -40,7 +40,12 @@ struct gdb {
 
 	ev_io socket_io;
 
+	// Owned by the event loop, which does all the reading and
+	// writing. The execution thread builds the replies.
 	int gdb_fd;
+	// Set from a read or write error until the execution thread
+	// acknowledged the disconnect and the fd is closed
+	bool closing;
 
 	// Receiving
 	char* rev_buffer;
@@ -48,10 +53,21 @@ struct gdb {
 	size_t rev_buffer_length;
 	ev_io recv_io;
 
-	// Sending
+	// Sending, the reply is built on the execution thread and
+	// posted to the event loop when the command is done
+	char* reply;
+	size_t reply_length;
+	size_t reply_size;
 	char packet_checksum;
+	// Whether the execution thread still answers the client
+	bool connected;
 	ev_io send_io;
 
+	// Halt the mcu once the pc leaves a range step, below and
+	// above the range. Owned by the execution thread.
+	struct mcu_hook range_hooks[2];
+	bool range_stepping;
+
 	struct mcu_callbacks mcu_callbacks;
 
 	//
@@ -148,44 +164,156 @@ gdb_t gdb_create(struct ev_loop* loop, int port, mcu_t mcu)
 	return gdb;
 }
 
+static void gdb_client_close(gdb_t gdb);
+static void gdb_range_end(gdb_t gdb);
+
+void gdb_destroy(gdb_t gdb)
+{
+	if (gdb->gdb_fd >= 0)
+		gdb_client_close(gdb);
+
+	ev_io_stop(gdb->loop, &gdb->socket_io);
+	close(gdb->socket_io.fd);
+
+	mcu_remove_callbacks(gdb->mcu, &gdb->mcu_callbacks);
+	gdb_range_end(gdb);
+
+	free(gdb->rev_buffer);
+	free(gdb->reply);
+	free(gdb);
+}
+
 static void gdb_client_close(gdb_t gdb)
 {
 	printf("gdb disconnected\n");
 	close(gdb->gdb_fd);
 	gdb->gdb_fd = -1;
+	gdb->closing = false;
 	ev_io_stop(gdb->loop, &gdb->recv_io);
 	ev_io_stop(gdb->loop, &gdb->send_io);
 	gdb->rev_buffer_filled = 0;
 }
 
-static void gdb_client_error(gdb_t gdb)
+static void gdb_client_close_command(mcu_t mcu, void* context)
 {
-	perror("gdb-client");
-	gdb_client_close(gdb);
+	gdb_client_close(context);
 }
 
-static bool gdb_send_ack(gdb_t gdb) {
-	static const char* ack = "+\n";
+static void gdb_disconnect_command(mcu_t mcu, void* context)
+{
+	gdb_t gdb = context;
 
-	gdb_debug("gdb-send: %s", ack);
-	if (write(gdb->gdb_fd, ack, strlen(ack)) < 0) {
-		gdb_client_error(gdb);
-		return false;
+	// A range step in progress ends without a stop reply
+	if (gdb->range_stepping) {
+		gdb_range_end(gdb);
+		mcu_halt(mcu, HAL_TRAP);
+	}
+
+	// Replies posted so far are still ahead of the close
+	gdb->connected = false;
+	gdb->reply_length = 0;
+	mcu_post_loop(mcu, gdb_client_close_command, gdb);
+}
+
+static void gdb_connect_command(mcu_t mcu, void* context)
+{
+	gdb_t gdb = context;
+
+	gdb->connected = true;
+}
+
+// The execution thread may be answering a packet right now, so
+// the fd is only closed once it stopped doing so
+static void gdb_client_disconnect(gdb_t gdb)
+{
+	if (gdb->closing)
+		return;
+
+	gdb->closing = true;
+	ev_io_stop(gdb->loop, &gdb->recv_io);
+	mcu_post(gdb->mcu, gdb_disconnect_command, gdb);
+}
+
+struct gdb_reply {
+	gdb_t gdb;
+	size_t length;
+	char data[];
+};
+
+static void gdb_write_command(mcu_t mcu, void* context)
+{
+	struct gdb_reply* reply = context;
+	gdb_t gdb = reply->gdb;
+
+	for (size_t written = 0; written < reply->length && gdb->gdb_fd >= 0 && !gdb->closing;) {
+		ssize_t len = write(gdb->gdb_fd, reply->data + written, reply->length - written);
+
+		if (len < 0) {
+			perror("gdb-client");
+			gdb_client_disconnect(gdb);
+			break;
+		}
+
+		written += len;
+	}
+
+	free(reply);
+}
+
+// Hands the reply built so far to the event loop
+static void gdb_flush(gdb_t gdb)
+{
+	if (gdb->reply_length == 0 || !gdb->connected)
+		return;
+
+	struct gdb_reply* reply = malloc(sizeof(struct gdb_reply) + gdb->reply_length);
+
+	if (!reply) {
+		perror("malloc");
+		return;
 	}
 
+	reply->gdb = gdb;
+	reply->length = gdb->reply_length;
+	memcpy(reply->data, gdb->reply, gdb->reply_length);
+	gdb->reply_length = 0;
+
+	mcu_post_loop(gdb->mcu, gdb_write_command, reply);
+}
+
+static bool gdb_send(gdb_t gdb, const char* data, size_t length)
+{
+	if (gdb->reply_length + length > gdb->reply_size) {
+		size_t size = (gdb->reply_length + length) * 2;
+		char* buffer = realloc(gdb->reply, size);
+
+		if (!buffer) {
+			perror("realloc");
+			return false;
+		}
+
+		gdb->reply = buffer;
+		gdb->reply_size = size;
+	}
+
+	memcpy(gdb->reply + gdb->reply_length, data, length);
+	gdb->reply_length += length;
+
 	return true;
 }
 
+static bool gdb_send_ack(gdb_t gdb) {
+	static const char* ack = "+\n";
+
+	gdb_debug("gdb-send: %s", ack);
+	return gdb_send(gdb, ack, strlen(ack));
+}
+
 static bool gdb_send_nack(gdb_t gdb) {
 	static const char* ack = "-\n";
 
 	gdb_debug("gdb-send: %s", ack);
-	if (write(gdb->gdb_fd, ack, strlen(ack)) < 0) {
-		gdb_client_error(gdb);
-		return false;
-	}
-
-	return true;
+	return gdb_send(gdb, ack, strlen(ack));
 }
 
 static bool gdb_send_packet_begin(gdb_t gdb) {
@@ -193,12 +321,7 @@ static bool gdb_send_packet_begin(gdb_t gdb) {
 
 	gdb_debug("[gdb] > $");
 
-	if (write(gdb->gdb_fd, "$", 1) < 1) {
-		gdb_client_error(gdb);
-		return false;
-	}
-
-	return true;
+	return gdb_send(gdb, "$", 1);
 }
 
 static bool gdb_send_packet_char(gdb_t gdb, char c) {
@@ -207,22 +330,15 @@ static bool gdb_send_packet_char(gdb_t gdb, char c) {
 		gdb->packet_checksum += '}';
 
 		gdb_debug("}");
-		if (write(gdb->gdb_fd, "}", 1) < 1) {
-			gdb_client_error(gdb);
+		if (!gdb_send(gdb, "}", 1))
 			return false;
-		}
 
 		c ^= 0x20;
 	}
 
 	gdb_debug("%c", c);
 	gdb->packet_checksum += c;
-	if (write(gdb->gdb_fd, &c, 1) < 1) {
-		gdb_client_error(gdb);
-		return false;
-	}
-
-	return true;
+	return gdb_send(gdb, &c, 1);
 }
 
 static bool gdb_send_packet_str(gdb_t gdb, const char* str) {
@@ -254,10 +370,8 @@ static bool gdb_send_packet_hex(gdb_t gdb, uint32_t number, int length) {
 static bool gdb_send_packet_end(gdb_t gdb) {
 
 	gdb_debug("#");
-	if (write(gdb->gdb_fd, "#", 1) < 1) {
-		gdb_client_error(gdb);
+	if (!gdb_send(gdb, "#", 1))
 		return false;
-	}
 
 	if (!gdb_send_packet_hex(gdb, gdb->packet_checksum, 1))
 		return false;
@@ -301,6 +415,110 @@ static bool gdb_mcu_fetch_byte(mcu_t mcu, uint32_t addr, char* c)
 	return true;
 }
 
+static void gdb_send_stop(gdb_t gdb)
+{
+	gdb_send_packet_begin(gdb);
+	gdb_send_packet_str(gdb, "S05");
+	gdb_send_packet_end(gdb);
+}
+
+static void gdb_range_end(gdb_t gdb)
+{
+	if (!gdb->range_stepping)
+		return;
+
+	gdb->range_stepping = false;
+
+	for (int i = 0; i < 2; i++)
+		mcu_hook_remove(gdb->mcu, &gdb->range_hooks[i]);
+}
+
+static bool gdb_range_left(mcu_t mcu, uint32_t addr, void* context)
+{
+	gdb_t gdb = context;
+
+	// Stop in front of the first instruction outside the range, the
+	// halt callback sends gdb the stop
+	gdb_range_end(gdb);
+	mcu_halt(mcu, HAL_TRAP);
+
+	return false;
+}
+
+// Runs as long as the pc stays in [start, end), which saves gdb a
+// round trip per instruction. The mcu runs like after continue, so
+// breakpoints, faults and a break from gdb stop it as usual.
+static void gdb_range_step(gdb_t gdb, uint32_t start, uint32_t end)
+{
+	mcu_t mcu = gdb->mcu;
+	uint32_t pc = mcu_read_reg(mcu, REG_PC);
+
+	// A range step steps at least once
+	if (pc < start || pc >= end || gdb->range_stepping) {
+		mcu_step(mcu);
+		gdb_send_stop(gdb);
+		return;
+	}
+
+	// gdb sees the pc register, which is 2 bytes ahead of the
+	// instruction the hooks are called for
+	start = start >= 2 ? start - 2 : 0;
+	end -= 2;
+
+	gdb->range_hooks[0] = (struct mcu_hook){
+		.type = mcu_hook_instruction,
+		.addr = 0,
+		.length = start,
+		.instruction = gdb_range_left,
+		.context = gdb,
+	};
+	gdb->range_hooks[1] = (struct mcu_hook){
+		.type = mcu_hook_instruction,
+		.addr = end,
+		.length = -end,
+		.instruction = gdb_range_left,
+		.context = gdb,
+	};
+
+	for (int i = 0; i < 2; i++)
+		mcu_hook_add(mcu, &gdb->range_hooks[i]);
+
+	gdb->range_stepping = true;
+	mcu_resume(mcu);
+}
+
+static void gdb_handle_vcont(gdb_t gdb, char* actions)
+{
+	// There is only one thread, so the first action is the one
+	// that applies to it, whatever thread id follows
+	switch (*actions++) {
+		case 'c':
+		case 'C':
+			mcu_resume(gdb->mcu);
+			break;
+
+		case 's':
+		case 'S':
+			mcu_step(gdb->mcu);
+			gdb_send_stop(gdb);
+			break;
+
+		case 'r':
+		{
+			uint32_t start = strtoul(actions, &actions, 16);
+			actions++; // ,
+			uint32_t end = strtoul(actions, NULL, 16);
+
+			gdb_range_step(gdb, start, end);
+			break;
+		}
+
+		default:
+			gdb_send_packet_begin(gdb);
+			gdb_send_packet_end(gdb);
+	}
+}
+
 static bool gdb_handle_packet(gdb_t gdb, char* packet, size_t len)
 {
 	packet++;
@@ -431,8 +649,18 @@ static bool gdb_handle_packet(gdb_t gdb, char* packet, size_t len)
 		}
 
 		case 'v':
-			gdb_send_packet_begin(gdb);
-			gdb_send_packet_end(gdb);
+			if (strncmp(packet, "Cont?", strlen("Cont?")) == 0) {
+				gdb_send_packet_begin(gdb);
+				gdb_send_packet_str(gdb, "vCont;c;C;s;S;r");
+				gdb_send_packet_end(gdb);
+			}
+			else if (strncmp(packet, "Cont;", strlen("Cont;")) == 0) {
+				gdb_handle_vcont(gdb, packet + strlen("Cont;"));
+			}
+			else {
+				gdb_send_packet_begin(gdb);
+				gdb_send_packet_end(gdb);
+			}
 			break;
 
 		case 's':
@@ -486,16 +714,88 @@ static bool gdb_handle_packet(gdb_t gdb, char* packet, size_t len)
 	return true;
 }
 
-static void gdb_mcu_did_halt(mcu_t mcu, halt_reason_t reason, void* context)
+struct gdb_packet {
+	gdb_t gdb;
+	size_t length;
+	char data[];
+};
+
+static void gdb_packet_command(mcu_t mcu, void* context)
 {
-	gdb_t gdb = (gdb_t)context;
+	struct gdb_packet* packet = context;
+
+	gdb_handle_packet(packet->gdb, packet->data, packet->length);
+	gdb_flush(packet->gdb);
+	free(packet);
+}
+
+static void gdb_break_command(mcu_t mcu, void* context)
+{
+	mcu_halt(mcu, HAL_TRAP);
+}
+
+// The packet is handled on the execution thread, as it
+// accesses the mcu
+static void gdb_post_packet(gdb_t gdb, const char* data, size_t length)
+{
+	struct gdb_packet* packet = malloc(sizeof(struct gdb_packet) + length + 1);
+
+	if (!packet) {
+		perror("malloc");
+		return;
+	}
+
+	packet->gdb = gdb;
+	packet->length = length;
+	memcpy(packet->data, data, length);
+	packet->data[length] = '\0';
+
+	mcu_post(gdb->mcu, gdb_packet_command, packet);
+}
+
+struct gdb_stop {
+	gdb_t gdb;
+	halt_reason_t reason;
+};
 
-  // Don't tell gdb when the mcu only entered a sleep state
-	if (reason >= 0 && gdb->gdb_fd >= 0) {
+static void gdb_stop_command(mcu_t mcu, void* context)
+{
+	struct gdb_stop* stop = context;
+	gdb_t gdb = stop->gdb;
+
+	// Something else than the range stopped the mcu
+	gdb_range_end(gdb);
+
+	if (gdb->connected) {
 		gdb_send_packet_begin(gdb);
 		gdb_send_packet_str(gdb, "S");
-		gdb_send_packet_hex(gdb, reason, 1);
+		gdb_send_packet_hex(gdb, stop->reason, 1);
 		gdb_send_packet_end(gdb);
+		gdb_flush(gdb);
+	}
+
+	free(stop);
+}
+
+// Called on the event loop, the stop reply is built on the execution
+// thread like all others so they don't interleave
+static void gdb_mcu_did_halt(mcu_t mcu, halt_reason_t reason, void* context)
+{
+	gdb_t gdb = (gdb_t)context;
+
+	// Don't tell gdb when the mcu only entered a sleep state
+	if (reason >= 0 && gdb->gdb_fd >= 0 && !gdb->closing) {
+		struct gdb_stop* stop = malloc(sizeof(struct gdb_stop));
+
+		if (!stop) {
+			perror("malloc");
+			return;
+		}
+
+		stop->gdb = gdb;
+		stop->reason = reason;
+
+		mcu_post(mcu, gdb_stop_command, stop);
 	}
 }
 
@@ -525,6 +825,7 @@ static void gdb_accept_callback(struct ev_loop *loop, ev_io *w, int revents)
 			ev_io_set(&gdb->send_io, fd, EV_WRITE);
 
 			ev_io_start(gdb->loop, &gdb->recv_io);
+			mcu_post(gdb->mcu, gdb_connect_command, gdb);
 
 			printf("Connected to gdb client\n");
 		}
@@ -541,13 +842,15 @@ static void gdb_read_callback(struct ev_loop *loop, ev_io *w, int revents)
 
 		len = read(gdb->gdb_fd, gdb->rev_buffer + gdb->rev_buffer_filled, gdb->rev_buffer_length - gdb->rev_buffer_filled - 1);
 		if (len == 0) {
-			gdb_client_close(gdb);
+			gdb_client_disconnect(gdb);
+			return;
 		}
 		else if (len < 0) {
 			if (errno == EAGAIN)
 				return;
 
-			gdb_client_error(gdb);
+			perror("gdb-client");
+			gdb_client_disconnect(gdb);
 			return;
 		}
 
@@ -555,7 +858,8 @@ static void gdb_read_callback(struct ev_loop *loop, ev_io *w, int revents)
 		gdb->rev_buffer[gdb->rev_buffer_filled] = '\0';
 
 		// Try to find a packet start
-		for (char* b = gdb->rev_buffer; b < gdb->rev_buffer + gdb->rev_buffer_filled; b++) {
+		char* b;
+		for (b = gdb->rev_buffer; b < gdb->rev_buffer + gdb->rev_buffer_filled; b++) {
 			if (*b == 0x03)
 				hasBreak = true;
 			else if (*b == '$') { // Packet start
@@ -566,6 +870,11 @@ static void gdb_read_callback(struct ev_loop *loop, ev_io *w, int revents)
 			}
 		}
 
+		// Drop what was scanned, a break must not be seen again
+		// with the next packet
+		if (b == gdb->rev_buffer + gdb->rev_buffer_filled)
+			gdb->rev_buffer_filled = 0;
+
 		// We have a packet
 		if (*gdb->rev_buffer == '$') {
 			char* end = gdb->rev_buffer;
@@ -594,7 +903,7 @@ static void gdb_read_callback(struct ev_loop *loop, ev_io *w, int revents)
 			}
 			gdb_debug("\n");
 
-			gdb_handle_packet(gdb, gdb->rev_buffer, end - gdb->rev_buffer);
+			gdb_post_packet(gdb, gdb->rev_buffer, end - gdb->rev_buffer);
 
 			// remove the handled packet
 			gdb->rev_buffer_filled -= end - gdb->rev_buffer;
@@ -606,7 +915,7 @@ static void gdb_read_callback(struct ev_loop *loop, ev_io *w, int revents)
 		}
 
 		if (hasBreak)
-			mcu_halt(gdb->mcu, HAL_TRAP);
+			mcu_post(gdb->mcu, gdb_break_command, NULL);
 	}
 }
 
@@ -30,3 +30,4 @@
 typedef struct gdb* gdb_t;
 
 gdb_t gdb_create(struct ev_loop* loop, int port, mcu_t mcu);
+void gdb_destroy(gdb_t gdb);
@@ -0,0 +1,544 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <mcu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Traced allocator functions, as named in core/malloc.c
+typedef enum {
+	heap_malloc_raw,
+	heap_free_raw,
+	heap_malloc,
+	heap_free,
+
+	heap_function_count,
+} heap_function_t;
+
+static const char* const mcu_heap_function_names[heap_function_count] = {
+	[heap_malloc_raw] = "malloc_raw",
+	[heap_free_raw]   = "free_raw",
+	[heap_malloc]     = "malloc",
+	[heap_free]       = "free",
+};
+
+// sizeof(struct malloc_header) of the firmware
+static const uint32_t mcu_heap_malloc_header = 4;
+
+// Free lists longer than this are considered corrupt
+static const uint32_t mcu_heap_max_blocks = 4096;
+
+struct mcu_heap_hook {
+	struct mcu_hook hook;
+
+	mcu_heap_t heap;
+	heap_function_t function;
+};
+
+// A call from outside the allocator that did not return yet
+struct mcu_heap_call {
+	heap_function_t function;
+	uint32_t sp;
+	uint32_t args[2];
+	uint32_t caller;
+};
+
+struct mcu_heap_allocation {
+	uint32_t addr;
+	uint32_t size;
+
+	// An address inside the calling instruction
+	uint32_t caller;
+
+	// Allocated with malloc_raw, no malloc header in front
+	bool raw;
+	bool live;
+
+	uint64_t allocated;
+	uint64_t freed;
+};
+
+struct mcu_heap_sample {
+	uint64_t cycles;
+	uint32_t used;
+	uint32_t free;
+	uint32_t blocks;
+	uint32_t largest;
+};
+
+struct mcu_heap {
+	struct mcu_heap_hook hooks[heap_function_count];
+
+	// Address of free_head, 0 when the firmware has no such symbol
+	uint32_t free_head;
+
+	struct mcu_heap_call* calls;
+	uint32_t call_count;
+	uint32_t call_capacity;
+
+	struct mcu_heap_allocation* allocations;
+	uint32_t allocation_count;
+	uint32_t allocation_capacity;
+
+	struct mcu_heap_sample* samples;
+	uint32_t sample_count;
+	uint32_t sample_capacity;
+
+	// Bytes handed to free_raw from outside the allocator, like
+	// malloc_init does
+	uint32_t heap_size;
+
+	// Bytes in live allocations, malloc headers included
+	uint32_t used;
+	uint32_t peak_used;
+	uint64_t peak_cycles;
+
+	uint32_t failed;
+	uint32_t unknown_frees;
+};
+
+// Grows an array by one element
+static void* mcu_heap_grow(void** array, uint32_t* count, uint32_t* capacity, size_t size)
+{
+	if (*count == *capacity) {
+		uint32_t grown = *capacity ? *capacity * 2 : 64;
+		void* resized = realloc(*array, grown * size);
+
+		if (!resized) {
+			perror("Could not record heap event");
+			return NULL;
+		}
+
+		*array = resized;
+		*capacity = grown;
+	}
+
+	return (uint8_t*)*array + (*count)++ * size;
+}
+
+// Calls the allocator makes itself, like malloc_raw splitting a block
+// with free_raw, are part of the outer call
+static bool mcu_heap_internal(mcu_t mcu, uint32_t addr)
+{
+	for (heap_function_t function = 0; function < heap_function_count; function++) {
+		mcu_symbol_t symbol = mcu_symbol_named(mcu, mcu_heap_function_names[function]);
+
+		if (symbol && addr - symbol->addr < symbol->size)
+			return true;
+	}
+
+	return false;
+}
+
+static void mcu_heap_sample(mcu_t mcu, mcu_heap_t heap)
+{
+	struct mcu_heap_sample sample = {
+		.cycles = mcu->cycles,
+		.used = heap->used,
+	};
+	uint32_t block = 0;
+
+	if (heap->free_head && !mcu_fetch32(mcu, heap->free_head, &block))
+		block = 0;
+
+	// Walk the free list like get_free_size does
+	while (block != 0 && sample.blocks < mcu_heap_max_blocks) {
+		uint32_t size;
+
+		if (!mcu_fetch32(mcu, block, &size) || !mcu_fetch32(mcu, block + 4, &block))
+			break;
+
+		sample.free += size;
+		sample.blocks++;
+
+		if (size > sample.largest)
+			sample.largest = size;
+	}
+
+	if (heap->sample_count > 0) {
+		struct mcu_heap_sample* last = &heap->samples[heap->sample_count - 1];
+
+		if (last->used == sample.used && last->free == sample.free &&
+			last->blocks == sample.blocks && last->largest == sample.largest)
+			return;
+	}
+
+	struct mcu_heap_sample* entry = mcu_heap_grow((void**)&heap->samples, &heap->sample_count,
+		&heap->sample_capacity, sizeof(struct mcu_heap_sample));
+
+	if (entry)
+		*entry = sample;
+}
+
+static void mcu_heap_allocated(mcu_t mcu, mcu_heap_t heap, struct mcu_heap_call* call, uint32_t addr)
+{
+	if (addr == 0) {
+		heap->failed++;
+		return;
+	}
+
+	struct mcu_heap_allocation* allocation = mcu_heap_grow((void**)&heap->allocations,
+		&heap->allocation_count, &heap->allocation_capacity, sizeof(struct mcu_heap_allocation));
+
+	if (!allocation)
+		return;
+
+	*allocation = (struct mcu_heap_allocation){
+		.addr = addr,
+		.size = call->args[0],
+		.caller = call->caller,
+		.raw = call->function == heap_malloc_raw,
+		.live = true,
+		.allocated = mcu->cycles,
+	};
+
+	heap->used += allocation->size + (allocation->raw ? 0 : mcu_heap_malloc_header);
+
+	if (heap->used > heap->peak_used) {
+		heap->peak_used = heap->used;
+		heap->peak_cycles = mcu->cycles;
+	}
+}
+
+static void mcu_heap_freed(mcu_t mcu, mcu_heap_t heap, struct mcu_heap_call* call)
+{
+	// Recent allocations are the likely ones to go
+	for (uint32_t i = heap->allocation_count; i-- > 0; ) {
+		struct mcu_heap_allocation* allocation = &heap->allocations[i];
+
+		if (allocation->live && allocation->addr == call->args[0]) {
+			allocation->live = false;
+			allocation->freed = mcu->cycles;
+			heap->used -= allocation->size + (allocation->raw ? 0 : mcu_heap_malloc_header);
+			return;
+		}
+	}
+
+	if (call->function == heap_free_raw)
+		heap->heap_size += call->args[1];
+	else
+		heap->unknown_frees++;
+}
+
+static void mcu_heap_entry(mcu_t mcu, uint32_t addr, void* context)
+{
+	struct mcu_heap_hook* hook = context;
+	mcu_heap_t heap = hook->heap;
+	uint32_t caller = (mcu_read_reg(mcu, REG_LR) & ~1) - 2;
+
+	if (mcu_heap_internal(mcu, caller))
+		return;
+
+	struct mcu_heap_call* call = mcu_heap_grow((void**)&heap->calls, &heap->call_count,
+		&heap->call_capacity, sizeof(struct mcu_heap_call));
+
+	if (!call)
+		return;
+
+	*call = (struct mcu_heap_call){
+		.function = hook->function,
+		.sp = mcu_read_reg(mcu, REG_SP),
+		.args = { mcu_read_reg(mcu, 0), mcu_read_reg(mcu, 1) },
+		.caller = caller,
+	};
+}
+
+static void mcu_heap_exit(mcu_t mcu, uint32_t addr, void* context)
+{
+	struct mcu_heap_hook* hook = context;
+	mcu_heap_t heap = hook->heap;
+	uint32_t sp = mcu_read_reg(mcu, REG_SP);
+
+	// Threads may be in the allocator at the same time, the stack
+	// pointer tells their calls apart
+	for (uint32_t i = heap->call_count; i-- > 0; ) {
+		struct mcu_heap_call call = heap->calls[i];
+
+		if (call.function != hook->function || call.sp != sp)
+			continue;
+
+		heap->calls[i] = heap->calls[--heap->call_count];
+
+		if (call.function == heap_malloc_raw || call.function == heap_malloc)
+			mcu_heap_allocated(mcu, heap, &call, mcu_read_reg(mcu, 0));
+		else
+			mcu_heap_freed(mcu, heap, &call);
+
+		mcu_heap_sample(mcu, heap);
+		return;
+	}
+}
+
+bool mcu_heap_start(mcu_t mcu)
+{
+	if (mcu->heap)
+		return true;
+
+	if (!mcu_symbol_named(mcu, "malloc_raw") || !mcu_symbol_named(mcu, "free_raw")) {
+		printf("Firmware has no malloc_raw and free_raw symbols\n");
+		return false;
+	}
+
+	mcu_heap_t heap = calloc(1, sizeof(struct mcu_heap));
+
+	if (!heap) {
+		perror("Could not allocate mcu_heap structure");
+		return false;
+	}
+
+	mcu_symbol_t free_head = mcu_symbol_named(mcu, "free_head");
+
+	if (free_head)
+		heap->free_head = free_head->addr;
+	else
+		printf("Firmware has no free_head symbol, fragmentation is not tracked\n");
+
+	mcu->heap = heap;
+
+	for (heap_function_t function = 0; function < heap_function_count; function++) {
+		struct mcu_heap_hook* hook = &heap->hooks[function];
+
+		hook->heap = heap;
+		hook->function = function;
+		hook->hook.entry = mcu_heap_entry;
+		hook->hook.exit = mcu_heap_exit;
+		hook->hook.context = hook;
+
+		// malloc and free are left out of firmware that does not use them
+		if (mcu_symbol_named(mcu, mcu_heap_function_names[function]) &&
+			!mcu_hook_symbol(mcu, &hook->hook, mcu_heap_function_names[function])) {
+			mcu_heap_stop(mcu);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void mcu_heap_stop(mcu_t mcu)
+{
+	mcu_heap_t heap = mcu->heap;
+
+	if (!heap)
+		return;
+
+	for (heap_function_t function = 0; function < heap_function_count; function++)
+		mcu_hook_remove(mcu, &heap->hooks[function].hook);
+
+	mcu->heap = NULL;
+
+	free(heap->calls);
+	free(heap->allocations);
+	free(heap->samples);
+	free(heap);
+}
+
+// Describes a code address as symbol+offset (file:line)
+static void mcu_heap_describe(mcu_t mcu, uint32_t addr, char* buffer, size_t length)
+{
+	mcu_symbol_t symbol = mcu_symbol_at(mcu, addr);
+	mcu_line_t line = mcu_line_at(mcu, addr);
+	int used;
+
+	if (symbol)
+		used = snprintf(buffer, length, "%s+0x%x", symbol->name, addr - symbol->addr);
+	else
+		used = snprintf(buffer, length, "0x%08x", addr);
+
+	if (line && used >= 0 && (size_t)used < length)
+		snprintf(buffer + used, length - used, " (%s:%u)", mcu->files[line->file], line->line);
+}
+
+// Allocations of one caller
+struct mcu_heap_spot {
+	uint32_t caller;
+	uint32_t count;
+	uint32_t live;
+	uint64_t bytes;
+	uint64_t lifetime;
+	uint32_t freed;
+};
+
+static int mcu_heap_spot_compare(const void* _a, const void* _b)
+{
+	const struct mcu_heap_spot* a = _a;
+	const struct mcu_heap_spot* b = _b;
+
+	if (a->count != b->count)
+		return a->count < b->count ? 1 : -1;
+
+	return (a->bytes < b->bytes) - (a->bytes > b->bytes);
+}
+
+static void mcu_heap_write_spots(mcu_t mcu, mcu_heap_t heap, FILE* out)
+{
+	struct mcu_heap_spot* spots = NULL;
+	uint32_t spot_count = 0;
+	uint32_t spot_capacity = 0;
+	char caller[256];
+
+	for (uint32_t i = 0; i < heap->allocation_count; i++) {
+		struct mcu_heap_allocation* allocation = &heap->allocations[i];
+		struct mcu_heap_spot* spot = NULL;
+
+		for (uint32_t j = 0; j < spot_count; j++) {
+			if (spots[j].caller == allocation->caller) {
+				spot = &spots[j];
+				break;
+			}
+		}
+
+		if (!spot) {
+			spot = mcu_heap_grow((void**)&spots, &spot_count, &spot_capacity, sizeof(struct mcu_heap_spot));
+
+			if (!spot)
+				break;
+
+			*spot = (struct mcu_heap_spot){ .caller = allocation->caller };
+		}
+
+		spot->count++;
+		spot->bytes += allocation->size;
+
+		if (allocation->live) {
+			spot->live++;
+		}
+		else {
+			spot->freed++;
+			spot->lifetime += allocation->freed - allocation->allocated;
+		}
+	}
+
+	if (spot_count > 0)
+		qsort(spots, spot_count, sizeof(struct mcu_heap_spot), mcu_heap_spot_compare);
+
+	fprintf(out, "\nHot spots\n");
+	fprintf(out, "%10s %10s %8s %14s %6s  %s\n", "allocs", "bytes", "avg", "avg lifetime", "live", "caller");
+
+	for (uint32_t i = 0; i < spot_count; i++) {
+		struct mcu_heap_spot* spot = &spots[i];
+
+		mcu_heap_describe(mcu, spot->caller, caller, sizeof(caller));
+
+		fprintf(out, "%10u %10llu %8llu ", spot->count, (unsigned long long)spot->bytes,
+			(unsigned long long)(spot->bytes / spot->count));
+
+		if (spot->freed > 0)
+			fprintf(out, "%14llu ", (unsigned long long)(spot->lifetime / spot->freed));
+		else
+			fprintf(out, "%14s ", "-");
+
+		fprintf(out, "%6u  %s\n", spot->live, caller);
+	}
+
+	free(spots);
+}
+
+bool mcu_heap_write_report(mcu_t mcu, const char* path)
+{
+	mcu_heap_t heap = mcu->heap;
+	char caller[256];
+
+	if (!heap) {
+		printf("No heap use recorded\n");
+		return false;
+	}
+
+	FILE* out = fopen(path, "w");
+
+	if (!out) {
+		perror("Could not open heap report");
+		return false;
+	}
+
+	uint32_t live = 0;
+	uint32_t frees = 0;
+	struct mcu_heap_sample* worst = NULL;
+
+	for (uint32_t i = 0; i < heap->allocation_count; i++) {
+		if (heap->allocations[i].live)
+			live++;
+		else
+			frees++;
+	}
+
+	// Fragmentation is the share of free memory outside the largest block
+	for (uint32_t i = 0; i < heap->sample_count; i++) {
+		struct mcu_heap_sample* sample = &heap->samples[i];
+
+		if (sample->free > 0 && (!worst ||
+			(uint64_t)(sample->free - sample->largest) * worst->free > (uint64_t)(worst->free - worst->largest) * sample->free))
+			worst = sample;
+	}
+
+	fprintf(out, "Heap report after %llu cycles\n\n", (unsigned long long)mcu->cycles);
+	fprintf(out, "Summary\n");
+	fprintf(out, "  heap size          %u bytes\n", heap->heap_size);
+	fprintf(out, "  allocations        %u (%u failed)\n", heap->allocation_count, heap->failed);
+	fprintf(out, "  frees              %u (%u of unknown blocks)\n", frees, heap->unknown_frees);
+	fprintf(out, "  peak use           %u bytes at cycle %llu\n", heap->peak_used, (unsigned long long)heap->peak_cycles);
+	fprintf(out, "  live at end        %u allocations, %u bytes\n", live, heap->used);
+
+	if (worst)
+		fprintf(out, "  worst fragmentation %u%% at cycle %llu (%u bytes free in %u blocks, largest %u)\n",
+			(uint32_t)((uint64_t)(worst->free - worst->largest) * 100 / worst->free),
+			(unsigned long long)worst->cycles, worst->free, worst->blocks, worst->largest);
+
+	mcu_heap_write_spots(mcu, heap, out);
+
+	fprintf(out, "\nLive allocations\n");
+	fprintf(out, "%10s %8s %12s  %s\n", "addr", "size", "allocated", "caller");
+
+	for (uint32_t i = 0; i < heap->allocation_count; i++) {
+		struct mcu_heap_allocation* allocation = &heap->allocations[i];
+
+		if (!allocation->live)
+			continue;
+
+		mcu_heap_describe(mcu, allocation->caller, caller, sizeof(caller));
+		fprintf(out, "0x%08x %8u %12llu  %s\n", allocation->addr, allocation->size,
+			(unsigned long long)allocation->allocated, caller);
+	}
+
+	fprintf(out, "\nFree list over time\n");
+	fprintf(out, "%14s %8s %8s %8s %8s %6s\n", "cycles", "used", "free", "blocks", "largest", "frag");
+
+	for (uint32_t i = 0; i < heap->sample_count; i++) {
+		struct mcu_heap_sample* sample = &heap->samples[i];
+		uint32_t fragmentation = sample->free ? (uint64_t)(sample->free - sample->largest) * 100 / sample->free : 0;
+
+		fprintf(out, "%14llu %8u %8u %8u %8u %5u%%\n", (unsigned long long)sample->cycles,
+			sample->used, sample->free, sample->blocks, sample->largest, fragmentation);
+	}
+
+	if (fclose(out) != 0) {
+		perror("Could not write heap report");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,273 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <mcu.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// A firmware function run natively. Returns false when it can't be
+// emulated, the thumb code then runs instead. units is what the cost
+// per unit is charged for (bytes or characters).
+typedef bool (*mcu_hle_impl_t)(mcu_t mcu, uint32_t* units);
+
+struct mcu_hle_function {
+	const char* name;
+	mcu_hle_impl_t impl;
+
+	// Cycles of the thumb code, taken from the loops gcc emits for
+	// core/string.c and lib/crc at -Os
+	uint32_t fixed;
+	uint32_t per_unit;
+};
+
+struct mcu_hle_hook {
+	struct mcu_hook hook;
+
+	const struct mcu_hle_function* function;
+};
+
+// Host memory for [addr, addr + length), NULL when the range is not
+// plain memory of one device. Watched memory is not plain.
+static uint8_t* mcu_hle_memory(mcu_t mcu, uint32_t addr, uint32_t length, bool write)
+{
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL; dev = dev->next) {
+		if (dev->offset <= addr && addr < dev->offset + dev->length) {
+			if (!dev->direct || length > dev->offset + dev->length - addr)
+				return NULL;
+
+			if (dev->class != mem_class_ram && (write || dev->class != mem_class_flash))
+				return NULL;
+
+			return (uint8_t*)dev->direct + (addr - dev->offset);
+		}
+	}
+
+	return NULL;
+}
+
+// Host memory for the string at addr, which must end in the same device
+static const char* mcu_hle_string(mcu_t mcu, uint32_t addr, uint32_t* length)
+{
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL; dev = dev->next) {
+		if (dev->offset <= addr && addr < dev->offset + dev->length) {
+			uint32_t available = dev->offset + dev->length - addr;
+			const char* string = (const char*)mcu_hle_memory(mcu, addr, available, false);
+			const char* end = string ? memchr(string, '\0', available) : NULL;
+
+			if (!end)
+				return NULL;
+
+			*length = end - string;
+			return string;
+		}
+	}
+
+	return NULL;
+}
+
+static bool mcu_hle_memcpy(mcu_t mcu, uint32_t* units)
+{
+	uint32_t n = mcu_read_reg(mcu, 2);
+	uint8_t* dst = mcu_hle_memory(mcu, mcu_read_reg(mcu, 0), n, true);
+	const uint8_t* src = mcu_hle_memory(mcu, mcu_read_reg(mcu, 1), n, false);
+
+	if (!dst || !src)
+		return false;
+
+	// Overlapping copies go front to back, like the thumb code
+	for (uint32_t i = 0; i < n; i++)
+		dst[i] = src[i];
+
+	*units = n;
+
+	return true;
+}
+
+static bool mcu_hle_memmove(mcu_t mcu, uint32_t* units)
+{
+	uint32_t n = mcu_read_reg(mcu, 2);
+	uint8_t* dst = mcu_hle_memory(mcu, mcu_read_reg(mcu, 0), n, true);
+	const uint8_t* src = mcu_hle_memory(mcu, mcu_read_reg(mcu, 1), n, false);
+
+	if (!dst || !src)
+		return false;
+
+	memmove(dst, src, n);
+	*units = n;
+
+	return true;
+}
+
+static bool mcu_hle_memset(mcu_t mcu, uint32_t* units)
+{
+	uint32_t n = mcu_read_reg(mcu, 2);
+	uint8_t* b = mcu_hle_memory(mcu, mcu_read_reg(mcu, 0), n, true);
+
+	if (!b)
+		return false;
+
+	memset(b, mcu_read_reg(mcu, 1) & 0xFF, n);
+	*units = n;
+
+	return true;
+}
+
+static bool mcu_hle_strlen(mcu_t mcu, uint32_t* units)
+{
+	uint32_t length;
+
+	if (!mcu_hle_string(mcu, mcu_read_reg(mcu, 0), &length))
+		return false;
+
+	mcu_write_reg(mcu, 0, length);
+	*units = length;
+
+	return true;
+}
+
+static bool mcu_hle_strcmp(mcu_t mcu, uint32_t* units)
+{
+	uint32_t length1, length2;
+	const uint8_t* s1 = (const uint8_t*)mcu_hle_string(mcu, mcu_read_reg(mcu, 0), &length1);
+	const uint8_t* s2 = (const uint8_t*)mcu_hle_string(mcu, mcu_read_reg(mcu, 1), &length2);
+	uint32_t i = 0;
+
+	if (!s1 || !s2)
+		return false;
+
+	while (s1[i] && s1[i] == s2[i])
+		i++;
+
+	// char is unsigned on arm
+	mcu_write_reg(mcu, 0, s1[i] < s2[i] ? -1 : s1[i] > s2[i]);
+	*units = i + 1;
+
+	return true;
+}
+
+static bool mcu_hle_crc8_maxim(mcu_t mcu, uint32_t* units)
+{
+	uint32_t n = mcu_read_reg(mcu, 1);
+	const uint8_t* data = mcu_hle_memory(mcu, mcu_read_reg(mcu, 0), n, false);
+	uint8_t crc = 0;
+
+	if (!data)
+		return false;
+
+	for (uint32_t i = 0; i < n; i++) {
+		crc ^= data[i];
+
+		for (uint8_t bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+	}
+
+	mcu_write_reg(mcu, 0, crc);
+	*units = n;
+
+	return true;
+}
+
+static const struct mcu_hle_function mcu_hle_functions[] = {
+	{ "memcpy",     mcu_hle_memcpy,     8,  5 },
+	{ "memmove",    mcu_hle_memmove,    10, 5 },
+	{ "memset",     mcu_hle_memset,     6,  4 },
+	{ "strlen",     mcu_hle_strlen,     6,  4 },
+	{ "strcmp",     mcu_hle_strcmp,     14, 9 },
+	{ "crc8_maxim", mcu_hle_crc8_maxim, 8,  50 },
+};
+
+#define MCU_HLE_FUNCTION_COUNT (sizeof(mcu_hle_functions) / sizeof(mcu_hle_functions[0]))
+
+struct mcu_hle {
+	struct mcu_hle_hook hooks[MCU_HLE_FUNCTION_COUNT];
+};
+
+static bool mcu_hle_call(mcu_t mcu, uint32_t addr, void* context)
+{
+	const struct mcu_hle_function* function = ((struct mcu_hle_hook*)context)->function;
+	uint32_t units = 0;
+
+	if (!function->impl(mcu, &units))
+		return true;
+
+	// Return like bx lr, the dispatch already counted one cycle
+	mcu_write_reg(mcu, REG_PC, (mcu_read_reg(mcu, REG_LR) & ~1) + 2);
+	mcu->cycles += function->fixed + (uint64_t)function->per_unit * units - 1;
+
+	return false;
+}
+
+bool mcu_hle_start(mcu_t mcu)
+{
+	if (mcu->hle)
+		return true;
+
+	mcu_hle_t hle = calloc(1, sizeof(struct mcu_hle));
+
+	if (!hle) {
+		perror("Could not allocate mcu_hle structure");
+		return false;
+	}
+
+	mcu->hle = hle;
+
+	for (uint32_t i = 0; i < MCU_HLE_FUNCTION_COUNT; i++) {
+		struct mcu_hle_hook* hook = &hle->hooks[i];
+		mcu_symbol_t symbol = mcu_symbol_named(mcu, mcu_hle_functions[i].name);
+
+		if (!symbol || !symbol->function)
+			continue;
+
+		hook->function = &mcu_hle_functions[i];
+		hook->hook.type = mcu_hook_instruction;
+		hook->hook.addr = symbol->addr;
+		hook->hook.length = 2;
+		hook->hook.instruction = mcu_hle_call;
+		hook->hook.context = hook;
+
+		if (!mcu_hook_add(mcu, &hook->hook)) {
+			mcu_hle_stop(mcu);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void mcu_hle_stop(mcu_t mcu)
+{
+	mcu_hle_t hle = mcu->hle;
+
+	if (!hle)
+		return;
+
+	for (uint32_t i = 0; i < MCU_HLE_FUNCTION_COUNT; i++)
+		if (hle->hooks[i].function)
+			mcu_hook_remove(mcu, &hle->hooks[i].hook);
+
+	mcu->hle = NULL;
+	free(hle);
+}
@@ -0,0 +1,391 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <mcu.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Where a hooked function returns to. The stack pointer tells
+// recursive calls apart.
+struct mcu_hook_return {
+	uint32_t addr;
+	uint32_t sp;
+};
+
+// Memory hooks put a watch device in front of the devices they
+// observe, the device list stays untouched while there are none
+struct mcu_watch {
+	struct mem_dev mem_dev;
+
+	mcu_hook_t hook;
+};
+
+static const uint16_t mcu_watch_mem_type = 0xFFFF;
+
+// The device the watch hides
+static mem_dev_t mcu_watch_target(mem_dev_t watch, uint32_t addr)
+{
+	for (mem_dev_t dev = watch->next; dev != NULL; dev = dev->next)
+		if (dev->offset <= addr && addr < dev->offset + dev->length)
+			return dev;
+
+	return NULL;
+}
+
+static bool mcu_watch_fetch16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t* value)
+{
+	mcu_hook_t hook = ((struct mcu_watch*)mem_dev)->hook;
+	mem_dev_t dev = mcu_watch_target(mem_dev, mem_dev->offset + addr);
+
+	addr += mem_dev->offset;
+
+	if (!dev || !dev->fetch16 || !dev->fetch16(mcu, dev, addr - dev->offset, value))
+		return false;
+
+	hook->access(mcu, addr, *value, 2, false, hook->context);
+
+	return true;
+}
+
+static bool mcu_watch_fetch32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t* value)
+{
+	mcu_hook_t hook = ((struct mcu_watch*)mem_dev)->hook;
+	mem_dev_t dev = mcu_watch_target(mem_dev, mem_dev->offset + addr);
+
+	addr += mem_dev->offset;
+
+	if (!dev || !dev->fetch32 || !dev->fetch32(mcu, dev, addr - dev->offset, value))
+		return false;
+
+	hook->access(mcu, addr, *value, 4, false, hook->context);
+
+	return true;
+}
+
+static bool mcu_watch_write16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t value)
+{
+	mcu_hook_t hook = ((struct mcu_watch*)mem_dev)->hook;
+	mem_dev_t dev = mcu_watch_target(mem_dev, mem_dev->offset + addr);
+
+	addr += mem_dev->offset;
+
+	if (!dev || !dev->write16 || !dev->write16(mcu, dev, addr - dev->offset, value))
+		return false;
+
+	hook->access(mcu, addr, value, 2, true, hook->context);
+
+	return true;
+}
+
+static bool mcu_watch_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t value)
+{
+	mcu_hook_t hook = ((struct mcu_watch*)mem_dev)->hook;
+	mem_dev_t dev = mcu_watch_target(mem_dev, mem_dev->offset + addr);
+
+	addr += mem_dev->offset;
+
+	if (!dev || !dev->write32 || !dev->write32(mcu, dev, addr - dev->offset, value))
+		return false;
+
+	hook->access(mcu, addr, value, 4, true, hook->context);
+
+	return true;
+}
+
+static bool mcu_watch_add(mcu_t mcu, mcu_hook_t hook)
+{
+	struct mcu_watch* watch = calloc(1, sizeof(struct mcu_watch));
+
+	if (!watch) {
+		perror("Could not allocate mcu_watch structure");
+		return false;
+	}
+
+	watch->mem_dev.class = mem_class_io;
+	watch->mem_dev.type = mcu_watch_mem_type;
+	watch->mem_dev.fetch16 = mcu_watch_fetch16;
+	watch->mem_dev.fetch32 = mcu_watch_fetch32;
+	watch->mem_dev.write16 = mcu_watch_write16;
+	watch->mem_dev.write32 = mcu_watch_write32;
+	watch->mem_dev.length = hook->length;
+	watch->hook = hook;
+
+	hook->watch = (mem_dev_t)watch;
+
+	// New devices go to the front, hiding the watched ones
+	return mcu_add_mem_dev(mcu, hook->addr, (mem_dev_t)watch);
+}
+
+static void mcu_watch_remove(mcu_t mcu, mcu_hook_t hook)
+{
+	for (mem_dev_t* pos = &mcu->mem_devs; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == hook->watch) {
+			*pos = hook->watch->next;
+			break;
+		}
+	}
+
+	free(hook->watch);
+	hook->watch = NULL;
+}
+
+bool mcu_hook_add(mcu_t mcu, mcu_hook_t hook)
+{
+	if (hook->type >= mcu_hook_type_count)
+		return false;
+
+	if (hook->type == mcu_hook_memory && !mcu_watch_add(mcu, hook))
+		return false;
+
+	hook->returns_count = 0;
+	hook->next = mcu->hooks[hook->type];
+	mcu->hooks[hook->type] = hook;
+
+	// Decoded instructions carry whether they are hooked
+	if (hook->type == mcu_hook_instruction || hook->type == mcu_hook_function)
+		mcu_decode_cache_flush(mcu);
+
+	return true;
+}
+
+bool mcu_hook_symbol(mcu_t mcu, mcu_hook_t hook, const char* symbol)
+{
+	mcu_symbol_t sym = mcu_symbol_named(mcu, symbol);
+
+	if (!sym || !sym->function) {
+		printf("Unknown function %s\n", symbol);
+		return false;
+	}
+
+	hook->type = mcu_hook_function;
+	hook->addr = sym->addr;
+	hook->length = sym->size;
+
+	return mcu_hook_add(mcu, hook);
+}
+
+bool mcu_hook_device(mcu_t mcu, mcu_hook_t hook, uint32_t addr)
+{
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL; dev = dev->next) {
+		if (dev->offset <= addr && addr < dev->offset + dev->length) {
+			hook->type = mcu_hook_memory;
+			hook->addr = dev->offset;
+			hook->length = dev->length;
+
+			return mcu_hook_add(mcu, hook);
+		}
+	}
+
+	printf("No device at 0x%x\n", addr);
+	return false;
+}
+
+void mcu_hook_remove(mcu_t mcu, mcu_hook_t hook)
+{
+	for (mcu_hook_t* pos = &mcu->hooks[hook->type]; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == hook) {
+			*pos = hook->next;
+			hook->next = NULL;
+			break;
+		}
+	}
+
+	if (hook->watch)
+		mcu_watch_remove(mcu, hook);
+
+	free(hook->returns);
+	hook->returns = NULL;
+	hook->returns_count = 0;
+	hook->returns_capacity = 0;
+
+	if (hook->type == mcu_hook_instruction || hook->type == mcu_hook_function)
+		mcu_decode_cache_flush(mcu);
+}
+
+bool mcu_hooked(mcu_t mcu, uint32_t addr)
+{
+	for (mcu_hook_t hook = mcu->hooks[mcu_hook_instruction]; hook != NULL; hook = hook->next)
+		if (addr - hook->addr < hook->length)
+			return true;
+
+	for (mcu_hook_t hook = mcu->hooks[mcu_hook_function]; hook != NULL; hook = hook->next) {
+		if (addr == hook->addr)
+			return true;
+
+		for (uint32_t i = 0; i < hook->returns_count; i++)
+			if (hook->returns[i].addr == addr)
+				return true;
+	}
+
+	return false;
+}
+
+static void mcu_hook_push_return(mcu_t mcu, mcu_hook_t hook, uint32_t addr, uint32_t sp)
+{
+	if (hook->returns_count == hook->returns_capacity) {
+		uint32_t capacity = hook->returns_capacity ? hook->returns_capacity * 2 : 8;
+		struct mcu_hook_return* returns = realloc(hook->returns, capacity * sizeof(struct mcu_hook_return));
+
+		if (!returns) {
+			perror("Could not track function return");
+			return;
+		}
+
+		hook->returns = returns;
+		hook->returns_capacity = capacity;
+	}
+
+	hook->returns[hook->returns_count++] = (struct mcu_hook_return){ addr, sp };
+
+	// Make the return address stop by the hooks
+	mcu_decoded_t decoded = mcu_decoded_at(mcu, addr);
+
+	if (decoded)
+		decoded->hooked = true;
+}
+
+bool mcu_hooks_instruction(mcu_t mcu, uint32_t addr)
+{
+	bool execute = true;
+	mcu_hook_t next;
+
+	for (mcu_hook_t hook = mcu->hooks[mcu_hook_function]; hook != NULL; hook = next) {
+		next = hook->next;
+
+		uint32_t sp = mcu_read_reg(mcu, REG_SP);
+
+		if (hook->returns_count > 0) {
+			struct mcu_hook_return* top = &hook->returns[hook->returns_count - 1];
+
+			if (top->addr == addr && top->sp == sp) {
+				hook->returns_count--;
+
+				if (hook->exit)
+					hook->exit(mcu, addr, hook->context);
+			}
+		}
+
+		if (addr == hook->addr) {
+			mcu_hook_push_return(mcu, hook, mcu_read_reg(mcu, REG_LR) & ~1, sp);
+
+			if (hook->entry)
+				hook->entry(mcu, addr, hook->context);
+		}
+	}
+
+	for (mcu_hook_t hook = mcu->hooks[mcu_hook_instruction]; hook != NULL; hook = next) {
+		next = hook->next;
+
+		if (addr - hook->addr < hook->length && hook->instruction &&
+			!hook->instruction(mcu, addr, hook->context))
+			execute = false;
+	}
+
+	return execute;
+}
+
+void mcu_hooks_exception_entry(mcu_t mcu, uint32_t exception)
+{
+	mcu_hook_t next;
+
+	for (mcu_hook_t hook = mcu->hooks[mcu_hook_exception]; hook != NULL; hook = next) {
+		next = hook->next;
+
+		if (hook->entry)
+			hook->entry(mcu, exception, hook->context);
+	}
+}
+
+void mcu_hooks_exception_exit(mcu_t mcu, uint32_t exception)
+{
+	mcu_hook_t next;
+
+	for (mcu_hook_t hook = mcu->hooks[mcu_hook_exception]; hook != NULL; hook = next) {
+		next = hook->next;
+
+		if (hook->exit)
+			hook->exit(mcu, exception, hook->context);
+	}
+}
+
+bool mcu_add_symbol(mcu_t mcu, const char* name, uint32_t addr, uint32_t size, bool function)
+{
+	mcu_symbol_t symbols = realloc(mcu->symbols, (mcu->symbol_count + 1) * sizeof(struct mcu_symbol));
+
+	if (!symbols) {
+		perror("Could not allocate symbol");
+		return false;
+	}
+
+	mcu->symbols = symbols;
+
+	char* copy = strdup(name);
+
+	if (!copy) {
+		perror("Could not allocate symbol");
+		return false;
+	}
+
+	mcu->symbols[mcu->symbol_count++] = (struct mcu_symbol){
+		.name = copy,
+		.addr = addr,
+		.size = size,
+		.function = function,
+	};
+
+	return true;
+}
+
+void mcu_clear_symbols(mcu_t mcu)
+{
+	for (uint32_t i = 0; i < mcu->symbol_count; i++)
+		free(mcu->symbols[i].name);
+
+	free(mcu->symbols);
+	mcu->symbols = NULL;
+	mcu->symbol_count = 0;
+}
+
+mcu_symbol_t mcu_symbol_named(mcu_t mcu, const char* name)
+{
+	for (uint32_t i = 0; i < mcu->symbol_count; i++)
+		if (strcmp(mcu->symbols[i].name, name) == 0)
+			return &mcu->symbols[i];
+
+	return NULL;
+}
+
+mcu_symbol_t mcu_symbol_at(mcu_t mcu, uint32_t addr)
+{
+	for (uint32_t i = 0; i < mcu->symbol_count; i++) {
+		mcu_symbol_t symbol = &mcu->symbols[i];
+
+		if (addr - symbol->addr < symbol->size || addr == symbol->addr)
+			return symbol;
+	}
+
+	return NULL;
+}
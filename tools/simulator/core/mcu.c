@@ -25,25 +25,158 @@
 #include <mcu.h>
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #define FIXUP_MCU(a, b) ((mcu_t)((uintptr_t)a - __builtin_offsetof(struct mcu, b)))
 
+// Lagging further behind than this does not make the mcu
+// run faster to catch up, e.g. after the host was busy
+static const uint64_t mcu_pace_max_lag = 100000000; // 100ms
+
+static uint64_t mcu_monotonic_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void mcu_pace_restart(mcu_t mcu)
+{
+	mcu->pace_start = mcu_monotonic_ns();
+	mcu->pace_cycles = mcu->cycles;
+}
+
+// Returns how many ns the simulated time is ahead of the wall clock
+static uint64_t mcu_pace_ahead(mcu_t mcu)
+{
+	uint64_t elapsed = mcu_monotonic_ns() - mcu->pace_start;
+	uint64_t simulated = (double)(mcu->cycles - mcu->pace_cycles) * 1e9
+		/ ((double)mcu->frequency * mcu->speed);
+
+	if (simulated > elapsed)
+		return simulated - elapsed;
+
+	if (elapsed - simulated > mcu_pace_max_lag)
+		mcu_pace_restart(mcu);
+
+	return 0;
+}
+
+// Cycles executed between two looks at the clock, 1ms of simulated time
+static uint64_t mcu_pace_batch(mcu_t mcu)
+{
+	return mcu->frequency / 1000 ?: 1;
+}
+
 static void idle_cb (struct ev_loop *loop, ev_idle *w, int revents)
 {
 	mcu_t mcu = FIXUP_MCU(w, idle);
 
-	mcu_runloop(mcu);
+	if (mcu->speed == 0) {
+		mcu_runloop(mcu);
+		mcu_shm_update(mcu);
+		return;
+	}
+
+	uint64_t end = mcu->cycles + mcu_pace_batch(mcu);
+
+	while (!mcu_is_halted(mcu) && mcu->cycles < end)
+		mcu_runloop(mcu);
+
+	mcu_shm_update(mcu);
+
+	if (mcu_is_halted(mcu))
+		return;
+
+	uint64_t ahead = mcu_pace_ahead(mcu);
+
+	// Sleep in the event loop so gdb and devices are served meanwhile
+	if (ahead > 0) {
+		ev_idle_stop(loop, &mcu->idle);
+		ev_timer_set(&mcu->pace_timer, ahead / 1e9, 0.);
+		ev_timer_start(loop, &mcu->pace_timer);
+	}
+}
+
+static void pace_cb (struct ev_loop *loop, ev_timer *w, int revents)
+{
+	mcu_t mcu = FIXUP_MCU(w, pace_timer);
+
+	if (!mcu_is_halted(mcu))
+		ev_idle_start(loop, &mcu->idle);
 }
 
 bool mcu_init(mcu_t mcu, struct ev_loop* loop)
 {
 	mcu->loop = loop;
+	mcu->state = mcu_halted;
+	mcu->halt_reason = HALT_STOPPED;
 
 	ev_idle_init(&mcu->idle, idle_cb);
+	ev_timer_init(&mcu->pace_timer, pace_cb, 0., 0.);
+
+	return true;
+}
+
+void mcu_destroy(mcu_t mcu)
+{
+	mcu_thread_stop(mcu);
+
+	if (mcu->loop) {
+		ev_idle_stop(mcu->loop, &mcu->idle);
+		ev_timer_stop(mcu->loop, &mcu->pace_timer);
+	}
+
+	mem_dev_t dev = mcu->mem_devs;
+
+	while (dev != NULL) {
+		mem_dev_t next = dev->next;
+
+		if (dev->destroy)
+			dev->destroy(dev);
+		else
+			free(dev);
+
+		dev = next;
+	}
+
+	// The devices are gone, nothing uses the shared memory anymore
+	mcu_shm_destroy(mcu);
+	mcu_hle_stop(mcu);
+	mcu_heap_stop(mcu);
+	mcu_coverage_stop(mcu);
+	mcu_clear_lines(mcu);
+	mcu_clear_symbols(mcu);
+	free(mcu->decoded);
+	free(mcu);
+}
+
+bool mcu_decode_cache_init(mcu_t mcu, uint32_t base, uint32_t length)
+{
+	mcu_decoded_t decoded = calloc(length / 2, sizeof(struct mcu_decoded));
+
+	if (!decoded) {
+		perror("Could not allocate decode cache");
+		return false;
+	}
+
+	free(mcu->decoded);
+	mcu->decoded = decoded;
+	mcu->decoded_base = base;
+	mcu->decoded_length = length;
 
 	return true;
 }
 
+void mcu_decode_cache_flush(mcu_t mcu)
+{
+	if (mcu->decoded)
+		memset(mcu->decoded, 0, (mcu->decoded_length / 2) * sizeof(struct mcu_decoded));
+}
+
 #define DECLARE_MEM_OP(name, type) \
 bool mcu_##name(mcu_t mcu, uint32_t addr, type value) \
 { \
@@ -66,6 +199,27 @@ DECLARE_MEM_OP(fetch32, uint32_t*);
 DECLARE_MEM_OP(write16, uint16_t);
 DECLARE_MEM_OP(write32, uint32_t);
 
+uint32_t* mcu_mem_direct(mcu_t mcu, uint32_t addr, uint32_t length)
+{
+	// Memory hooks need to see every access
+	if ((addr & 3) || mcu->hooks[mcu_hook_memory])
+		return NULL;
+
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL; dev = dev->next) {
+		if (dev->offset <= addr && addr < dev->offset + dev->length) {
+			if (dev->class != mem_class_ram || dev->direct == NULL)
+				return NULL;
+
+			if (length > dev->offset + dev->length - addr)
+				return NULL;
+
+			return dev->direct + ((addr - dev->offset) >> 2);
+		}
+	}
+
+	return NULL;
+}
+
 bool mcu_emu_fetch16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t* valueOut)
 {
 	uint32_t value;
@@ -74,9 +228,9 @@ bool mcu_emu_fetch16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t* valu
 		return false;
 
 	if (addr & 2)
-		*valueOut = (value >> 0) & 0xFFFF;
-	else
 		*valueOut = (value >> 16) & 0xFFFF;
+	else
+		*valueOut = (value >> 0) & 0xFFFF;
 
 	return true;
 }
@@ -89,9 +243,9 @@ bool mcu_emu_write16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t value
 		return false;
 
 	if (addr & 2)
-		value = (value & ~0xFFFF) | ((valueIn << 0) & 0xFFFF);
+		value = (value &  0xFFFF) | ((uint32_t)valueIn << 16);
 	else
-		value = (value &  0xFFFF) | ((valueIn << 16) & ~0xFFFF);
+		value = (value & ~0xFFFF) | ((valueIn << 0) & 0xFFFF);
 
 	return mem_dev->write32(mcu, mem_dev, addr & ~2, value);
 }
@@ -137,6 +291,14 @@ bool mcu_add_mem_dev(mcu_t mcu, uint32_t offset, mem_dev_t dev)
 	return true;
 }
 
+void mcu_reset_mem_devs(mcu_t mcu)
+{
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL; dev = dev->next) {
+		if (dev->reset)
+			dev->reset(mcu, dev);
+	}
+}
+
 bool mcu_is_unlocked(mcu_t mcu)
 {
 	return mcu->unlocked;
@@ -146,12 +308,17 @@ bool mcu_unlock(mcu_t mcu)
 {
 	mcu->unlocked = true;
 
+	// Code may be written while unlocked
+	mcu_decode_cache_flush(mcu);
+
 	return true;
 }
 
 bool mcu_lock(mcu_t mcu)
 {
 	mcu->unlocked = false;
+
+	mcu_decode_cache_flush(mcu);
 	
 	return true;
 }
@@ -166,6 +333,15 @@ halt_reason_t mcu_halt_reason(mcu_t mcu)
 	return mcu->halt_reason;
 }
 
+static void mcu_notify_halt(mcu_t mcu, void* context)
+{
+	halt_reason_t reason = (intptr_t)context;
+
+	for (mcu_callbacks_t callbacks = mcu->callbacks; callbacks != NULL; callbacks = callbacks->next)
+		if (callbacks->mcu_did_halt)
+			callbacks->mcu_did_halt(mcu, reason, callbacks->context);
+}
+
 bool mcu_halt(mcu_t mcu, halt_reason_t reason)
 {
 	if (mcu_is_halted(mcu))
@@ -174,14 +350,17 @@ bool mcu_halt(mcu_t mcu, halt_reason_t reason)
 	mcu->state = mcu_halted;
 	mcu->halt_reason = reason;
 
-	ev_idle_stop(mcu->loop, &mcu->idle);
+	if (mcu->loop && !mcu->thread) {
+		ev_idle_stop(mcu->loop, &mcu->idle);
+		ev_timer_stop(mcu->loop, &mcu->pace_timer);
+	}
 
 	if (reason >= 0)
 		printf("[MCU] halted\n");
 
-	for (mcu_callbacks_t callbacks = mcu->callbacks; callbacks != NULL; callbacks = callbacks->next)
-		if (callbacks->mcu_did_halt)
-			callbacks->mcu_did_halt(mcu, reason, callbacks->context);
+	mcu_shm_update(mcu);
+
+	mcu_post_loop(mcu, mcu_notify_halt, (void*)(intptr_t)reason);
 
 	return true;
 }
@@ -192,8 +371,19 @@ bool mcu_resume(mcu_t mcu)
 		return true;
 
 	mcu->state = mcu_running;
-	ev_idle_start(mcu->loop, &mcu->idle);
-	printf("[MCU] resumed\n");
+
+	// Time spent halted or sleeping without pending events
+	// does not need to be caught up
+	mcu_pace_restart(mcu);
+
+	// The execution thread picks this up on its own
+	if (mcu->loop && !mcu->thread)
+		ev_idle_start(mcu->loop, &mcu->idle);
+
+	if (mcu->halt_reason >= 0)
+		printf("[MCU] resumed\n");
+
+	mcu_shm_update(mcu);
 
 	return true;
 }
@@ -201,7 +391,12 @@ bool mcu_resume(mcu_t mcu)
 bool mcu_runloop(mcu_t mcu)
 {
 	if (!mcu_is_halted(mcu)) {
-		return mcu_instr_step(mcu);
+		bool result = mcu_instr_step(mcu);
+
+		if (mcu_events_due(mcu))
+			mcu_events_run(mcu);
+
+		return result;
 	}
 
 	return true;
@@ -209,7 +404,79 @@ bool mcu_runloop(mcu_t mcu)
 
 bool mcu_step(mcu_t mcu)
 {
-	return mcu_instr_step(mcu);
+	mcu->stepping = true;
+	bool result = mcu_instr_step(mcu);
+	mcu->stepping = false;
+
+	if (mcu_events_due(mcu))
+		mcu_events_run(mcu);
+
+	return result;
+}
+
+void mcu_set_speed(mcu_t mcu, uint32_t factor)
+{
+	mcu->speed = factor;
+	mcu_pace_restart(mcu);
+}
+
+void mcu_pace(mcu_t mcu)
+{
+	mcu_shm_update(mcu);
+
+	if (mcu->speed == 0)
+		return;
+
+	uint64_t ahead = mcu_pace_ahead(mcu);
+
+	if (ahead > 0) {
+		struct timespec ts = {
+			.tv_sec = ahead / 1000000000,
+			.tv_nsec = ahead % 1000000000,
+		};
+
+		nanosleep(&ts, NULL);
+	}
+}
+
+void mcu_event_schedule(mcu_t mcu, mcu_event_t event, uint64_t cycles)
+{
+	mcu_event_cancel(mcu, event);
+
+	event->deadline = mcu->cycles + cycles;
+
+	// Keep the list sorted, events with the same deadline fire in
+	// the order they were scheduled
+	mcu_event_t* pos = &mcu->events;
+	while (*pos != NULL && (*pos)->deadline <= event->deadline)
+		pos = &(*pos)->next;
+
+	event->next = *pos;
+	*pos = event;
+}
+
+void mcu_event_cancel(mcu_t mcu, mcu_event_t event)
+{
+	for (mcu_event_t* pos = &mcu->events; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == event) {
+			*pos = event->next;
+			event->next = NULL;
+			break;
+		}
+	}
+}
+
+void mcu_events_run(mcu_t mcu)
+{
+	while (mcu_events_due(mcu)) {
+		mcu_event_t event = mcu->events;
+
+		mcu->events = event->next;
+		event->next = NULL;
+
+		// The event may reschedule itself
+		event->fire(mcu, event->context);
+	}
 }
 
 void mcu_add_callbacks(mcu_t mcu, mcu_callbacks_t callbacks)
@@ -218,3 +485,63 @@ void mcu_add_callbacks(mcu_t mcu, mcu_callbacks_t callbacks)
 	mcu->callbacks = callbacks;
 }
 
+void mcu_remove_callbacks(mcu_t mcu, mcu_callbacks_t callbacks)
+{
+	for (mcu_callbacks_t* pos = &mcu->callbacks; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == callbacks) {
+			*pos = callbacks->next;
+			callbacks->next = NULL;
+			break;
+		}
+	}
+}
+
+static void mcu_deliver_output(mcu_t mcu, const char* data, size_t length)
+{
+	bool handled = false;
+
+	for (mcu_callbacks_t callbacks = mcu->callbacks; callbacks != NULL; callbacks = callbacks->next) {
+		if (callbacks->mcu_did_output) {
+			callbacks->mcu_did_output(mcu, data, length, callbacks->context);
+			handled = true;
+		}
+	}
+
+	if (!handled)
+		fwrite(data, 1, length, stdout);
+}
+
+struct mcu_output {
+	size_t length;
+	char data[];
+};
+
+static void mcu_deliver_queued_output(mcu_t mcu, void* context)
+{
+	struct mcu_output* output = context;
+
+	mcu_deliver_output(mcu, output->data, output->length);
+	free(output);
+}
+
+void mcu_output(mcu_t mcu, const char* data, size_t length)
+{
+	if (!mcu->thread) {
+		mcu_deliver_output(mcu, data, length);
+		return;
+	}
+
+	// The data only lives until we return
+	struct mcu_output* output = malloc(sizeof(struct mcu_output) + length);
+
+	if (!output) {
+		perror("Could not queue output");
+		return;
+	}
+
+	output->length = length;
+	memcpy(output->data, data, length);
+
+	mcu_post_loop(mcu, mcu_deliver_queued_output, output);
+}
+
@@ -34,6 +34,29 @@ typedef struct mcu_callbacks* mcu_callbacks_t;
 typedef struct mcu_instr16* mcu_instr16_t;
 typedef struct mcu_instr32* mcu_instr32_t;
 typedef struct mem_dev* mem_dev_t;
+typedef struct mcu_event* mcu_event_t;
+typedef struct mcu_decoded* mcu_decoded_t;
+typedef struct mcu_fusion* mcu_fusion_t;
+typedef struct mcu_thread* mcu_thread_t;
+typedef struct mcu_hook* mcu_hook_t;
+typedef struct mcu_symbol* mcu_symbol_t;
+typedef struct mcu_line* mcu_line_t;
+typedef struct mcu_coverage* mcu_coverage_t;
+typedef struct mcu_heap* mcu_heap_t;
+typedef struct mcu_shm* mcu_shm_t;
+typedef struct mcu_hle* mcu_hle_t;
+
+typedef enum {
+	mcu_hook_instruction,
+	mcu_hook_function,
+	mcu_hook_memory,
+	mcu_hook_exception,
+
+	mcu_hook_type_count,
+} mcu_hook_type_t;
+
+/// Work passed between the event loop and the execution thread
+typedef void (*mcu_command_fn_t)(mcu_t mcu, void* context);
 
 typedef enum {
 	mcu_halted,
@@ -53,11 +76,77 @@ struct mcu {
 
 	bool unlocked;
 
+	// Set when the firmware requested to exit (HALT_EXIT)
+	int exit_code;
+
+	// Number of cycles executed since the mcu was created
+	uint64_t cycles;
+	// Core clock in hz, used to convert device timings into cycles
+	uint32_t frequency;
+
+	// Pending device events, sorted by deadline
+	mcu_event_t events;
+
+	// Decode cache for the code region, one entry per halfword
+	mcu_decoded_t decoded;
+	uint32_t decoded_base;
+	uint32_t decoded_length;
+
+	// Instruction pairs that may be fused into a superinstruction
+	mcu_fusion_t fusions;
+
+	// Set while single stepping, superinstructions are not used
+	bool stepping;
+
+	// Simulated time runs this many times faster than wall clock
+	// time, 0 runs as fast as possible
+	uint32_t speed;
+	// Wall clock time (ns) at which pace_cycles were executed
+	uint64_t pace_start;
+	uint64_t pace_cycles;
+
 	struct ev_loop *loop;
 	ev_idle idle;
+	ev_timer pace_timer;
+
+	// Set while the mcu executes on its own thread
+	mcu_thread_t thread;
+
+	// Registered hooks by type
+	mcu_hook_t hooks[mcu_hook_type_count];
+
+	// Symbols of the loaded firmware
+	mcu_symbol_t symbols;
+	uint32_t symbol_count;
+
+	// Source lines of the loaded firmware
+	mcu_line_t lines;
+	uint32_t line_count;
+	char** files;
+	uint32_t file_count;
+
+	// Set while coverage is collected
+	mcu_coverage_t coverage;
+
+	// Set while heap use is analyzed
+	mcu_heap_t heap;
+
+	// Set while memory is published as shared memory object
+	mcu_shm_t shm;
+
+	// Set while library functions are emulated natively
+	mcu_hle_t hle;
 };
 
+/// Initializes the generic part of the mcu
+///
+/// @param loop the event loop the mcu runs in, may be NULL
+///		when the mcu is only driven through mcu_step
+///
 bool mcu_init(mcu_t mcu, struct ev_loop* loop);
+
+/// Frees the mcu together with all its memory devices
+void mcu_destroy(mcu_t mcu);
 bool mcu_is_halted(mcu_t mcu);
 halt_reason_t mcu_halt_reason(mcu_t mcu);
 
@@ -97,8 +186,47 @@ bool mcu_runloop(mcu_t mcu);
 
 bool mcu_step(mcu_t mcu);
 
+/// Locks simulated time to the host monotonic clock
+///
+/// @param factor how many times faster than real time the mcu
+///		runs, 0 disables pacing
+///
+void mcu_set_speed(mcu_t mcu, uint32_t factor);
+
+/// Moves execution from the event loop's idle watcher to a thread
+/// of its own
+///
+/// Once started, the event loop side must not touch the mcu directly
+/// but post commands with mcu_post. Halt callbacks and output are
+/// delivered on the event loop thread.
+///
+bool mcu_thread_start(mcu_t mcu);
+
+/// Joins the execution thread, the mcu runs from the loop again
+void mcu_thread_stop(mcu_t mcu);
+
+/// Runs fn on the execution thread between two blocks of instructions,
+/// or right away when there is no execution thread
+///
+/// Safe from any thread. On the execution thread itself fn runs
+/// right away as well.
+void mcu_post(mcu_t mcu, mcu_command_fn_t fn, void* context);
+
+/// Runs fn on the event loop thread, or right away when there is
+/// no execution thread
+void mcu_post_loop(mcu_t mcu, mcu_command_fn_t fn, void* context);
+
+/// Blocks until wall clock time caught up with the simulated time,
+/// for callers that drive the mcu without an event loop. Call it
+/// once per ms of simulated time, it also publishes the cycle
+/// counter to shared memory.
+void mcu_pace(mcu_t mcu);
+
 bool mcu_add_mem_dev(mcu_t mcu, uint32_t offset, mem_dev_t dev);
 
+/// Calls the reset hook of all memory devices
+void mcu_reset_mem_devs(mcu_t mcu);
+
 bool mcu_reset(mcu_t mcu);
 uint32_t mcu_read_reg(mcu_t _mcu, reg_t reg);
 void mcu_write_reg(mcu_t _mcu, reg_t reg, uint32_t val);
@@ -128,15 +256,262 @@ struct mcu_instr32 {
 #endif
 
 void mcu_add_callbacks(mcu_t mcu, mcu_callbacks_t callbacks);
+void mcu_remove_callbacks(mcu_t mcu, mcu_callbacks_t callbacks);
+
+/// Passes firmware output to the registered callbacks
+void mcu_output(mcu_t mcu, const char* data, size_t length);
+
+/// An event a device wants to happen after a number of cycles.
+///
+/// Devices embed this into their own structure and are called back
+/// with the context once the mcu executed enough cycles.
+///
+struct mcu_event {
+	mcu_event_t next;
+
+	uint64_t deadline;
+
+	void (*fire)(mcu_t mcu, void* context);
+	void* context;
+};
+
+/// Schedules an event to fire in the given number of cycles
+///
+/// An already scheduled event is rescheduled.
+///
+void mcu_event_schedule(mcu_t mcu, mcu_event_t event, uint64_t cycles);
+
+/// Removes an event if it is scheduled
+void mcu_event_cancel(mcu_t mcu, mcu_event_t event);
+
+/// Fires all events whose deadline has been reached
+void mcu_events_run(mcu_t mcu);
+
+static inline bool mcu_events_due(mcu_t mcu)
+{
+	return mcu->events != NULL && mcu->events->deadline <= mcu->cycles;
+}
+
+/// Converts microseconds into cycles of the core clock
+static inline uint64_t mcu_us_to_cycles(mcu_t mcu, uint64_t us)
+{
+	return us * mcu->frequency / 1000000;
+}
+
+/// A cached decoded instruction
+struct mcu_decoded {
+	bool (^impl16)(mcu_t mcu, uint16_t instr);
+	bool (^impl32)(mcu_t mcu, uint32_t instr);
+	uint32_t instr;
+	uint8_t size;
+
+	// Executions counted until the fusion threshold is reached
+	uint16_t hits;
+
+	// Set when this and the following instruction run as a superinstruction
+	mcu_fusion_t fusion;
+	mcu_decoded_t second;
+
+	// Hooks want to see this instruction, it is never fused
+	bool hooked;
+
+	// Coverage still waits for these mcu_coverage_* events, the
+	// instruction is not fused until it has seen all of them
+	uint8_t uncovered;
+};
+
+/// Instructions need to run this often before they are fused
+static const uint16_t mcu_fusion_threshold = 16;
+
+/// A pair of 16-bit instructions that is executed in one dispatch
+struct mcu_fusion {
+	uint16_t first_mask;
+	uint16_t first_instr;
+	uint16_t second_mask;
+	uint16_t second_instr;
+
+	/// Executes both instructions at once. When NULL the two
+	/// handlers are called back to back.
+	bool (^impl)(mcu_t mcu, uint16_t first, uint16_t second);
+};
+
+/// Enables the decode cache for the given code region
+bool mcu_decode_cache_init(mcu_t mcu, uint32_t base, uint32_t length);
+
+/// Drops all decoded instructions, needed whenever code changes
+void mcu_decode_cache_flush(mcu_t mcu);
+
+static inline mcu_decoded_t mcu_decoded_at(mcu_t mcu, uint32_t addr)
+{
+	uint32_t offset = addr - mcu->decoded_base;
+
+	if (offset >= mcu->decoded_length)
+		return NULL;
+
+	return &mcu->decoded[offset >> 1];
+}
 
 struct mcu_callbacks {
 	mcu_callbacks_t next;
 
 	void (*mcu_did_halt)(mcu_t mcu, halt_reason_t reason, void* context);
 
+	/// Called with everything the firmware prints. When no callback
+	/// handles output it goes to stdout.
+	void (*mcu_did_output)(mcu_t mcu, const char* data, size_t length, void* context);
+
+	void* context;
+};
+
+/// A point where tools can observe (or take over) execution
+///
+/// Hooks are embedded into the structure of the tool using them.
+/// Nothing is checked on the dispatch path for kinds of hooks that
+/// are not registered.
+///
+struct mcu_hook {
+	mcu_hook_t next;
+	mcu_hook_type_t type;
+
+	/// The watched range. Filled in by mcu_hook_symbol and
+	/// mcu_hook_device, unused for exception hooks.
+	uint32_t addr;
+	uint32_t length;
+
+	/// mcu_hook_instruction: called before the instruction at addr
+	/// executes. Returning false skips the instruction, the hook then
+	/// did its work and set the pc (address + 2) itself.
+	bool (*instruction)(mcu_t mcu, uint32_t addr, void* context);
+
+	/// mcu_hook_function: addr is the function when it is called and
+	/// the return address when it returns.
+	/// mcu_hook_exception: addr is the exception number.
+	void (*entry)(mcu_t mcu, uint32_t addr, void* context);
+	void (*exit)(mcu_t mcu, uint32_t addr, void* context);
+
+	/// mcu_hook_memory: called after an access of size bytes
+	void (*access)(mcu_t mcu, uint32_t addr, uint32_t value, uint8_t size, bool write, void* context);
+
 	void* context;
+
+	// Private
+	mem_dev_t watch;
+	struct mcu_hook_return* returns;
+	uint32_t returns_count;
+	uint32_t returns_capacity;
 };
 
+/// Registers a hook, addr and length need to be set up
+bool mcu_hook_add(mcu_t mcu, mcu_hook_t hook);
+
+/// Hooks calls of the function with the given symbol name
+bool mcu_hook_symbol(mcu_t mcu, mcu_hook_t hook, const char* symbol);
+
+/// Hooks all register accesses of the device mapped at addr
+bool mcu_hook_device(mcu_t mcu, mcu_hook_t hook, uint32_t addr);
+
+void mcu_hook_remove(mcu_t mcu, mcu_hook_t hook);
+
+/// True when an instruction or function hook wants to see addr
+bool mcu_hooked(mcu_t mcu, uint32_t addr);
+
+/// Runs the hooks for the instruction at addr, returns false
+/// when the instruction must be skipped
+bool mcu_hooks_instruction(mcu_t mcu, uint32_t addr);
+
+void mcu_hooks_exception_entry(mcu_t mcu, uint32_t exception);
+void mcu_hooks_exception_exit(mcu_t mcu, uint32_t exception);
+
+struct mcu_symbol {
+	char* name;
+	uint32_t addr;
+	uint32_t size;
+	bool function;
+};
+
+bool mcu_add_symbol(mcu_t mcu, const char* name, uint32_t addr, uint32_t size, bool function);
+void mcu_clear_symbols(mcu_t mcu);
+
+/// Returns the symbol with the given name, NULL if there is none
+mcu_symbol_t mcu_symbol_named(mcu_t mcu, const char* name);
+
+/// Returns the symbol containing addr, NULL if there is none
+mcu_symbol_t mcu_symbol_at(mcu_t mcu, uint32_t addr);
+
+/// Instructions in [start, end) belong to line of file. Empty ranges
+/// are lines that execute along with the instruction at start.
+struct mcu_line {
+	uint32_t start;
+	uint32_t end;
+	uint32_t file;
+	uint32_t line;
+};
+
+/// Returns the index of the source file, adding it if it is new
+uint32_t mcu_add_source_file(mcu_t mcu, const char* name);
+
+bool mcu_add_line(mcu_t mcu, uint32_t start, uint32_t end, uint32_t file, uint32_t line);
+void mcu_clear_lines(mcu_t mcu);
+
+/// Returns the line the instruction at addr belongs to, NULL if unknown
+mcu_line_t mcu_line_at(mcu_t mcu, uint32_t addr);
+
+enum {
+	mcu_coverage_executed  = 1 << 0,
+	mcu_coverage_taken     = 1 << 1,
+	mcu_coverage_not_taken = 1 << 2,
+};
+
+/// Starts recording which instructions execute and which way
+/// conditional branches go
+bool mcu_coverage_start(mcu_t mcu);
+
+/// Stops recording and drops what was recorded
+void mcu_coverage_stop(mcu_t mcu);
+
+/// Returns the mcu_coverage_* events not yet recorded for the
+/// instruction at addr
+uint8_t mcu_coverage_pending(mcu_t mcu, uint32_t addr, bool branch);
+
+void mcu_coverage_record(mcu_t mcu, uint32_t addr, uint8_t events);
+
+/// Writes the recorded coverage as lcov tracefile, mapped to
+/// source lines through the line table
+bool mcu_coverage_write_lcov(mcu_t mcu, const char* path);
+
+/// Moves ram and flash into the named POSIX shared memory object,
+/// see mcusim_shm.h for its layout. Only while halted.
+bool mcu_shm_create(mcu_t mcu, const char* name);
+
+/// Unmaps and unlinks the object, once the devices using it are gone
+void mcu_shm_destroy(mcu_t mcu);
+
+void mcu_shm_publish(mcu_t mcu);
+
+/// Publishes the cycle counter and run state
+static inline void mcu_shm_update(mcu_t mcu)
+{
+	if (mcu->shm)
+		mcu_shm_publish(mcu);
+}
+
+/// Runs memcpy, memset, memmove, strlen, strcmp and crc8_maxim of
+/// the firmware natively and charges the cycles the thumb code would
+/// have taken. Functions without a symbol are left alone.
+bool mcu_hle_start(mcu_t mcu);
+
+void mcu_hle_stop(mcu_t mcu);
+
+/// Traces the allocator of the firmware (malloc_raw, free_raw, malloc
+/// and free) through its symbols, the firmware stays untouched
+bool mcu_heap_start(mcu_t mcu);
+
+void mcu_heap_stop(mcu_t mcu);
+
+/// Writes peak use, fragmentation over time, allocation hot spots
+/// and the allocations still alive
+bool mcu_heap_write_report(mcu_t mcu, const char* path);
+
 typedef enum {
 	mem_class_ram,
 	mem_class_flash,
@@ -159,6 +534,21 @@ struct mem_dev {
 
 	bool (*write16)(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t value);
 	bool (*write32)(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t value);
+
+	/// Frees the device, plain free() is used when not set
+	void (*destroy)(mem_dev_t mem_dev);
+
+	/// Puts the device back into its reset state, optional
+	void (*reset)(mcu_t mcu, mem_dev_t mem_dev);
+
+	/// Host memory backing the whole device, set only for plain
+	/// memory without side effects on access. Only mem_class_ram
+	/// may be written through it.
+	uint32_t* direct;
+
+	/// Moves the contents to storage (length bytes), which the device
+	/// uses from then on without owning it. Optional.
+	void (*share)(mem_dev_t mem_dev, uint32_t* storage);
 };
 
 bool mcu_fetch16(mcu_t mcu, uint32_t addr, uint16_t* value);
@@ -169,5 +559,13 @@ bool mcu_write32(mcu_t mcu, uint32_t addr, uint32_t value);
 bool mcu_util_fetch8(mcu_t mcu, uint32_t addr, uint8_t* value);
 bool mcu_util_write8(mcu_t mcu, uint32_t addr, uint8_t value);
 
+/// Returns host memory for [addr, addr + length) when the range is
+/// word aligned and lies completely inside one ram device, NULL otherwise.
+///
+/// Used by multi word transfers to do one bounds check instead of one
+/// device lookup per word.
+///
+uint32_t* mcu_mem_direct(mcu_t mcu, uint32_t addr, uint32_t length);
+
 bool mcu_emu_fetch16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t* valueOut);
 bool mcu_emu_write16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t valueIn);
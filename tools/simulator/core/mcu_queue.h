@@ -0,0 +1,81 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+
+#include <mcu.h>
+#include <stdatomic.h>
+
+/// Number of commands a queue holds, a power of two
+#define MCU_QUEUE_LENGTH 256
+
+struct mcu_command {
+	mcu_command_fn_t fn;
+	void* context;
+};
+
+/// A queue of commands between exactly one producer and one
+/// consumer thread. Neither side takes a lock, the producer only
+/// writes head and the consumer only writes tail.
+struct mcu_queue {
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+
+	struct mcu_command commands[MCU_QUEUE_LENGTH];
+};
+
+/// Appends a command, fails when the queue is full
+static inline bool mcu_queue_push(struct mcu_queue* queue, mcu_command_fn_t fn, void* context)
+{
+	uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+	if (head - tail == MCU_QUEUE_LENGTH)
+		return false;
+
+	queue->commands[head & (MCU_QUEUE_LENGTH - 1)] = (struct mcu_command){ fn, context };
+
+	// Publish the command before the new head
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+	return true;
+}
+
+/// Removes the oldest command, fails when the queue is empty
+static inline bool mcu_queue_pop(struct mcu_queue* queue, struct mcu_command* command)
+{
+	uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+	if (head == tail)
+		return false;
+
+	*command = queue->commands[tail & (MCU_QUEUE_LENGTH - 1)];
+
+	// Hand the slot back to the producer
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+	return true;
+}
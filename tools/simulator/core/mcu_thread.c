@@ -0,0 +1,238 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <mcu.h>
+#include <mcu_queue.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+struct mcu_thread {
+	mcu_t mcu;
+	pthread_t thread;
+	atomic_bool quit;
+
+	// Commands from the event loop to the execution thread. The
+	// queue takes one producer, so posting threads take post_lock.
+	struct mcu_queue to_mcu;
+	pthread_mutex_t post_lock;
+	// Commands from the execution thread to the event loop
+	struct mcu_queue to_loop;
+
+	// Wakes the execution thread while the mcu is halted
+	int wakeup[2];
+	// Wakes the event loop
+	ev_async loop_wakeup;
+};
+
+// The mcu thread the calling thread executes, if any
+static _Thread_local mcu_thread_t current_thread;
+
+#define FIXUP_THREAD(a, b) ((mcu_thread_t)((uintptr_t)a - __builtin_offsetof(struct mcu_thread, b)))
+
+static void mcu_thread_run_queue(mcu_t mcu, struct mcu_queue* queue)
+{
+	struct mcu_command command;
+
+	while (mcu_queue_pop(queue, &command))
+		command.fn(mcu, command.context);
+}
+
+static void mcu_thread_loop_cb(struct ev_loop *loop, ev_async *w, int revents)
+{
+	mcu_thread_t thread = FIXUP_THREAD(w, loop_wakeup);
+
+	mcu_thread_run_queue(thread->mcu, &thread->to_loop);
+}
+
+static void* mcu_thread_main(void* context)
+{
+	mcu_thread_t thread = context;
+	mcu_t mcu = thread->mcu;
+
+	current_thread = thread;
+
+	while (!atomic_load(&thread->quit)) {
+		// Commands only run between blocks, never in the
+		// middle of an instruction
+		mcu_thread_run_queue(mcu, &thread->to_mcu);
+
+		if (mcu_is_halted(mcu)) {
+			char buffer[64];
+
+			if (read(thread->wakeup[0], buffer, sizeof(buffer)) < 0)
+				perror("mcu thread wakeup");
+
+			continue;
+		}
+
+		// Run 1ms of simulated time
+		uint64_t end = mcu->cycles + (mcu->frequency / 1000 ?: 1);
+
+		while (!mcu_is_halted(mcu) && mcu->cycles < end)
+			mcu_runloop(mcu);
+
+		mcu_pace(mcu);
+	}
+
+	return NULL;
+}
+
+static void mcu_thread_wakeup(mcu_thread_t thread)
+{
+	// Nothing is lost when the pipe is full, the thread
+	// has enough wakeups pending then
+	if (write(thread->wakeup[1], "", 1) < 0 && errno != EAGAIN)
+		perror("mcu thread wakeup");
+}
+
+bool mcu_thread_start(mcu_t mcu)
+{
+	if (mcu->thread)
+		return true;
+
+	if (!mcu->loop) {
+		printf("The mcu thread needs an event loop\n");
+		return false;
+	}
+
+	mcu_thread_t thread = calloc(1, sizeof(struct mcu_thread));
+
+	if (!thread) {
+		perror("Could not allocate mcu_thread");
+		return false;
+	}
+
+	thread->mcu = mcu;
+	pthread_mutex_init(&thread->post_lock, NULL);
+
+	if (pipe(thread->wakeup) < 0) {
+		perror("pipe");
+		pthread_mutex_destroy(&thread->post_lock);
+		free(thread);
+		return false;
+	}
+
+	fcntl(thread->wakeup[1], F_SETFL, O_NONBLOCK);
+
+	ev_async_init(&thread->loop_wakeup, mcu_thread_loop_cb);
+	ev_async_start(mcu->loop, &thread->loop_wakeup);
+
+	// The execution thread drives the mcu from now on
+	ev_idle_stop(mcu->loop, &mcu->idle);
+	ev_timer_stop(mcu->loop, &mcu->pace_timer);
+	mcu->thread = thread;
+
+	if (pthread_create(&thread->thread, NULL, mcu_thread_main, thread) != 0) {
+		perror("pthread_create");
+		mcu->thread = NULL;
+		ev_async_stop(mcu->loop, &thread->loop_wakeup);
+		close(thread->wakeup[0]);
+		close(thread->wakeup[1]);
+		pthread_mutex_destroy(&thread->post_lock);
+		free(thread);
+
+		if (!mcu_is_halted(mcu))
+			ev_idle_start(mcu->loop, &mcu->idle);
+
+		return false;
+	}
+
+	return true;
+}
+
+void mcu_thread_stop(mcu_t mcu)
+{
+	mcu_thread_t thread = mcu->thread;
+
+	if (!thread)
+		return;
+
+	atomic_store(&thread->quit, true);
+	mcu_thread_wakeup(thread);
+	pthread_join(thread->thread, NULL);
+
+	mcu->thread = NULL;
+
+	// Deliver what the thread left behind
+	mcu_thread_run_queue(mcu, &thread->to_loop);
+
+	ev_async_stop(mcu->loop, &thread->loop_wakeup);
+	close(thread->wakeup[0]);
+	close(thread->wakeup[1]);
+	pthread_mutex_destroy(&thread->post_lock);
+	free(thread);
+
+	if (!mcu_is_halted(mcu))
+		ev_idle_start(mcu->loop, &mcu->idle);
+}
+
+void mcu_post(mcu_t mcu, mcu_command_fn_t fn, void* context)
+{
+	mcu_thread_t thread = mcu->thread;
+
+	// The execution thread would wait for itself to drain a
+	// full queue, so its own commands run right away
+	if (!thread || thread == current_thread) {
+		fn(mcu, context);
+		return;
+	}
+
+	pthread_mutex_lock(&thread->post_lock);
+
+	while (!mcu_queue_push(&thread->to_mcu, fn, context))
+		sched_yield();
+
+	pthread_mutex_unlock(&thread->post_lock);
+
+	mcu_thread_wakeup(thread);
+}
+
+void mcu_post_loop(mcu_t mcu, mcu_command_fn_t fn, void* context)
+{
+	mcu_thread_t thread = mcu->thread;
+
+	if (!thread) {
+		fn(mcu, context);
+		return;
+	}
+
+	while (!mcu_queue_push(&thread->to_loop, fn, context)) {
+		// The loop is waiting for us to finish and won't
+		// drain the queue anymore
+		if (atomic_load(&thread->quit)) {
+			fn(mcu, context);
+			return;
+		}
+
+		sched_yield();
+	}
+
+	ev_async_send(mcu->loop, &thread->loop_wakeup);
+}
@@ -0,0 +1,377 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <mcusim.h>
+
+#include <mcu.h>
+#include <elf.h>
+#include <gdb.h>
+#include <stdio.h>
+#include <string.h>
+
+static const uint32_t mcusim_mem_type = 0x10;
+
+struct mcusim {
+	mcu_t mcu;
+	gdb_t gdb;
+
+	struct mcu_callbacks callbacks;
+
+	void (*output)(mcusim_t sim, const char* data, size_t length, void* context);
+	void* output_context;
+
+	void (*halted)(mcusim_t sim, mcusim_stop_t reason, void* context);
+	void* halted_context;
+};
+
+struct mcusim_dev {
+	struct mem_dev mem_dev;
+
+	mcusim_t sim;
+	const struct mcusim_device* device;
+	void* context;
+};
+
+static mcusim_stop_t mcusim_stop_reason(halt_reason_t reason)
+{
+	switch (reason) {
+		case HALT_SLEEP:
+			return mcusim_stop_sleep;
+		case HALT_EXIT:
+			return mcusim_stop_exit;
+		case HALT_STOPPED:
+		case HAL_TRAP:
+			return mcusim_stop_trap;
+		default:
+			return mcusim_stop_fault;
+	}
+}
+
+static void mcusim_did_halt(mcu_t mcu, halt_reason_t reason, void* context)
+{
+	mcusim_t sim = context;
+
+	if (sim->halted)
+		sim->halted(sim, mcusim_stop_reason(reason), sim->halted_context);
+}
+
+static void mcusim_did_output(mcu_t mcu, const char* data, size_t length, void* context)
+{
+	mcusim_t sim = context;
+
+	if (sim->output)
+		sim->output(sim, data, length, sim->output_context);
+	else
+		fwrite(data, 1, length, stdout);
+}
+
+mcusim_t mcusim_create_with_loop(struct ev_loop* loop, size_t ramsize)
+{
+	mcusim_t sim = calloc(1, sizeof(struct mcusim));
+
+	if (!sim) {
+		perror("Could not allocate mcusim");
+		return NULL;
+	}
+
+	sim->mcu = mcu_cortex_m0p_create(loop, ramsize);
+
+	if (!sim->mcu) {
+		free(sim);
+		return NULL;
+	}
+
+	sim->callbacks.mcu_did_halt = mcusim_did_halt;
+	sim->callbacks.mcu_did_output = mcusim_did_output;
+	sim->callbacks.context = sim;
+	mcu_add_callbacks(sim->mcu, &sim->callbacks);
+
+	return sim;
+}
+
+mcusim_t mcusim_create(size_t ramsize)
+{
+	return mcusim_create_with_loop(NULL, ramsize);
+}
+
+void mcusim_destroy(mcusim_t sim)
+{
+	if (!sim)
+		return;
+
+	// Nothing may run the mcu while it is torn down
+	mcu_thread_stop(sim->mcu);
+
+	if (sim->gdb)
+		gdb_destroy(sim->gdb);
+
+	mcu_remove_callbacks(sim->mcu, &sim->callbacks);
+
+	// Devices are owned by the mcu and live as long as it does
+	mcu_destroy(sim->mcu);
+	free(sim);
+}
+
+bool mcusim_load_elf(mcusim_t sim, const void* data, size_t length)
+{
+	return elf_load_buffer(sim->mcu, data, length);
+}
+
+bool mcusim_load_elf_file(mcusim_t sim, const char* path)
+{
+	return elf_load(sim->mcu, path);
+}
+
+bool mcusim_reset(mcusim_t sim)
+{
+	return mcu_reset(sim->mcu);
+}
+
+mcusim_stop_t mcusim_run(mcusim_t sim, uint64_t cycles)
+{
+	mcu_t mcu = sim->mcu;
+	uint64_t end = mcu->cycles + cycles;
+
+	// Don't let a previous trap keep us from running, but
+	// a finished firmware stays finished
+	if (mcu_is_halted(mcu)) {
+		if (mcu_halt_reason(mcu) == HALT_EXIT)
+			return mcusim_stop_exit;
+
+		mcu->state = mcu_running;
+	}
+
+	uint64_t pace = mcu->cycles;
+
+	while (mcu->cycles < end) {
+		mcu_runloop(mcu);
+
+		if (mcu_is_halted(mcu))
+			return mcusim_stop_reason(mcu_halt_reason(mcu));
+
+		// Look at the clock once per ms of simulated time
+		if (mcu->cycles - pace >= mcu->frequency / 1000) {
+			mcu_pace(mcu);
+			pace = mcu->cycles;
+		}
+	}
+
+	mcu_shm_update(mcu);
+
+	return mcusim_stop_cycles;
+}
+
+static void mcusim_resume_command(mcu_t mcu, void* context)
+{
+	mcu_resume(mcu);
+}
+
+bool mcusim_resume(mcusim_t sim)
+{
+	mcu_post(sim->mcu, mcusim_resume_command, NULL);
+
+	return true;
+}
+
+bool mcusim_start_thread(mcusim_t sim)
+{
+	return mcu_thread_start(sim->mcu);
+}
+
+void mcusim_set_speed(mcusim_t sim, uint32_t factor)
+{
+	mcu_set_speed(sim->mcu, factor);
+}
+
+uint64_t mcusim_cycles(mcusim_t sim)
+{
+	return sim->mcu->cycles;
+}
+
+int mcusim_exit_code(mcusim_t sim)
+{
+	return sim->mcu->exit_code;
+}
+
+bool mcusim_read_mem(mcusim_t sim, uint32_t addr, void* _buffer, size_t length)
+{
+	uint8_t* buffer = _buffer;
+
+	for (size_t i = 0; i < length; i++)
+		if (!mcu_util_fetch8(sim->mcu, addr + i, &buffer[i]))
+			return false;
+
+	return true;
+}
+
+bool mcusim_write_mem(mcusim_t sim, uint32_t addr, const void* _buffer, size_t length)
+{
+	const uint8_t* buffer = _buffer;
+	bool was_unlocked = mcu_is_unlocked(sim->mcu);
+	bool success = true;
+
+	mcu_unlock(sim->mcu);
+
+	for (size_t i = 0; i < length && success; i++)
+		success = mcu_util_write8(sim->mcu, addr + i, buffer[i]);
+
+	if (!was_unlocked)
+		mcu_lock(sim->mcu);
+
+	return success;
+}
+
+uint32_t mcusim_read_reg(mcusim_t sim, mcusim_reg_t reg)
+{
+	// The simulator keeps the pc one halfword ahead
+	if (reg == mcusim_reg_pc)
+		return mcu_read_reg(sim->mcu, REG_PC) - 2;
+
+	return mcu_read_reg(sim->mcu, (reg_t)reg);
+}
+
+void mcusim_write_reg(mcusim_t sim, mcusim_reg_t reg, uint32_t value)
+{
+	if (reg == mcusim_reg_pc)
+		value += 2;
+
+	mcu_write_reg(sim->mcu, (reg_t)reg, value);
+}
+
+static void mcusim_irq_command(mcu_t mcu, void* context)
+{
+	mcu_do_irq(mcu, (uintptr_t)context);
+}
+
+bool mcusim_irq(mcusim_t sim, unsigned irq)
+{
+	if (irq >= 32)
+		return false;
+
+	mcu_post(sim->mcu, mcusim_irq_command, (void*)(uintptr_t)irq);
+
+	return true;
+}
+
+static bool mcusim_dev_read32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t* temp)
+{
+	struct mcusim_dev* dev = (struct mcusim_dev*)mem_dev;
+
+	if (!dev->device->read)
+		return false;
+
+	return dev->device->read(dev->sim, addr, temp, dev->context);
+}
+
+static bool mcusim_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp)
+{
+	struct mcusim_dev* dev = (struct mcusim_dev*)mem_dev;
+
+	if (!dev->device->write)
+		return false;
+
+	return dev->device->write(dev->sim, addr, temp, dev->context);
+}
+
+bool mcusim_add_device(mcusim_t sim, uint32_t base, uint32_t length,
+	const struct mcusim_device* device, void* context)
+{
+	struct mcusim_dev* dev = calloc(1, sizeof(struct mcusim_dev));
+
+	if (!dev) {
+		perror("Could not allocate mcusim_dev structure");
+		return false;
+	}
+
+	dev->mem_dev.class = mem_class_io;
+	dev->mem_dev.type = mcusim_mem_type;
+	dev->mem_dev.fetch16 = mcu_emu_fetch16;
+	dev->mem_dev.fetch32 = mcusim_dev_read32;
+	dev->mem_dev.write16 = mcu_emu_write16;
+	dev->mem_dev.write32 = mcusim_dev_write32;
+	dev->mem_dev.length = length;
+
+	dev->sim = sim;
+	dev->device = device;
+	dev->context = context;
+
+	return mcu_add_mem_dev(sim->mcu, base, (mem_dev_t)dev);
+}
+
+void mcusim_set_output(mcusim_t sim, void (*output)(mcusim_t sim, const char* data, size_t length, void* context), void* context)
+{
+	sim->output = output;
+	sim->output_context = context;
+}
+
+void mcusim_set_halt_handler(mcusim_t sim, void (*halted)(mcusim_t sim, mcusim_stop_t reason, void* context), void* context)
+{
+	sim->halted = halted;
+	sim->halted_context = context;
+}
+
+bool mcusim_coverage_start(mcusim_t sim)
+{
+	return mcu_coverage_start(sim->mcu);
+}
+
+bool mcusim_coverage_write(mcusim_t sim, const char* path)
+{
+	return mcu_coverage_write_lcov(sim->mcu, path);
+}
+
+bool mcusim_share_memory(mcusim_t sim, const char* name)
+{
+	return mcu_shm_create(sim->mcu, name);
+}
+
+bool mcusim_hle_start(mcusim_t sim)
+{
+	return mcu_hle_start(sim->mcu);
+}
+
+bool mcusim_heap_start(mcusim_t sim)
+{
+	return mcu_heap_start(sim->mcu);
+}
+
+bool mcusim_heap_write_report(mcusim_t sim, const char* path)
+{
+	return mcu_heap_write_report(sim->mcu, path);
+}
+
+bool mcusim_gdb_listen(mcusim_t sim, int port)
+{
+	if (!sim->mcu->loop) {
+		printf("gdb needs a simulator with an event loop\n");
+		return false;
+	}
+
+	if (sim->gdb)
+		return true;
+
+	sim->gdb = gdb_create(sim->mcu->loop, port, sim->mcu);
+
+	return sim->gdb != NULL;
+}
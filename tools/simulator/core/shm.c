@@ -0,0 +1,175 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include <mcu.h>
+#include <mcusim_shm.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Regions start on page boundaries, so monitors can map them alone
+static const size_t mcu_shm_align = 4096;
+
+struct mcu_shm {
+	char* name;
+	size_t size;
+
+	struct mcusim_shm_header* header;
+};
+
+static size_t mcu_shm_aligned(size_t size)
+{
+	return (size + mcu_shm_align - 1) & ~(mcu_shm_align - 1);
+}
+
+static bool mcu_shm_shareable(mem_dev_t dev)
+{
+	return dev->share && (dev->class == mem_class_ram || dev->class == mem_class_flash);
+}
+
+bool mcu_shm_create(mcu_t mcu, const char* name)
+{
+	size_t size = mcu_shm_aligned(sizeof(struct mcusim_shm_header));
+	uint32_t count = 0;
+
+	if (mcu->shm) {
+		printf("Memory is already shared as %s\n", mcu->shm->name);
+		return false;
+	}
+
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL; dev = dev->next) {
+		if (mcu_shm_shareable(dev) && count < MCUSIM_SHM_MAX_REGIONS) {
+			size += mcu_shm_aligned(dev->length);
+			count++;
+		}
+	}
+
+	if (count == 0) {
+		printf("No memory to share\n");
+		return false;
+	}
+
+	mcu_shm_t shm = calloc(1, sizeof(struct mcu_shm));
+
+	if (!shm) {
+		perror("Could not allocate mcu_shm structure");
+		return false;
+	}
+
+	shm->name = strdup(name);
+	shm->size = size;
+
+	if (!shm->name) {
+		perror("Could not allocate mcu_shm structure");
+		free(shm);
+		return false;
+	}
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		perror("shm_open");
+		free(shm->name);
+		free(shm);
+		return false;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		perror("ftruncate");
+		close(fd);
+		shm_unlink(name);
+		free(shm->name);
+		free(shm);
+		return false;
+	}
+
+	shm->header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shm->header == MAP_FAILED) {
+		perror("mmap");
+		shm_unlink(name);
+		free(shm->name);
+		free(shm);
+		return false;
+	}
+
+	struct mcusim_shm_header* header = shm->header;
+	size_t offset = mcu_shm_aligned(sizeof(struct mcusim_shm_header));
+
+	header->version = MCUSIM_SHM_VERSION;
+	header->header_size = sizeof(struct mcusim_shm_header);
+	header->frequency = mcu->frequency;
+
+	for (mem_dev_t dev = mcu->mem_devs; dev != NULL && header->region_count < count; dev = dev->next) {
+		if (!mcu_shm_shareable(dev))
+			continue;
+
+		header->regions[header->region_count++] = (struct mcusim_shm_region){
+			.base = dev->offset,
+			.length = dev->length,
+			.offset = offset,
+			.kind = dev->class == mem_class_flash ? mcusim_shm_flash : mcusim_shm_ram,
+		};
+
+		dev->share(dev, (uint32_t*)((uint8_t*)header + offset));
+		offset += mcu_shm_aligned(dev->length);
+	}
+
+	mcu->shm = shm;
+	mcu_shm_publish(mcu);
+
+	// Monitors wait for the magic, it comes last
+	__atomic_store_n(&header->magic, MCUSIM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void mcu_shm_destroy(mcu_t mcu)
+{
+	mcu_shm_t shm = mcu->shm;
+
+	if (!shm)
+		return;
+
+	mcu->shm = NULL;
+
+	munmap(shm->header, shm->size);
+	shm_unlink(shm->name);
+
+	free(shm->name);
+	free(shm);
+}
+
+void mcu_shm_publish(mcu_t mcu)
+{
+	struct mcusim_shm_header* header = mcu->shm->header;
+
+	__atomic_store_n(&header->cycles, mcu->cycles, __ATOMIC_RELAXED);
+	__atomic_store_n(&header->halted, mcu_is_halted(mcu), __ATOMIC_RELAXED);
+}
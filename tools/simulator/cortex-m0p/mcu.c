@@ -25,15 +25,40 @@
 #include <mcu.h>
 
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <ram.h>
 #include <flash.h>
 #include <uart.h>
 #include <unittest.h>
+#include <scs.h>
+#include <gpio.h>
+#include <i2c.h>
+#include <adc.h>
+#include <24xx64.h>
+#include <sht2x.h>
 
 typedef struct mcu_cortex_m0p* mcu_cortex_m0p_t;
 
 extern struct mcu_instr16 mcu_instr16_cortex_m0p[];
 extern struct mcu_instr32 mcu_instr32_cortex_m0p[];
+extern struct mcu_fusion mcu_fusions_cortex_m0p[];
+
+// ARM semihosting operations, passed in r0 to bkpt 0xAB
+enum {
+	SYS_OPEN          = 0x01,
+	SYS_CLOSE         = 0x02,
+	SYS_WRITE0        = 0x04,
+	SYS_WRITE         = 0x05,
+	SYS_READ          = 0x06,
+	SYS_CLOCK         = 0x10,
+	SYS_EXIT          = 0x18,
+	SYS_EXIT_EXTENDED = 0x20,
+};
+
+static const uint32_t semihosting_bkpt = 0xAB;
+static const uint32_t ADP_Stopped_ApplicationExit = 0x20026;
 
 enum {
 	CPSR_N = (1<<31),
@@ -43,6 +68,97 @@ enum {
 	CPSR_Q = (1<<27)
 };
 
+static bool mcu_cortex_m0p_add_lpc11xx(mcu_t mcu)
+{
+	// SYSCON and IOCON only need to hold what the drivers write
+	{
+		ram_dev_t syscon = ram_dev_create(16 * 1024);
+
+		if (!syscon) {
+			printf("Could not allocate syscon");
+			return false;
+		}
+
+		if (!mcu_add_mem_dev(mcu, 0x40048000, (mem_dev_t)syscon)) {
+			printf("Could not add syscon to mcu");
+			return false;
+		}
+
+		mcu_write32(mcu, 0x40048078, 1); // SYSAHBCLKDIV
+		mcu_write32(mcu, 0x40048080, 0x485F); // SYSAHBCLKCTRL
+		mcu_write32(mcu, 0x40048238, 0xEDF0); // PDRUNCFG
+	}
+
+	{
+		ram_dev_t iocon = ram_dev_create(16 * 1024);
+
+		if (!iocon) {
+			printf("Could not allocate iocon");
+			return false;
+		}
+
+		if (!mcu_add_mem_dev(mcu, 0x40044000, (mem_dev_t)iocon)) {
+			printf("Could not add iocon to mcu");
+			return false;
+		}
+	}
+
+	for (uint8_t port = 0; port < 4; port++) {
+		gpio_dev_t gpio = gpio_dev_create();
+
+		if (!gpio) {
+			printf("Could not create gpio_dev");
+			return false;
+		}
+
+		if (!mcu_add_mem_dev(mcu, 0x50000000 + port * 0x10000, (mem_dev_t)gpio)) {
+			printf("Could not add gpio_dev to mcu");
+			return false;
+		}
+	}
+
+	{
+		adc_dev_t adc = adc_dev_create();
+
+		if (!adc) {
+			printf("Could not create adc_dev");
+			return false;
+		}
+
+		if (!mcu_add_mem_dev(mcu, 0x4001C000, (mem_dev_t)adc)) {
+			printf("Could not add adc_dev to mcu");
+			return false;
+		}
+	}
+
+	{
+		i2c_dev_t i2c = i2c_dev_create(15);
+
+		if (!i2c) {
+			printf("Could not create i2c_dev");
+			return false;
+		}
+
+		if (!mcu_add_mem_dev(mcu, 0x40000000, (mem_dev_t)i2c)) {
+			printf("Could not add i2c_dev to mcu");
+			return false;
+		}
+
+		mcp24xx64_dev_t eeprom = mcp24xx64_dev_create(0xA0);
+		sht2x_dev_t sht2x = sht2x_dev_create();
+
+		if (!eeprom || !sht2x) {
+			printf("Could not create i2c slaves");
+			return false;
+		}
+
+		i2c_dev_attach(i2c, (i2c_slave_t)eeprom);
+		i2c_dev_attach(i2c, (i2c_slave_t)sht2x);
+	}
+
+	return true;
+}
+
 mcu_t mcu_cortex_m0p_create(struct ev_loop *loop, size_t ramsize)
 {
 	mcu_cortex_m0p_t mcu = calloc(1, sizeof(struct mcu_cortex_m0p));
@@ -55,6 +171,31 @@ mcu_t mcu_cortex_m0p_create(struct ev_loop *loop, size_t ramsize)
 	mcu_init((mcu_t)mcu, loop);
 	mcu->mcu.instrs16 = mcu_instr16_cortex_m0p;
 	mcu->mcu.instrs32 = mcu_instr32_cortex_m0p;
+	mcu->mcu.fusions = mcu_fusions_cortex_m0p;
+	// LPC11xx running from the 12MHz IRC
+	mcu->mcu.frequency = 12000000;
+
+	// Add the peripherals first, so that ram and flash end up
+	// at the front of the device list
+	if (!mcu_cortex_m0p_add_lpc11xx((mcu_t)mcu))
+		return NULL;
+
+	{
+		scs_dev_t scs = scs_dev_create();
+
+		if (!scs) {
+			printf("Could not create scs_dev");
+			return NULL;
+		}
+
+		if (!mcu_add_mem_dev((mcu_t)mcu, 0xE000E000, (mem_dev_t)scs)) {
+			printf("Could not add scs_dev to mcu");
+			return NULL;
+		}
+	}
+
+	if (!mcu_decode_cache_init((mcu_t)mcu, 0x0, 32 * 1024))
+		return NULL;
 
 	{
 		flash_dev_t flash = flash_dev_create(32 * 1024);
@@ -119,6 +260,15 @@ bool mcu_reset(mcu_t _mcu)
 {
 	mcu_cortex_m0p_t mcu = (mcu_cortex_m0p_t)_mcu;
 
+	mcu_reset_mem_devs(_mcu);
+
+	mcu->processor_mode = processor_thread_mode;
+	mcu->pending = 0;
+	mcu->enabled = 0;
+	mcu->regs[REG_CONTROL] = 0;
+	mcu->regs[REG_PRIMASK] = 0;
+	mcu_write_reg(_mcu, REG_IPSR, 0);
+
 	{
 		uint32_t val;
 
@@ -146,7 +296,6 @@ bool mcu_reset(mcu_t _mcu)
 		mcu_write_reg(_mcu, REG_PC, val + 2);
 	}
 
-	mcu->processor_mode = processor_thread_mode;
 	mcu_write_reg(_mcu, REG_EPSR, 1 << 24);
 
 	return true;
@@ -165,25 +314,171 @@ bool mcu_do_fault(mcu_t mcu, fault_t fault)
 	return mcu_do_exception(mcu, exception_hardfault);
 }
 
-bool mcu_do_irq(mcu_t mcu, irq_t fault)
+bool mcu_do_irq(mcu_t _mcu, irq_t irq)
 {
-	return false;
+	mcu_cortex_m0p_t mcu = (mcu_cortex_m0p_t)_mcu;
+
+	mcu->pending |= 1ULL << (irq + 16);
+
+	// Wake up from wfi
+	if (mcu_is_halted(_mcu) && mcu_halt_reason(_mcu) == HALT_SLEEP)
+		mcu_resume(_mcu);
+
+	return true;
 }
 
-uint32_t mcu_read_reg(mcu_t _mcu, reg_t reg)
+// The stack pointer that is currently selected by
+// the processor mode and CONTROL.SPSEL
+static reg_t mcu_current_sp(mcu_cortex_m0p_t mcu)
 {
-	mcu_cortex_m0p_t mcu = (mcu_cortex_m0p_t)_mcu;
+	if (mcu->processor_mode == processor_thread_mode && (mcu->regs[REG_CONTROL] & 0x2))
+		return REG_PSP;
+	else
+		return REG_MSP;
+}
 
-	if (reg == REG_SP) {
-		if (mcu->regs[reg] & 0x2)
-			reg = REG_PSP;
+static bool mcu_exception_entry(mcu_cortex_m0p_t mcu, exception_t exception)
+{
+	mcu_t _mcu = (mcu_t)mcu;
+	uint32_t sp = mcu_read_reg(_mcu, REG_SP);
+	uint32_t xpsr = mcu->regs[REG_XPSR];
+
+	// Frames are always 8-byte aligned
+	if (sp & 0x4) {
+		sp -= 4;
+		xpsr |= (1 << 9);
+	}
+	else {
+		xpsr &= ~(1 << 9);
+	}
+
+	sp -= 32;
+
+	uint32_t frame[8] = {
+		mcu->regs[REG_R0],
+		mcu->regs[REG_R1],
+		mcu->regs[REG_R2],
+		mcu->regs[REG_R3],
+		mcu->regs[REG_R12],
+		mcu->regs[REG_LR],
+		mcu->regs[REG_PC] - 2,
+		xpsr,
+	};
+
+	for (int i = 0; i < 8; i++) {
+		if (!mcu_write32(_mcu, sp + i * 4, frame[i])) {
+			printf("Could not push exception frame at 0x%x\n", sp + i * 4);
+			mcu_halt(_mcu, HALT_HARD_FAULT);
+			return false;
+		}
+	}
+
+	mcu_write_reg(_mcu, REG_SP, sp);
+
+	if (mcu->processor_mode == processor_handler_mode)
+		mcu_write_reg(_mcu, REG_LR, 0xFFFFFFF1);
+	else if (mcu_current_sp(mcu) == REG_PSP)
+		mcu_write_reg(_mcu, REG_LR, 0xFFFFFFFD);
+	else
+		mcu_write_reg(_mcu, REG_LR, 0xFFFFFFF9);
+
+	uint32_t vector;
+
+	if (!mcu_fetch32(_mcu, exception * 4, &vector)) {
+		printf("Could not fetch vector %u\n", exception);
+		mcu_halt(_mcu, HALT_HARD_FAULT);
+		return false;
+	}
+
+	mcu->processor_mode = processor_handler_mode;
+	mcu_write_reg(_mcu, REG_IPSR, exception);
+	mcu_write_reg(_mcu, REG_PC, vector + 2);
+
+	mcu->pending &= ~(1ULL << exception);
+
+	if (_mcu->hooks[mcu_hook_exception])
+		mcu_hooks_exception_entry(_mcu, exception);
+
+	return true;
+}
+
+static bool mcu_exception_return(mcu_cortex_m0p_t mcu, uint32_t exc_return)
+{
+	mcu_t _mcu = (mcu_t)mcu;
+	uint32_t exception = mcu->regs[REG_XPSR] & 0x3F;
+	reg_t sp_reg = (exc_return & 0x4) ? REG_PSP : REG_MSP;
+	uint32_t sp = mcu->regs[sp_reg];
+	uint32_t frame[8];
+
+	for (int i = 0; i < 8; i++) {
+		if (!mcu_fetch32(_mcu, sp + i * 4, &frame[i])) {
+			printf("Could not pop exception frame at 0x%x\n", sp + i * 4);
+			mcu_halt(_mcu, HALT_HARD_FAULT);
+			return false;
+		}
+	}
+
+	sp += 32;
+	if (frame[7] & (1 << 9))
+		sp += 4;
+
+	mcu->regs[sp_reg] = sp;
+
+	if (exc_return & 0x8) {
+		mcu->processor_mode = processor_thread_mode;
+
+		if (exc_return & 0x4)
+			mcu->regs[REG_CONTROL] |= 0x2;
 		else
-			reg = REG_MSP;
+			mcu->regs[REG_CONTROL] &= ~0x2;
+	}
+	else {
+		mcu->processor_mode = processor_handler_mode;
 	}
+
+	mcu->regs[REG_R0] = frame[0];
+	mcu->regs[REG_R1] = frame[1];
+	mcu->regs[REG_R2] = frame[2];
+	mcu->regs[REG_R3] = frame[3];
+	mcu->regs[REG_R12] = frame[4];
+	mcu->regs[REG_LR] = frame[5];
+	mcu->regs[REG_XPSR] = frame[7] & ~(1 << 9);
+	mcu_write_reg(_mcu, REG_PC, frame[6] + 2);
+
+	if (_mcu->hooks[mcu_hook_exception])
+		mcu_hooks_exception_exit(_mcu, exception);
+
+	return true;
+}
+
+// Takes the highest priority pending exception when the
+// core is able to. Exceptions do not preempt each other,
+// every handler runs to completion.
+static bool mcu_check_exceptions(mcu_cortex_m0p_t mcu)
+{
+	if (mcu->pending == 0 ||
+		mcu->processor_mode != processor_thread_mode ||
+		(mcu->regs[REG_PRIMASK] & 1))
+		return true;
+
+	uint64_t active = mcu->pending & (((uint64_t)mcu->enabled << 16) | 0xFFFF);
+
+	if (active == 0)
+		return true;
+
+	return mcu_exception_entry(mcu, __builtin_ctzll(active));
+}
+
+uint32_t mcu_read_reg(mcu_t _mcu, reg_t reg)
+{
+	mcu_cortex_m0p_t mcu = (mcu_cortex_m0p_t)_mcu;
+
+	if (reg == REG_SP)
+		reg = mcu_current_sp(mcu);
 	else if (reg == REG_APSR)
 		return mcu->regs[REG_XPSR] & 0xF0000000;
 	else if (reg == REG_IPSR)
-		return mcu->regs[REG_XPSR] & 0x1F;
+		return mcu->regs[REG_XPSR] & 0x3F;
 	else if (reg == REG_EPSR)
 		return mcu->regs[REG_XPSR] & 0x1000000;
 
@@ -198,89 +493,238 @@ void mcu_write_reg(mcu_t _mcu, reg_t reg, uint32_t val)
 		val &= ~1;
 	}
 
-	if (reg == REG_SP) {
-		if (mcu->regs[reg] & 0x2)
-			reg = REG_PSP;
-		else
-			reg = REG_MSP;
-	}
+	if (reg == REG_SP)
+		reg = mcu_current_sp(mcu);
 
 	if (reg == REG_APSR)
 		mcu->regs[REG_XPSR] = (mcu->regs[REG_XPSR] & ~0xF0000000) | (val & 0xF0000000);
 	else if (reg == REG_IPSR)
-		mcu->regs[REG_XPSR] = (mcu->regs[REG_XPSR] & ~0x1F) | (val & 0x1F);
+		mcu->regs[REG_XPSR] = (mcu->regs[REG_XPSR] & ~0x3F) | (val & 0x3F);
 	else if (reg == REG_EPSR)
 		mcu->regs[REG_XPSR] = (mcu->regs[REG_XPSR] & ~0x1000000) | (val & 0x1000000);
 	else
 		mcu->regs[reg] = val;
 }
 
-bool mcu_instr_step(mcu_t mcu)
+// Fetches and looks up the instruction at pc. Failures halt the mcu
+// when report is set.
+static bool mcu_decode(mcu_t mcu, uint32_t pc, mcu_decoded_t decoded, bool report)
 {
-	uint32_t pc = mcu_read_reg(mcu, REG_PC);
-	uint32_t old_pc = pc;
-	uint32_t instr;
-	bool thritytwo = false;
+	uint32_t instr = 0;
+	uint16_t half;
 
-	if (!mcu_fetch16(mcu, pc - 2, (uint16_t*)&instr)) {
-		printf("ERROR: could not fetch instruction. [pc=0x%x]", pc);
-		mcu_halt(mcu, HALT_HARD_FAULT);
+	if (!mcu_fetch16(mcu, pc - 2, &half)) {
+		if (report) {
+			printf("ERROR: could not fetch instruction. [pc=0x%x]", pc);
+			mcu_halt(mcu, HALT_HARD_FAULT);
+		}
 		return false;
 	}
 
+	instr = half;
+
+	decoded->hooked = (mcu->hooks[mcu_hook_instruction] || mcu->hooks[mcu_hook_function]) &&
+		mcu_hooked(mcu, pc - 2);
+
+	// Conditional branches are also covered by the way they went
+	decoded->uncovered = mcu->coverage ?
+		mcu_coverage_pending(mcu, pc - 2, (instr & 0xF000) == 0xD000 && ((instr >> 8) & 0xF) < 0xE) : 0;
+
 	// 32-bit thumb instruction
 	if ((instr & 0xF800) == 0xF800 ||
 		(instr & 0xF800) == 0xE800 ||
 		(instr & 0xF800) == 0xF000) {
-		thritytwo = true;
-
-		instr <<= 16;
-		pc += 2;
-
-		if (!mcu_fetch16(mcu, pc - 2, (uint16_t*)&instr)) {
-			printf("ERROR: could not fetch instruction. [pc=0x%x]", pc);
-			mcu_halt(mcu, HALT_HARD_FAULT);
+		if (!mcu_fetch16(mcu, pc, &half)) {
+			if (report) {
+				printf("ERROR: could not fetch instruction. [pc=0x%x]", pc + 2);
+				mcu_halt(mcu, HALT_HARD_FAULT);
+			}
 			return false;
 		}
-	}
 
-	mcu_write_reg(mcu, REG_PC, pc+2);
+		instr = (instr << 16) | half;
 
-	if (thritytwo) {
 		for (mcu_instr32_t def = mcu->instrs32; def->impl != NULL; ++def) {
-			if ((instr & def->mask) == def->instr){
-				if (!def->impl(mcu, instr)) {
-					mcu_write_reg(mcu, REG_PC, old_pc);
-					return false;
-				}
-				else
-					return true;
+			if ((instr & def->mask) == def->instr) {
+				decoded->impl32 = def->impl;
+				decoded->instr = instr;
+				decoded->size = 4;
+				return true;
 			}
 		}
 
-		printf("Unkown 32-bit thumb instruction: 0x%08x", instr);
+		if (report)
+			printf("Unkown 32-bit thumb instruction: 0x%08x", instr);
 	}
 	else {
 		for (mcu_instr16_t def = mcu->instrs16; def->impl != NULL; ++def) {
 			if ((instr & def->mask) == def->instr) {
-				if (!def->impl(mcu, instr)) {
-					mcu_write_reg(mcu, REG_PC, old_pc);
-					return false;
-				}
-				else
-					return true;
+				decoded->impl16 = def->impl;
+				decoded->instr = instr;
+				decoded->size = 2;
+				return true;
 			}
 		}
 
-		printf("Unkown 16-bit thumb instruction: 0x%04x", instr);
+		if (report)
+			printf("Unkown 16-bit thumb instruction: 0x%04x", instr);
 	}
 
-	mcu_write_reg(mcu, REG_PC, old_pc);
-	mcu_halt(mcu, HALT_UNKOWN_INSTRUCTION);
+	if (report)
+		mcu_halt(mcu, HALT_UNKOWN_INSTRUCTION);
 
 	return false;
 }
 
+static bool mcu_execute(mcu_t mcu, mcu_decoded_t decoded, uint32_t pc)
+{
+	bool success;
+
+	mcu_write_reg(mcu, REG_PC, pc + decoded->size);
+
+	if (decoded->size == 4)
+		success = decoded->impl32(mcu, decoded->instr);
+	else
+		success = decoded->impl16(mcu, decoded->instr);
+
+	if (!success)
+		mcu_write_reg(mcu, REG_PC, pc);
+
+	return success;
+}
+
+// Executes an instruction coverage still waits for, and records it
+static bool mcu_execute_covered(mcu_t mcu, mcu_decoded_t decoded, uint32_t pc)
+{
+	uint32_t next = pc + decoded->size;
+	uint8_t events = mcu_coverage_executed;
+
+	if (!mcu_execute(mcu, decoded, pc))
+		return false;
+
+	if (decoded->uncovered & (mcu_coverage_taken | mcu_coverage_not_taken))
+		events |= mcu_read_reg(mcu, REG_PC) != next ? mcu_coverage_taken : mcu_coverage_not_taken;
+
+	// Loop branches go the same way for a long time
+	events &= decoded->uncovered;
+
+	if (events) {
+		mcu_coverage_record(mcu, pc - 2, events);
+		decoded->uncovered &= ~events;
+	}
+
+	return true;
+}
+
+// Executes a superinstruction, the pair runs in one dispatch without
+// checking for exceptions in between
+static bool mcu_execute_fused(mcu_t mcu, mcu_decoded_t decoded, uint32_t pc)
+{
+	mcu_decoded_t second = decoded->second;
+
+	mcu->cycles++;
+
+	if (decoded->fusion->impl) {
+		mcu_write_reg(mcu, REG_PC, pc + 4);
+
+		if (!decoded->fusion->impl(mcu, decoded->instr, second->instr)) {
+			mcu_write_reg(mcu, REG_PC, pc);
+			return false;
+		}
+
+		return true;
+	}
+
+	if (!mcu_execute(mcu, decoded, pc))
+		return false;
+
+	// The first instruction of a fusion never branches
+	return mcu_execute(mcu, second, pc + 2);
+}
+
+static void mcu_fuse(mcu_t mcu, mcu_decoded_t decoded, uint32_t pc)
+{
+	if (decoded->size != 2 || decoded->hooked || decoded->uncovered)
+		return;
+
+	mcu_decoded_t second = mcu_decoded_at(mcu, pc);
+
+	if (!second)
+		return;
+
+	// The successor may be data, so don't complain when it does not decode
+	if (!second->impl16 && !second->impl32 && !mcu_decode(mcu, pc + 2, second, false))
+		return;
+
+	if (second->size != 2 || second->hooked || second->uncovered)
+		return;
+
+	for (mcu_fusion_t fusion = mcu->fusions; fusion != NULL && fusion->first_mask != 0; ++fusion) {
+		if ((decoded->instr & fusion->first_mask) == fusion->first_instr &&
+			(second->instr & fusion->second_mask) == fusion->second_instr) {
+			decoded->fusion = fusion;
+			decoded->second = second;
+			return;
+		}
+	}
+}
+
+bool mcu_instr_step(mcu_t mcu)
+{
+	mcu_cortex_m0p_t m0p = (mcu_cortex_m0p_t)mcu;
+
+	// A branch to EXC_RETURN in handler mode returns from the exception
+	if (m0p->processor_mode == processor_handler_mode &&
+		mcu_read_reg(mcu, REG_PC) - 2 >= 0xFFFFFFF0) {
+		if (!mcu_exception_return(m0p, (mcu_read_reg(mcu, REG_PC) - 2) | 1))
+			return false;
+	}
+
+	if (!mcu_check_exceptions(m0p))
+		return false;
+
+	uint32_t pc = mcu_read_reg(mcu, REG_PC);
+
+	mcu->cycles++;
+
+	mcu_decoded_t decoded = mcu_decoded_at(mcu, pc - 2);
+
+	if (decoded) {
+		if (!decoded->impl16 && !decoded->impl32 && !mcu_decode(mcu, pc, decoded, true))
+			return false;
+
+		// The hook may have taken care of the instruction
+		if (decoded->hooked && !mcu_hooks_instruction(mcu, pc - 2))
+			return true;
+
+		if (decoded->uncovered)
+			return mcu_execute_covered(mcu, decoded, pc);
+
+		if (decoded->fusion && !mcu->stepping)
+			return mcu_execute_fused(mcu, decoded, pc);
+
+		// Profile, once the instruction got hot try to fuse it with its successor
+		if (decoded->hits < mcu_fusion_threshold && ++decoded->hits == mcu_fusion_threshold)
+			mcu_fuse(mcu, decoded, pc);
+
+		return mcu_execute(mcu, decoded, pc);
+	}
+
+	// Not cacheable, decode every time
+	struct mcu_decoded uncached = {};
+
+	if (!mcu_decode(mcu, pc, &uncached, true))
+		return false;
+
+	if (uncached.hooked && !mcu_hooks_instruction(mcu, pc - 2))
+		return true;
+
+	if (uncached.uncovered)
+		return mcu_execute_covered(mcu, &uncached, pc);
+
+	return mcu_execute(mcu, &uncached, pc);
+}
+
 static void mcu_update_nflag(void* _mcu, uint32_t c)
 {
 	uint32_t cpsr = mcu_read_reg(_mcu, REG_APSR);
@@ -373,6 +817,208 @@ static void mcu_write_error(void* _mcu, uint32_t addr)
 	mcu_halt((mcu_t)mcu, HALT_HARD_FAULT);
 }
 
+// Bytes transferred by a push/pop/ldmia/stmia register list
+static uint32_t mcu_reglist_size(uint16_t list)
+{
+	return __builtin_popcount(list) << 2;
+}
+
+// Copies between mcu memory and the host byte by byte, the
+// buffers may be placed anywhere
+static bool mcu_semihosting_copy_in(mcu_t mcu, void* _buffer, uint32_t addr, uint32_t length)
+{
+	uint8_t* buffer = _buffer;
+
+	for (uint32_t i = 0; i < length; i++)
+		if (!mcu_util_fetch8(mcu, addr + i, &buffer[i]))
+			return false;
+
+	return true;
+}
+
+static bool mcu_semihosting_copy_out(mcu_t mcu, uint32_t addr, const void* _buffer, uint32_t length)
+{
+	const uint8_t* buffer = _buffer;
+
+	for (uint32_t i = 0; i < length; i++)
+		if (!mcu_util_write8(mcu, addr + i, buffer[i]))
+			return false;
+
+	return true;
+}
+
+static uint32_t mcu_semihosting_open(mcu_t mcu, uint32_t args[3])
+{
+	char name[256];
+	uint32_t mode = args[1];
+	uint32_t length = args[2];
+
+	if (length >= sizeof(name) || mode > 11)
+		return -1;
+
+	if (!mcu_semihosting_copy_in(mcu, name, args[0], length))
+		return -1;
+	name[length] = '\0';
+
+	// The console, reading gives stdin, appending stderr
+	if (strcmp(name, ":tt") == 0) {
+		if (mode < 4)
+			return STDIN_FILENO;
+		else if (mode < 8)
+			return STDOUT_FILENO;
+		else
+			return STDERR_FILENO;
+	}
+
+	// Modes are the fopen modes r, r+, w, w+, a, a+ each
+	// with and without b
+	static const int flags[] = {
+		O_RDONLY,
+		O_RDWR,
+		O_WRONLY | O_CREAT | O_TRUNC,
+		O_RDWR   | O_CREAT | O_TRUNC,
+		O_WRONLY | O_CREAT | O_APPEND,
+		O_RDWR   | O_CREAT | O_APPEND,
+	};
+
+	return open(name, flags[mode >> 1], 0644);
+}
+
+static uint32_t mcu_semihosting_write(mcu_t mcu, uint32_t args[3])
+{
+	uint32_t fd = args[0];
+	uint32_t length = args[2];
+	char* buffer = malloc(length);
+
+	if (!buffer || !mcu_semihosting_copy_in(mcu, buffer, args[1], length)) {
+		free(buffer);
+		return length;
+	}
+
+	ssize_t written;
+
+	// The console goes to whoever listens to the mcu output
+	if (fd == STDOUT_FILENO || fd == STDERR_FILENO) {
+		mcu_output(mcu, buffer, length);
+		written = length;
+	}
+	else {
+		written = write(fd, buffer, length);
+	}
+
+	free(buffer);
+
+	if (written < 0)
+		return length;
+
+	return length - written;
+}
+
+static uint32_t mcu_semihosting_read(mcu_t mcu, uint32_t args[3])
+{
+	uint32_t length = args[2];
+	char* buffer = malloc(length);
+
+	if (!buffer)
+		return length;
+
+	ssize_t count = read(args[0], buffer, length);
+
+	if (count < 0 || !mcu_semihosting_copy_out(mcu, args[1], buffer, count)) {
+		free(buffer);
+		return length;
+	}
+
+	free(buffer);
+
+	return length - count;
+}
+
+// Handles bkpt 0xAB, the operation is in r0 and its
+// argument (mostly a pointer to a parameter block) in r1.
+// The result is returned in r0.
+static bool mcu_semihosting(mcu_t mcu)
+{
+	uint32_t op = mcu_read_reg(mcu, REG_R0);
+	uint32_t arg = mcu_read_reg(mcu, REG_R1);
+	uint32_t args[3] = {0};
+	uint32_t result = -1;
+
+	switch (op) {
+		case SYS_OPEN:
+		case SYS_WRITE:
+		case SYS_READ:
+		case SYS_EXIT_EXTENDED:
+			for (uint32_t i = 0; i < 3; i++) {
+				if (!mcu_fetch32(mcu, arg + i * 4, &args[i])) {
+					mcu_fetch_error(mcu, arg + i * 4);
+					return false;
+				}
+			}
+			break;
+		case SYS_CLOSE:
+			if (!mcu_fetch32(mcu, arg, &args[0])) {
+				mcu_fetch_error(mcu, arg);
+				return false;
+			}
+			break;
+	}
+
+	switch (op) {
+		case SYS_OPEN:
+			result = mcu_semihosting_open(mcu, args);
+			break;
+		case SYS_CLOSE:
+			// Never close the console of the simulator
+			if (args[0] <= STDERR_FILENO)
+				result = 0;
+			else
+				result = close(args[0]);
+			break;
+		case SYS_WRITE0:
+		{
+			char buffer[64];
+			uint32_t length = 0;
+
+			for (uint32_t addr = arg; mcu_util_fetch8(mcu, addr, (uint8_t*)&buffer[length]) && buffer[length] != '\0'; addr++) {
+				if (++length == sizeof(buffer)) {
+					mcu_output(mcu, buffer, length);
+					length = 0;
+				}
+			}
+
+			if (length > 0)
+				mcu_output(mcu, buffer, length);
+
+			result = 0;
+			break;
+		}
+		case SYS_WRITE:
+			result = mcu_semihosting_write(mcu, args);
+			break;
+		case SYS_READ:
+			result = mcu_semihosting_read(mcu, args);
+			break;
+		case SYS_CLOCK:
+			// Centiseconds of simulated time
+			result = mcu->cycles * 100 / mcu->frequency;
+			break;
+		case SYS_EXIT:
+			mcu->exit_code = arg == ADP_Stopped_ApplicationExit ? 0 : 1;
+			return mcu_halt(mcu, HALT_EXIT);
+		case SYS_EXIT_EXTENDED:
+			mcu->exit_code = args[0] == ADP_Stopped_ApplicationExit ? args[1] : 1;
+			return mcu_halt(mcu, HALT_EXIT);
+		default:
+			printf("Unsupported semihosting operation 0x%x\n", op);
+			break;
+	}
+
+	mcu_write_reg(mcu, REG_R0, result);
+
+	return true;
+}
+
 struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 	// TODO: ADC
 
@@ -756,8 +1402,8 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
                 case 0xD: //b le Z==1 or N != V
                 	trace_instr16("ble 0x%08X\n", new_pc - 3);
 
-                	if (   ((cpsr&CPSR_N) &&  (cpsr&CPSR_V))
-                		|| ((!(cpsr&CPSR_N))&&(!(cpsr&CPSR_V)))
+                	if (   ((!(cpsr&CPSR_N))&&(cpsr&CPSR_V))
+                		|| ((!(cpsr&CPSR_V))&&(cpsr&CPSR_N))
                 		|| (cpsr&CPSR_Z))
                     	mcu_write_reg(mcu, REG_PC, new_pc);
                 	return true;
@@ -825,7 +1471,8 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 		.impl = ^bool(mcu_t mcu, uint16_t instr) {
 			uint32_t a  = (instr >> 0) & 0xFF;
 
-#pragma unused(a)
+			if (a == semihosting_bkpt)
+				return mcu_semihosting(mcu);
 
 			mcu_halt(mcu, HAL_TRAP);
 
@@ -1042,7 +1689,20 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 		}
 	},
 
-	// TODO: CPS
+	//CPS
+	{
+		.mask = 0xFFEF,
+		.instr = 0xB662,
+		.impl = ^bool(mcu_t mcu, uint16_t instr) {
+			bool disable = (instr >> 4) & 0x1;
+
+			trace_instr16("cpsi%s i\n", disable ? "d" : "e");
+
+			mcu_write_reg(mcu, REG_PRIMASK, disable ? 1 : 0);
+
+			return true;
+		}
+	},
 
 	//CPY copy high register
 	{
@@ -1096,6 +1756,7 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 			trace_instr16("ldmia r%u, {", reg);
 
 			uint32_t sp = mcu_read_reg(mcu, reg);
+			uint32_t* direct = mcu_mem_direct(mcu, sp, mcu_reglist_size(instr & 0xFF));
 
 			for (reg_t reg = 0; reg < 8; ++reg) {
 				if (instr & (1 << reg)) {
@@ -1107,7 +1768,9 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 						trace_print(", ");
 					trace_print("r%u", reg);
 
-					if (!mcu_fetch32(mcu, sp, &val)) {
+					if (direct)
+						val = *direct++;
+					else if (!mcu_fetch32(mcu, sp, &val)) {
 						mcu_fetch_error(mcu, sp);
 						return false;
 					}
@@ -1684,6 +2347,7 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 		.instr = 0xBC00,
 		.impl = ^bool(mcu_t mcu, uint16_t instr) {
 			uint32_t sp = mcu_read_reg(mcu, REG_SP);
+			uint32_t* direct = mcu_mem_direct(mcu, sp, mcu_reglist_size(instr & 0x1FF));
 
 			bool first = true;
 			trace_instr16("pop {");
@@ -1698,7 +2362,9 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 						first = false;
 					trace_print("r%u", reg);
 
-					if (!mcu_fetch32(mcu, sp, &val)) {
+					if (direct)
+						val = *direct++;
+					else if (!mcu_fetch32(mcu, sp, &val)) {
 						printf("Fetch faild!");
 						return false;
 					}
@@ -1718,7 +2384,9 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 
 				trace_print("pc");
 
-				if (!mcu_fetch32(mcu, sp, &val)) {
+				if (direct)
+					val = *direct;
+				else if (!mcu_fetch32(mcu, sp, &val)) {
 					printf("Fetch faild!");
 					return false;
 				}
@@ -1751,19 +2419,14 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 			bool first = true;
 			trace_instr16("push {");
 
-			uint8_t num = 0;
-
-			for (reg_t reg = 0; reg < 8; ++reg)
-				if (instr & (1 << reg))
-					num++;
-
-			if (instr & 0x100)
-				num++;
+			uint32_t size = mcu_reglist_size(instr & 0x1FF);
 
-			sp -= num << 2;
+			sp -= size;
 
 			mcu_write_reg(mcu, REG_SP, sp);
 
+			uint32_t* direct = mcu_mem_direct(mcu, sp, size);
+
 			for (reg_t reg = 0; reg < 8; ++reg) {
 				if (instr & (1 << reg)) {
 					uint32_t val = mcu_read_reg(mcu, reg);
@@ -1774,7 +2437,9 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 						first = false;
 					trace_print("r%u", reg);
 
-					if (!mcu_write32(mcu, sp, val)) {
+					if (direct)
+						*direct++ = val;
+					else if (!mcu_write32(mcu, sp, val)) {
 						mcu_write_error(mcu, sp);
 
 						return false;
@@ -1794,7 +2459,9 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 
 				trace_print("lr");
 
-				if (!mcu_write32(mcu, sp, val)) {
+				if (direct)
+					*direct = val;
+				else if (!mcu_write32(mcu, sp, val)) {
 					printf("Fetch faild!");
 					return false;
 				}
@@ -1965,6 +2632,7 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 			trace_instr16("stmia r%u, {\n", reg);
 
 			uint32_t sp = mcu_read_reg(mcu, reg);
+			uint32_t* direct = mcu_mem_direct(mcu, sp, mcu_reglist_size(instr & 0xFF));
 
 			for (reg_t reg = 0; reg < 8; ++reg) {
 				if (instr & (1 << reg)) {
@@ -1976,7 +2644,9 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 						trace_print(", ");
 					trace_print("r%u", reg);
 
-					if (!mcu_write32(mcu, sp, val)) {
+					if (direct)
+						*direct++ = val;
+					else if (!mcu_write32(mcu, sp, val)) {
 						mcu_write_error(mcu, sp);
 						return false;
 					}
@@ -2406,6 +3076,20 @@ struct mcu_instr16 mcu_instr16_cortex_m0p[] = {
 		.mask = 0xFFFF,
 		.instr = 0xBF30,
 		.impl = ^bool(mcu_t mcu, uint16_t instr) {
+			mcu_cortex_m0p_t m0p = (mcu_cortex_m0p_t)mcu;
+
+			// Nothing to wait for
+			if (m0p->pending & (((uint64_t)m0p->enabled << 16) | 0xFFFF))
+				return true;
+
+			// Skip the idle cycles up to the next device event,
+			// which may raise the interrupt we are waiting for
+			if (mcu->events) {
+				if (mcu->events->deadline > mcu->cycles)
+					mcu->cycles = mcu->events->deadline;
+				return true;
+			}
+
 			mcu_halt(mcu, HALT_SLEEP);
 			return true;
 		}
@@ -2421,13 +3105,14 @@ struct mcu_instr32 mcu_instr32_cortex_m0p[] = {
 		.mask = 0xFFE00000,
 		.instr = 0xF3800000,
 		.impl = ^bool(mcu_t mcu, uint32_t instr) {
-			reg_t   src  = (instr >> 16) & 0x7;
+			reg_t   src  = (instr >> 16) & 0xF;
 			uint8_t sysm = (instr >>  0) & 0x7F;
 
 			switch (sysm) {
 				case 0x0:
 					trace_instr32("msr APSR, r%u\n", src);
 					mcu_write_reg(mcu, REG_APSR, mcu_read_reg(mcu, src));
+					break;
 				case 0x8:
 					trace_instr32("msr MSP, r%u\n", src);
 					mcu_write_reg(mcu, REG_MSP, mcu_read_reg(mcu, src));
@@ -2436,10 +3121,10 @@ struct mcu_instr32 mcu_instr32_cortex_m0p[] = {
 					trace_instr32("msr PSP, r%u\n", src);
 					mcu_write_reg(mcu, REG_PSP, mcu_read_reg(mcu, src));
 					break;
-				// case 0x10:
-				// 	trace_instr32("msr PRIMASK, r%u\n", src);
-				// 	mcu_write_reg(mcu, REG_PRIMASK, mcu_read_reg(mcu, src));
-				// 	break;
+				case 0x10:
+					trace_instr32("msr PRIMASK, r%u\n", src);
+					mcu_write_reg(mcu, REG_PRIMASK, mcu_read_reg(mcu, src) & 1);
+					break;
 				case 0x14:
 					trace_instr32("msr CONTROL, r%u\n", src);
 					mcu_write_reg(mcu, REG_CONTROL, mcu_read_reg(mcu, src));
@@ -2508,7 +3193,9 @@ struct mcu_instr32 mcu_instr32_cortex_m0p[] = {
 						val |= mcu_read_reg(mcu, REG_APSR);
 					}
 
-					mcu_write32(mcu, dest, val);
+					trace_print("}\n");
+					mcu_write_reg(mcu, dest, val);
+					break;
 				}
 				case 0x8:
 					trace_instr32("mrs r%u, MSP\n", dest);
@@ -2518,10 +3205,10 @@ struct mcu_instr32 mcu_instr32_cortex_m0p[] = {
 					trace_instr32("mrs r%u, PSP\n", dest);
 					mcu_write_reg(mcu, dest, mcu_read_reg(mcu, REG_PSP));
 					break;
-				// case 0x10:
-				// 	trace_instr32("mrs r%u, PRIMASK\n", dest);
-				// 	mcu_write_reg(mcu, dest, mcu_read_reg(mcu, REG_PRIMASK));
-				// 	break;
+				case 0x10:
+					trace_instr32("mrs r%u, PRIMASK\n", dest);
+					mcu_write_reg(mcu, dest, mcu_read_reg(mcu, REG_PRIMASK));
+					break;
 				case 0x14:
 					trace_instr32("mrs r%u, CONTROL\n", dest);
 					mcu_write_reg(mcu, dest, mcu_read_reg(mcu, REG_CONTROL));
@@ -2562,4 +3249,146 @@ struct mcu_instr32 mcu_instr32_cortex_m0p[] = {
 			return true;
 		}
 	},
+
+	{ 0, 0, NULL }
+};
+
+// Sets the flags like CMP does
+static void mcu_compare(mcu_t mcu, uint32_t a, uint32_t b)
+{
+	uint32_t c = a - b;
+	uint32_t cpsr = mcu_read_reg(mcu, REG_APSR) & ~(CPSR_N | CPSR_Z | CPSR_C | CPSR_V);
+
+	if (c & (1 << 31))
+		cpsr |= CPSR_N;
+	if (c == 0)
+		cpsr |= CPSR_Z;
+	if (a >= b)
+		cpsr |= CPSR_C;
+	if ((a ^ b) & (a ^ c) & (1 << 31))
+		cpsr |= CPSR_V;
+
+	mcu_write_reg(mcu, REG_APSR, cpsr);
+}
+
+static bool mcu_condition_passed(uint32_t cpsr, uint8_t cond)
+{
+	bool n = cpsr & CPSR_N;
+	bool z = cpsr & CPSR_Z;
+	bool c = cpsr & CPSR_C;
+	bool v = cpsr & CPSR_V;
+
+	switch (cond) {
+		case 0x0: return z;
+		case 0x1: return !z;
+		case 0x2: return c;
+		case 0x3: return !c;
+		case 0x4: return n;
+		case 0x5: return !n;
+		case 0x6: return v;
+		case 0x7: return !v;
+		case 0x8: return c && !z;
+		case 0x9: return !c || z;
+		case 0xA: return n == v;
+		case 0xB: return n != v;
+		case 0xC: return !z && n == v;
+		case 0xD: return z || n != v;
+		default: return true;
+	}
+}
+
+// Second half of a compare and branch, pc already points past the branch
+static bool mcu_fused_branch(mcu_t mcu, uint16_t instr)
+{
+	uint8_t cond = (instr >> 8) & 0xF;
+	uint32_t offset = instr & 0xFF;
+
+	// UDF and SVC share the encoding space
+	if (cond >= 0xE) {
+		printf("Undefined instruction!");
+		return false;
+	}
+
+	if (offset & 0x80)
+		offset |= (~0) << 8;
+
+	if (mcu_condition_passed(mcu_read_reg(mcu, REG_APSR), cond))
+		mcu_write_reg(mcu, REG_PC, (offset << 1) + mcu_read_reg(mcu, REG_PC) + 2);
+
+	return true;
+}
+
+// Pairs the compiler emits a lot, found by profiling the firmware
+// running in the simulator. Pairs without an impl just save the
+// dispatch in between.
+struct mcu_fusion mcu_fusions_cortex_m0p[] = {
+	// CMP(1) + B(1)
+	{
+		.first_mask = 0xF800,
+		.first_instr = 0x2800,
+		.second_mask = 0xF000,
+		.second_instr = 0xD000,
+		.impl = ^bool(mcu_t mcu, uint16_t first, uint16_t second) {
+			reg_t src    = (first >> 8) & 0x7;
+			uint32_t imm = (first >> 0) & 0xFF;
+
+			trace_instr16("cmp r%u,#0x%02X + b<c>\n", src, imm);
+
+			mcu_compare(mcu, mcu_read_reg(mcu, src), imm);
+
+			return mcu_fused_branch(mcu, second);
+		}
+	},
+
+	// CMP(2) + B(1)
+	{
+		.first_mask = 0xFFC0,
+		.first_instr = 0x4280,
+		.second_mask = 0xF000,
+		.second_instr = 0xD000,
+		.impl = ^bool(mcu_t mcu, uint16_t first, uint16_t second) {
+			reg_t src1 = (first >> 0) & 0x7;
+			reg_t src2 = (first >> 3) & 0x7;
+
+			trace_instr16("cmp r%u,r%u + b<c>\n", src1, src2);
+
+			mcu_compare(mcu, mcu_read_reg(mcu, src1), mcu_read_reg(mcu, src2));
+
+			return mcu_fused_branch(mcu, second);
+		}
+	},
+
+	// MOV(1) + CMP(1)
+	{
+		.first_mask = 0xF800,
+		.first_instr = 0x2000,
+		.second_mask = 0xF800,
+		.second_instr = 0x2800,
+	},
+
+	// LDR(1) + ADD(2)
+	{
+		.first_mask = 0xF800,
+		.first_instr = 0x6800,
+		.second_mask = 0xF800,
+		.second_instr = 0x3000,
+	},
+
+	// PUSH + SUB(4), function prologue
+	{
+		.first_mask = 0xFE00,
+		.first_instr = 0xB400,
+		.second_mask = 0xFF80,
+		.second_instr = 0xB080,
+	},
+
+	// ADD(7) + POP, function epilogue
+	{
+		.first_mask = 0xFF80,
+		.first_instr = 0xB000,
+		.second_mask = 0xFE00,
+		.second_instr = 0xBC00,
+	},
+
+	{ 0, 0, 0, 0, NULL }
 };
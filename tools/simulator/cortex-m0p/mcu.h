@@ -57,6 +57,7 @@ typedef enum {
 	REG_CONTROL,
 	REG_MSP,
 	REG_PSP,
+	REG_PRIMASK,
 	reg_count,
 	reg_gdb_count = REG_XPSR + 1,
 
@@ -68,6 +69,8 @@ typedef enum {
 typedef enum {
 	HALT_STOPPED = 0,
 	HALT_SLEEP = -1,
+	// The firmware is done, exit_code holds the result
+	HALT_EXIT = -2,
 
 	HALT_HARD_FAULT,
 	HALT_UNKOWN_INSTRUCTION,
@@ -108,6 +111,11 @@ struct mcu_cortex_m0p {
 	uint32_t regs[reg_count];
 
 	processor_mode_t processor_mode;
+
+	// Pending exceptions, indexed by exception number
+	uint64_t pending;
+	// Enabled external interrupts (NVIC ISER)
+	uint32_t enabled;
 };
 
 mcu_t mcu_cortex_m0p_create(struct ev_loop *loop, size_t ramsize);
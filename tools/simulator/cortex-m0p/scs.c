@@ -0,0 +1,344 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "scs.h"
+
+#include <mcu.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	SYST_CSR   = 0x010,
+	SYST_RVR   = 0x014,
+	SYST_CVR   = 0x018,
+	SYST_CALIB = 0x01C,
+
+	NVIC_ISER = 0x100,
+	NVIC_ICER = 0x180,
+	NVIC_ISPR = 0x200,
+	NVIC_ICPR = 0x280,
+	NVIC_IPR0 = 0x400,
+	NVIC_IPR7 = 0x41C,
+
+	SCB_CPUID = 0xD00,
+	SCB_ICSR  = 0xD04,
+	SCB_VTOR  = 0xD08,
+	SCB_AIRCR = 0xD0C,
+	SCB_SCR   = 0xD10,
+	SCB_CCR   = 0xD14,
+	SCB_SHPR2 = 0xD1C,
+	SCB_SHPR3 = 0xD20,
+};
+
+enum {
+	ICSR_NMIPENDSET = (1 << 31),
+	ICSR_PENDSVSET  = (1 << 28),
+	ICSR_PENDSVCLR  = (1 << 27),
+	ICSR_PENDSTSET  = (1 << 26),
+	ICSR_PENDSTCLR  = (1 << 25),
+};
+
+enum {
+	SYST_CSR_COUNTFLAG = (1 << 16),
+	SYST_CSR_CLKSOURCE = (1 << 2),
+	SYST_CSR_TICKINT   = (1 << 1),
+	SYST_CSR_ENABLE    = (1 << 0),
+};
+
+struct scs_dev {
+	struct mem_dev mem_dev;
+
+	// Priorities are stored but not used, exceptions are
+	// taken in order of their number
+	uint32_t ipr[8];
+	uint32_t shpr2;
+	uint32_t shpr3;
+	uint32_t scr;
+
+	// SysTick, the counter is not stepped but derived from
+	// the cycles executed since it held syst_value
+	uint32_t syst_csr;
+	uint32_t syst_rvr;
+	uint32_t syst_value;
+	uint64_t syst_start;
+	struct mcu_event syst_event;
+};
+
+// The reference clock of the LPC11xx runs at half the core clock
+static uint32_t systick_divider(scs_dev_t scs)
+{
+	return (scs->syst_csr & SYST_CSR_CLKSOURCE) ? 1 : 2;
+}
+
+static uint32_t systick_value(scs_dev_t scs, mcu_t mcu)
+{
+	if (!(scs->syst_csr & SYST_CSR_ENABLE))
+		return scs->syst_value;
+
+	uint64_t ticks = (mcu->cycles - scs->syst_start) / systick_divider(scs);
+
+	if (ticks < scs->syst_value)
+		return scs->syst_value - ticks;
+
+	if (scs->syst_rvr == 0)
+		return 0;
+
+	// Reaching 0 reloads the counter on the next tick
+	uint64_t phase = (ticks - scs->syst_value) % (scs->syst_rvr + 1);
+
+	return phase == 0 ? 0 : scs->syst_rvr + 1 - phase;
+}
+
+static void systick_schedule(scs_dev_t scs, mcu_t mcu)
+{
+	mcu_event_cancel(mcu, &scs->syst_event);
+
+	if (!(scs->syst_csr & SYST_CSR_ENABLE))
+		return;
+
+	uint64_t period = (uint64_t)scs->syst_rvr + 1;
+	uint64_t ticks = (mcu->cycles - scs->syst_start) / systick_divider(scs);
+	uint64_t next;
+
+	// Only counting down from 1 to 0 wraps, loading a
+	// zero does not
+	if (ticks < scs->syst_value)
+		next = scs->syst_value;
+	else if (scs->syst_rvr == 0)
+		return;
+	else
+		next = scs->syst_value + ((ticks - scs->syst_value) / period + 1) * period;
+
+	uint64_t deadline = scs->syst_start + next * systick_divider(scs);
+
+	mcu_event_schedule(mcu, &scs->syst_event, deadline - mcu->cycles);
+}
+
+// Restarts counting from the current value, needed
+// before the configuration changes
+static void systick_rebase(scs_dev_t scs, mcu_t mcu)
+{
+	scs->syst_value = systick_value(scs, mcu);
+	scs->syst_start = mcu->cycles;
+}
+
+static void systick_wrap(mcu_t mcu, void* context)
+{
+	scs_dev_t scs = context;
+
+	scs->syst_csr |= SYST_CSR_COUNTFLAG;
+
+	if (scs->syst_csr & SYST_CSR_TICKINT)
+		mcu_do_exception(mcu, exception_systick);
+
+	systick_schedule(scs, mcu);
+}
+
+static bool scs_dev_read32(mcu_t _mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t* temp)
+{
+	scs_dev_t scs = (scs_dev_t)mem_dev;
+	struct mcu_cortex_m0p* mcu = (struct mcu_cortex_m0p*)_mcu;
+
+	switch (addr) {
+		case SYST_CSR:
+			*temp = scs->syst_csr;
+			scs->syst_csr &= ~SYST_CSR_COUNTFLAG;
+			break;
+		case SYST_RVR:
+			*temp = scs->syst_rvr;
+			break;
+		case SYST_CVR:
+			*temp = systick_value(scs, _mcu);
+			break;
+		case SYST_CALIB:
+			// No calibration value
+			*temp = 0;
+			break;
+		case NVIC_ISER:
+		case NVIC_ICER:
+			*temp = mcu->enabled;
+			break;
+		case NVIC_ISPR:
+		case NVIC_ICPR:
+			*temp = mcu->pending >> 16;
+			break;
+		case SCB_CPUID:
+			*temp = 0x410CC601;
+			break;
+		case SCB_ICSR:
+		{
+			uint32_t val = mcu_read_reg(_mcu, REG_IPSR);
+
+			if (mcu->pending & (1ULL << exception_pendsv))
+				val |= ICSR_PENDSVSET;
+			if (mcu->pending & (1ULL << exception_systick))
+				val |= ICSR_PENDSTSET;
+			if (mcu->pending & ~0xFFFFULL)
+				val |= (1 << 22); // ISRPENDING
+
+			*temp = val;
+			break;
+		}
+		case SCB_VTOR:
+		case SCB_AIRCR:
+		case SCB_CCR:
+			*temp = 0;
+			break;
+		case SCB_SCR:
+			*temp = scs->scr;
+			break;
+		case SCB_SHPR2:
+			*temp = scs->shpr2;
+			break;
+		case SCB_SHPR3:
+			*temp = scs->shpr3;
+			break;
+		default:
+			if (addr >= NVIC_IPR0 && addr <= NVIC_IPR7) {
+				*temp = scs->ipr[(addr - NVIC_IPR0) >> 2];
+				break;
+			}
+
+			return false;
+	}
+
+	return true;
+}
+
+static bool scs_dev_write32(mcu_t _mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp)
+{
+	scs_dev_t scs = (scs_dev_t)mem_dev;
+	struct mcu_cortex_m0p* mcu = (struct mcu_cortex_m0p*)_mcu;
+
+	switch (addr) {
+		case SYST_CSR:
+			systick_rebase(scs, _mcu);
+			scs->syst_csr = (scs->syst_csr & SYST_CSR_COUNTFLAG)
+				| (temp & (SYST_CSR_CLKSOURCE | SYST_CSR_TICKINT | SYST_CSR_ENABLE));
+			systick_schedule(scs, _mcu);
+			break;
+		case SYST_RVR:
+			systick_rebase(scs, _mcu);
+			scs->syst_rvr = temp & 0xFFFFFF;
+			systick_schedule(scs, _mcu);
+			break;
+		case SYST_CVR:
+			// Any write clears the counter
+			scs->syst_value = 0;
+			scs->syst_start = _mcu->cycles;
+			scs->syst_csr &= ~SYST_CSR_COUNTFLAG;
+			systick_schedule(scs, _mcu);
+			break;
+		case NVIC_ISER:
+			mcu->enabled |= temp;
+			break;
+		case NVIC_ICER:
+			mcu->enabled &= ~temp;
+			break;
+		case NVIC_ISPR:
+			mcu->pending |= (uint64_t)temp << 16;
+			break;
+		case NVIC_ICPR:
+			mcu->pending &= ~((uint64_t)temp << 16);
+			break;
+		case SCB_ICSR:
+			if (temp & ICSR_NMIPENDSET)
+				mcu->pending |= 1ULL << exception_nmi;
+			if (temp & ICSR_PENDSVSET)
+				mcu->pending |= 1ULL << exception_pendsv;
+			if (temp & ICSR_PENDSVCLR)
+				mcu->pending &= ~(1ULL << exception_pendsv);
+			if (temp & ICSR_PENDSTSET)
+				mcu->pending |= 1ULL << exception_systick;
+			if (temp & ICSR_PENDSTCLR)
+				mcu->pending &= ~(1ULL << exception_systick);
+			break;
+		case SCB_AIRCR:
+			// SYSRESETREQ
+			if ((temp >> 16) == 0x05FA && (temp & (1 << 2)))
+				mcu_reset(_mcu);
+			break;
+		case SCB_VTOR:
+		case SCB_CCR:
+			break;
+		case SCB_SCR:
+			scs->scr = temp;
+			break;
+		case SCB_SHPR2:
+			scs->shpr2 = temp;
+			break;
+		case SCB_SHPR3:
+			scs->shpr3 = temp;
+			break;
+		default:
+			if (addr >= NVIC_IPR0 && addr <= NVIC_IPR7) {
+				scs->ipr[(addr - NVIC_IPR0) >> 2] = temp;
+				break;
+			}
+
+			printf("Unhandled scs write at 0x%x\n", addr);
+			return false;
+	}
+
+	return true;
+}
+
+static void scs_dev_reset(mcu_t mcu, mem_dev_t mem_dev)
+{
+	scs_dev_t scs = (scs_dev_t)mem_dev;
+
+	mcu_event_cancel(mcu, &scs->syst_event);
+
+	memset(scs->ipr, 0, sizeof(scs->ipr));
+	scs->shpr2 = 0;
+	scs->shpr3 = 0;
+	scs->scr = 0;
+	scs->syst_csr = 0;
+	scs->syst_rvr = 0;
+	scs->syst_value = 0;
+	scs->syst_start = mcu->cycles;
+}
+
+scs_dev_t scs_dev_create()
+{
+	scs_dev_t dev = calloc(1, sizeof(struct scs_dev));
+
+	if (!dev) {
+		perror("Could not allocate scs_dev structure");
+		return NULL;
+	}
+
+	dev->mem_dev.class = mem_class_io;
+	dev->mem_dev.type = scs_mem_type;
+	dev->mem_dev.fetch16 = mcu_emu_fetch16;
+	dev->mem_dev.fetch32 = scs_dev_read32;
+	dev->mem_dev.write16 = mcu_emu_write16;
+	dev->mem_dev.write32 = scs_dev_write32;
+	dev->mem_dev.length = 0x1000;
+	dev->mem_dev.reset = scs_dev_reset;
+	dev->syst_event.fire = systick_wrap;
+	dev->syst_event.context = dev;
+
+	return dev;
+}
@@ -0,0 +1,182 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+// Public interface of libmcusim
+//
+// Everything below only uses plain C types, so host programs can embed
+// the simulator without knowing about its internals or libev.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mcusim* mcusim_t;
+
+struct ev_loop;
+
+/// Why mcusim_run returned
+typedef enum {
+	/// The requested number of cycles was executed
+	mcusim_stop_cycles,
+	/// The mcu waits for an interrupt and has nothing scheduled
+	mcusim_stop_sleep,
+	/// A breakpoint or debugger stopped the mcu
+	mcusim_stop_trap,
+	/// The mcu hit a fault or an unknown instruction
+	mcusim_stop_fault,
+	/// The firmware exited, see mcusim_exit_code
+	mcusim_stop_exit,
+} mcusim_stop_t;
+
+/// Registers, numbered like gdb does
+typedef enum {
+	mcusim_reg_r0 = 0,
+	mcusim_reg_r12 = 12,
+	mcusim_reg_sp = 13,
+	mcusim_reg_lr = 14,
+	mcusim_reg_pc = 15,
+	mcusim_reg_xpsr = 16,
+} mcusim_reg_t;
+
+/// Callbacks of a host implemented memory mapped device
+///
+/// Accesses are always 32-bit wide, offset is relative to the base
+/// of the device. Returning false signals a bus error to the mcu.
+///
+struct mcusim_device {
+	bool (*read)(mcusim_t sim, uint32_t offset, uint32_t* value, void* context);
+	bool (*write)(mcusim_t sim, uint32_t offset, uint32_t value, void* context);
+};
+
+/// Creates a cortex-m0+ with the lpc11xx peripherals
+///
+/// The mcu is halted until mcusim_run is called.
+///
+mcusim_t mcusim_create(size_t ramsize);
+
+/// Creates a simulator that runs from a libev loop
+///
+/// Use mcusim_resume to let it run when the loop is idle.
+///
+mcusim_t mcusim_create_with_loop(struct ev_loop* loop, size_t ramsize);
+
+void mcusim_destroy(mcusim_t sim);
+
+/// Loads an elf image into flash and ram
+bool mcusim_load_elf(mcusim_t sim, const void* data, size_t length);
+bool mcusim_load_elf_file(mcusim_t sim, const char* path);
+
+/// Resets the mcu, leaves memory untouched
+bool mcusim_reset(mcusim_t sim);
+
+/// Runs at most the given number of cycles
+mcusim_stop_t mcusim_run(mcusim_t sim, uint64_t cycles);
+
+/// Lets the mcu run from the event loop
+bool mcusim_resume(mcusim_t sim);
+
+/// Executes the mcu on a thread of its own instead of the loop's
+/// idle watcher
+///
+/// Halt and output callbacks still arrive on the event loop thread.
+/// Memory and registers may only be accessed while the mcu is halted,
+/// mcusim_resume and mcusim_irq are safe at any time and from any
+/// thread.
+///
+bool mcusim_start_thread(mcusim_t sim);
+
+/// Paces the mcu against the host clock
+///
+/// @param factor 1 runs in real time, 10 ten times faster,
+///		0 (the default) as fast as possible
+///
+void mcusim_set_speed(mcusim_t sim, uint32_t factor);
+
+/// Cycles executed since the simulator was created
+uint64_t mcusim_cycles(mcusim_t sim);
+
+/// Exit code of the firmware once mcusim_stop_exit was returned
+int mcusim_exit_code(mcusim_t sim);
+
+bool mcusim_read_mem(mcusim_t sim, uint32_t addr, void* buffer, size_t length);
+
+/// Writes memory, flash included
+bool mcusim_write_mem(mcusim_t sim, uint32_t addr, const void* buffer, size_t length);
+
+/// Reads a register. The pc is the address of the next instruction.
+uint32_t mcusim_read_reg(mcusim_t sim, mcusim_reg_t reg);
+void mcusim_write_reg(mcusim_t sim, mcusim_reg_t reg, uint32_t value);
+
+/// Sets an external interrupt pending
+bool mcusim_irq(mcusim_t sim, unsigned irq);
+
+/// Maps a host device at base
+bool mcusim_add_device(mcusim_t sim, uint32_t base, uint32_t length,
+	const struct mcusim_device* device, void* context);
+
+/// Receives everything the firmware prints, instead of stdout
+void mcusim_set_output(mcusim_t sim, void (*output)(mcusim_t sim, const char* data, size_t length, void* context), void* context);
+
+/// Called whenever the mcu stops on its own, mostly useful
+/// for simulators running from an event loop
+void mcusim_set_halt_handler(mcusim_t sim, void (*halted)(mcusim_t sim, mcusim_stop_t reason, void* context), void* context);
+
+/// Records which instructions execute and which way conditional
+/// branches go, from now on
+bool mcusim_coverage_start(mcusim_t sim);
+
+/// Writes the recorded coverage as lcov tracefile, the source lines
+/// come from the debug info of the loaded elf
+bool mcusim_coverage_write(mcusim_t sim, const char* path);
+
+/// Moves ram and flash into a POSIX shared memory object of the given
+/// name (like "/mcusim"), where monitors can watch the firmware while it
+/// runs. See mcusim_shm.h for the layout. The object is removed when
+/// the simulator is destroyed.
+bool mcusim_share_memory(mcusim_t sim, const char* name);
+
+/// Runs hot library functions (memcpy, memset, memmove, strlen, strcmp,
+/// crc8_maxim) of the loaded elf natively, charging the cycles the
+/// firmware would have spent in them
+bool mcusim_hle_start(mcusim_t sim);
+
+/// Traces the heap of the firmware through the symbols of its
+/// allocator, needs a loaded elf
+bool mcusim_heap_start(mcusim_t sim);
+
+/// Writes peak use, fragmentation and allocation hot spots
+bool mcusim_heap_write_report(mcusim_t sim, const char* path);
+
+/// Starts a gdb server, requires a simulator with an event loop
+bool mcusim_gdb_listen(mcusim_t sim, int port);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,77 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#pragma once
+//
+// Layout of the shared memory a simulator publishes with
+// mcusim_share_memory
+//
+// Monitors open the object with shm_open and mmap it read only. The
+// header is followed by the memory of the mcu, each region starting
+// at its offset from the beginning of the object. Memory is live,
+// values spanning several words may be caught in the middle of
+// an update.
+//
+
+#include <stdint.h>
+
+#define MCUSIM_SHM_MAGIC 0x4D435348 // "MCSH"
+#define MCUSIM_SHM_VERSION 1
+#define MCUSIM_SHM_MAX_REGIONS 8
+
+typedef enum {
+	mcusim_shm_ram   = 0,
+	mcusim_shm_flash = 1,
+} mcusim_shm_kind_t;
+
+struct mcusim_shm_region {
+	/// Address of the region in the mcu
+	uint32_t base;
+	uint32_t length;
+
+	/// Where the region lives in the shared memory object
+	uint32_t offset;
+
+	/// A mcusim_shm_kind_t
+	uint32_t kind;
+};
+
+struct mcusim_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t region_count;
+
+	/// Cycles per second of the mcu
+	uint32_t frequency;
+
+	/// Nonzero while the mcu is halted
+	uint32_t halted;
+
+	/// Updated once per ms of simulated time and when the mcu halts
+	uint64_t cycles;
+
+	struct mcusim_shm_region regions[MCUSIM_SHM_MAX_REGIONS];
+};
@@ -0,0 +1,130 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "24xx64.h"
+
+#include <i2c.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	MCP24XX64_SIZE      = 8 * 1024,
+	MCP24XX64_PAGE_SIZE = 32,
+};
+
+// Maximum self timed write cycle (tWC)
+static const uint64_t mcp24xx64_write_cycle_us = 5000;
+
+struct mcp24xx64_dev {
+	struct i2c_slave slave;
+
+	uint8_t memory[MCP24XX64_SIZE];
+
+	uint16_t pointer;
+	uint8_t address_bytes;
+	bool written;
+
+	// The device does not acknowledge while it writes the page
+	uint64_t busy_until;
+};
+
+static bool mcp24xx64_start(mcu_t mcu, i2c_slave_t slave, bool read)
+{
+	mcp24xx64_dev_t dev = (mcp24xx64_dev_t)slave;
+
+	if (mcu->cycles < dev->busy_until)
+		return false;
+
+	dev->address_bytes = 0;
+	dev->written = false;
+
+	return true;
+}
+
+static bool mcp24xx64_write(mcu_t mcu, i2c_slave_t slave, uint8_t byte)
+{
+	mcp24xx64_dev_t dev = (mcp24xx64_dev_t)slave;
+
+	if (dev->address_bytes < 2) {
+		dev->pointer = ((dev->pointer << 8) | byte) & (MCP24XX64_SIZE - 1);
+		dev->address_bytes++;
+		return true;
+	}
+
+	dev->memory[dev->pointer] = byte;
+	dev->written = true;
+
+	// Writes roll over at the page boundary
+	dev->pointer = (dev->pointer & ~(MCP24XX64_PAGE_SIZE - 1)) |
+		((dev->pointer + 1) & (MCP24XX64_PAGE_SIZE - 1));
+
+	return true;
+}
+
+static uint8_t mcp24xx64_read(mcu_t mcu, i2c_slave_t slave, uint64_t* stretch)
+{
+	mcp24xx64_dev_t dev = (mcp24xx64_dev_t)slave;
+	uint8_t byte = dev->memory[dev->pointer];
+
+	// Sequential reads roll over at the end of the memory
+	dev->pointer = (dev->pointer + 1) & (MCP24XX64_SIZE - 1);
+
+	return byte;
+}
+
+static void mcp24xx64_stop(mcu_t mcu, i2c_slave_t slave)
+{
+	mcp24xx64_dev_t dev = (mcp24xx64_dev_t)slave;
+
+	if (dev->written) {
+		dev->busy_until = mcu->cycles + mcu_us_to_cycles(mcu, mcp24xx64_write_cycle_us);
+		dev->written = false;
+	}
+}
+
+uint8_t* mcp24xx64_dev_memory(mcp24xx64_dev_t dev)
+{
+	return dev->memory;
+}
+
+mcp24xx64_dev_t mcp24xx64_dev_create(uint8_t addr)
+{
+	mcp24xx64_dev_t dev = calloc(1, sizeof(struct mcp24xx64_dev));
+
+	if (!dev) {
+		perror("Could not allocate mcp24xx64_dev structure");
+		return NULL;
+	}
+
+	dev->slave.addr = addr;
+	dev->slave.start = mcp24xx64_start;
+	dev->slave.write = mcp24xx64_write;
+	dev->slave.read = mcp24xx64_read;
+	dev->slave.stop = mcp24xx64_stop;
+
+	// Erased state
+	memset(dev->memory, 0xFF, sizeof(dev->memory));
+
+	return dev;
+}
@@ -0,0 +1,195 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "adc.h"
+
+#include <mcu.h>
+#include <stdio.h>
+
+enum {
+	CR    = 0x00,
+	GDR   = 0x04,
+	INTEN = 0x0C,
+	DR0   = 0x10,
+	DR7   = 0x2C,
+	STAT  = 0x30,
+};
+
+enum {
+	CR_SEL_MASK     = 0xFF,
+	CR_CLKDIV_SHIFT = 8,
+	CR_CLKDIV_MASK  = 0xFF,
+	CR_START_SHIFT  = 24,
+	CR_START_MASK   = 0x7,
+	CR_START_NOW    = 1,
+
+	DR_DONE         = (1 << 31),
+	DR_OVERRUN      = (1 << 30),
+	DR_CHANNEL_SHIFT = 24,
+	DR_RESULT_SHIFT = 6,
+};
+
+// A conversion takes 11 adc clocks
+static const uint64_t adc_conversion_clocks = 11;
+
+struct adc_dev {
+	struct mem_dev mem_dev;
+
+	uint32_t cr;
+	uint32_t gdr;
+	uint32_t inten;
+	uint32_t dr[8];
+
+	bool converting;
+	uint8_t channel;
+	uint64_t done_at;
+
+	uint16_t values[8];
+};
+
+// Conversions are finished lazily when the result is read
+static void adc_dev_update(mcu_t mcu, adc_dev_t dev)
+{
+	if (!dev->converting || mcu->cycles < dev->done_at)
+		return;
+
+	uint32_t result = DR_DONE | (dev->values[dev->channel] & 0x3FF) << DR_RESULT_SHIFT;
+
+	if (dev->dr[dev->channel] & DR_DONE)
+		result |= DR_OVERRUN;
+
+	dev->dr[dev->channel] = result;
+	dev->gdr = result | (dev->channel << DR_CHANNEL_SHIFT);
+	dev->converting = false;
+}
+
+static bool adc_dev_read32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t* temp)
+{
+	adc_dev_t dev = (adc_dev_t)mem_dev;
+
+	adc_dev_update(mcu, dev);
+
+	switch (addr) {
+		case CR:
+			*temp = dev->cr;
+			break;
+		case GDR:
+			*temp = dev->gdr;
+			// Reading clears the done and overrun flags
+			dev->gdr &= ~(DR_DONE | DR_OVERRUN);
+			break;
+		case INTEN:
+			*temp = dev->inten;
+			break;
+		case STAT:
+		{
+			uint32_t stat = 0;
+
+			for (uint8_t i = 0; i < 8; i++) {
+				if (dev->dr[i] & DR_DONE)
+					stat |= (1 << i);
+				if (dev->dr[i] & DR_OVERRUN)
+					stat |= (1 << (i + 8));
+			}
+
+			*temp = stat;
+			break;
+		}
+		default:
+			if (addr >= DR0 && addr <= DR7) {
+				uint8_t channel = (addr - DR0) >> 2;
+
+				*temp = dev->dr[channel];
+				dev->dr[channel] &= ~(DR_DONE | DR_OVERRUN);
+				break;
+			}
+
+			return false;
+	}
+
+	return true;
+}
+
+static bool adc_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp)
+{
+	adc_dev_t dev = (adc_dev_t)mem_dev;
+
+	adc_dev_update(mcu, dev);
+
+	switch (addr) {
+		case CR:
+			dev->cr = temp;
+
+			// Burst mode and edge triggered starts are not modelled
+			if (((temp >> CR_START_SHIFT) & CR_START_MASK) == CR_START_NOW &&
+				(temp & CR_SEL_MASK) != 0) {
+				uint64_t clkdiv = (temp >> CR_CLKDIV_SHIFT) & CR_CLKDIV_MASK;
+
+				dev->channel = __builtin_ctz(temp & CR_SEL_MASK);
+				dev->done_at = mcu->cycles + adc_conversion_clocks * (clkdiv + 1);
+				dev->converting = true;
+				dev->gdr &= ~DR_DONE;
+			}
+			break;
+		case INTEN:
+			dev->inten = temp;
+			break;
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+void adc_dev_set_value(adc_dev_t dev, uint8_t channel, uint16_t value)
+{
+	if (channel < 8)
+		dev->values[channel] = value & 0x3FF;
+}
+
+adc_dev_t adc_dev_create()
+{
+	adc_dev_t dev = calloc(1, sizeof(struct adc_dev));
+
+	if (!dev) {
+		perror("Could not allocate adc_dev structure");
+		return NULL;
+	}
+
+	dev->mem_dev.class = mem_class_io;
+	dev->mem_dev.type = adc_mem_type;
+	dev->mem_dev.fetch16 = mcu_emu_fetch16;
+	dev->mem_dev.fetch32 = adc_dev_read32;
+	dev->mem_dev.write16 = mcu_emu_write16;
+	dev->mem_dev.write32 = adc_dev_write32;
+	dev->mem_dev.length = 0x4000;
+
+	dev->cr = 0x1;
+
+	// Mid scale until the host sets something else
+	for (uint8_t i = 0; i < 8; i++)
+		dev->values[i] = 0x200;
+
+	return dev;
+}
@@ -35,6 +35,9 @@ struct flash_dev {
 	struct mem_dev mem_dev;
 
 	uint32_t* flash;
+
+	// Set once the flash lives in memory the device does not own
+	bool shared;
 };
 
 bool flash_dev_read16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t* temp) {
@@ -67,6 +70,27 @@ bool flash_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t tem
 	return true;
 }
 
+static void flash_dev_share(mem_dev_t mem_dev, uint32_t* storage)
+{
+	flash_dev_t dev = (flash_dev_t)mem_dev;
+
+	memcpy(storage, dev->flash, mem_dev->length);
+
+	if (!dev->shared)
+		free(dev->flash);
+
+	dev->flash = storage;
+	dev->shared = true;
+	mem_dev->direct = storage;
+}
+
+static void flash_dev_destroy(mem_dev_t mem_dev)
+{
+	if (!((flash_dev_t)mem_dev)->shared)
+		free(((flash_dev_t)mem_dev)->flash);
+	free(mem_dev);
+}
+
 flash_dev_t flash_dev_create(size_t size)
 {
 	assert((size & 0x3FF) == 0 && "Flash size must be multiple of 1024");
@@ -85,6 +109,8 @@ flash_dev_t flash_dev_create(size_t size)
 	dev->mem_dev.write16 = flash_dev_write16;
 	dev->mem_dev.write32 = flash_dev_write32;
 	dev->mem_dev.length = size;
+	dev->mem_dev.destroy = flash_dev_destroy;
+	dev->mem_dev.share = flash_dev_share;
 	dev->flash = malloc(size);
 	memset(dev->flash, 0xDE, size);
 
@@ -94,5 +120,8 @@ flash_dev_t flash_dev_create(size_t size)
 		return NULL;
 	}
 
+	// Writes still go through the device, they depend on the lock
+	dev->mem_dev.direct = dev->flash;
+
 	return dev;
 }
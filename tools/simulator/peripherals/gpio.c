@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "gpio.h"
+
+#include <mcu.h>
+#include <stdio.h>
+
+enum {
+	// Bits 13:2 of the address select the pins affected
+	MASKED_ACCESS_END = 0x3FFC,
+	DATA              = 0x3FFC,
+	DIR               = 0x8000,
+	IS                = 0x8004,
+	IBE               = 0x8008,
+	IEV               = 0x800C,
+	IE                = 0x8010,
+	RIS               = 0x8014,
+	MIS               = 0x8018,
+	IC                = 0x801C,
+};
+
+static const uint32_t gpio_pin_mask = 0xFFF;
+
+struct gpio_dev {
+	struct mem_dev mem_dev;
+
+	uint32_t data;
+	uint32_t dir;
+	uint32_t input;
+
+	// Interrupt configuration is stored, but no edges are generated
+	uint32_t is;
+	uint32_t ibe;
+	uint32_t iev;
+	uint32_t ie;
+
+	gpio_dev_changed_t changed;
+	void* context;
+};
+
+uint32_t gpio_dev_get_pins(gpio_dev_t dev)
+{
+	return ((dev->data & dev->dir) | (dev->input & ~dev->dir)) & gpio_pin_mask;
+}
+
+static bool gpio_dev_read32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t* temp)
+{
+	gpio_dev_t dev = (gpio_dev_t)mem_dev;
+
+	if (addr <= MASKED_ACCESS_END) {
+		*temp = gpio_dev_get_pins(dev) & ((addr >> 2) & gpio_pin_mask);
+		return true;
+	}
+
+	switch (addr) {
+		case DIR:
+			*temp = dev->dir;
+			break;
+		case IS:
+			*temp = dev->is;
+			break;
+		case IBE:
+			*temp = dev->ibe;
+			break;
+		case IEV:
+			*temp = dev->iev;
+			break;
+		case IE:
+			*temp = dev->ie;
+			break;
+		case RIS:
+		case MIS:
+			*temp = 0;
+			break;
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+static bool gpio_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp)
+{
+	gpio_dev_t dev = (gpio_dev_t)mem_dev;
+	uint32_t old_pins = gpio_dev_get_pins(dev);
+
+	if (addr <= MASKED_ACCESS_END) {
+		uint32_t mask = (addr >> 2) & gpio_pin_mask;
+
+		dev->data = (dev->data & ~mask) | (temp & mask);
+	}
+	else {
+		switch (addr) {
+			case DIR:
+				dev->dir = temp & gpio_pin_mask;
+				break;
+			case IS:
+				dev->is = temp & gpio_pin_mask;
+				break;
+			case IBE:
+				dev->ibe = temp & gpio_pin_mask;
+				break;
+			case IEV:
+				dev->iev = temp & gpio_pin_mask;
+				break;
+			case IE:
+				dev->ie = temp & gpio_pin_mask;
+				break;
+			case IC:
+				break;
+			default:
+				return false;
+		}
+	}
+
+	uint32_t pins = gpio_dev_get_pins(dev);
+
+	if (dev->changed && pins != old_pins)
+		dev->changed(dev, pins, dev->context);
+
+	return true;
+}
+
+void gpio_dev_set_input(gpio_dev_t dev, uint8_t pin, bool level)
+{
+	if (level)
+		dev->input |= (1 << pin);
+	else
+		dev->input &= ~(1 << pin);
+}
+
+void gpio_dev_set_changed(gpio_dev_t dev, gpio_dev_changed_t changed, void* context)
+{
+	dev->changed = changed;
+	dev->context = context;
+}
+
+gpio_dev_t gpio_dev_create()
+{
+	gpio_dev_t dev = calloc(1, sizeof(struct gpio_dev));
+
+	if (!dev) {
+		perror("Could not allocate gpio_dev structure");
+		return NULL;
+	}
+
+	dev->mem_dev.class = mem_class_io;
+	dev->mem_dev.type = gpio_mem_type;
+	dev->mem_dev.fetch16 = mcu_emu_fetch16;
+	dev->mem_dev.fetch32 = gpio_dev_read32;
+	dev->mem_dev.write16 = mcu_emu_write16;
+	dev->mem_dev.write32 = gpio_dev_write32;
+	dev->mem_dev.length = 0x10000;
+
+	// Unconnected inputs read as high because of the pull-ups
+	dev->input = gpio_pin_mask;
+
+	return dev;
+}
@@ -0,0 +1,333 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "i2c.h"
+
+#include <stdio.h>
+
+enum {
+	CONSET = 0x00,
+	STAT   = 0x04,
+	DAT    = 0x08,
+	ADR0   = 0x0C,
+	SCLH   = 0x10,
+	SCLL   = 0x14,
+	CONCLR = 0x18,
+};
+
+enum {
+	CON_AA   = (1 << 2),
+	CON_SI   = (1 << 3),
+	CON_STO  = (1 << 4),
+	CON_STA  = (1 << 5),
+	CON_I2EN = (1 << 6),
+
+	CON_MASK = CON_AA | CON_SI | CON_STO | CON_STA | CON_I2EN,
+};
+
+enum {
+	STAT_START          = 0x08,
+	STAT_REPEATED_START = 0x10,
+	STAT_SLA_W_ACK      = 0x18,
+	STAT_SLA_W_NACK     = 0x20,
+	STAT_DATA_W_ACK     = 0x28,
+	STAT_DATA_W_NACK    = 0x30,
+	STAT_ARBITRATION    = 0x38,
+	STAT_SLA_R_ACK      = 0x40,
+	STAT_SLA_R_NACK     = 0x48,
+	STAT_DATA_R_ACK     = 0x50,
+	STAT_DATA_R_NACK    = 0x58,
+	STAT_IDLE           = 0xF8,
+};
+
+// SCLH and SCLL may not be set lower than 4
+static const uint32_t i2c_min_half_bit = 4;
+
+struct i2c_dev {
+	struct mem_dev mem_dev;
+
+	irq_t irq;
+
+	i2c_slave_t slaves;
+	i2c_slave_t selected;
+
+	uint32_t con;
+	uint32_t stat;
+	uint32_t dat;
+	uint32_t adr0;
+	uint32_t sclh;
+	uint32_t scll;
+
+	// Bus transaction in flight
+	struct mcu_event event;
+	uint32_t next_stat;
+	bool next_dat_valid;
+	uint8_t next_dat;
+};
+
+static uint64_t i2c_dev_bit_time(i2c_dev_t dev)
+{
+	uint32_t sclh = dev->sclh < i2c_min_half_bit ? i2c_min_half_bit : dev->sclh;
+	uint32_t scll = dev->scll < i2c_min_half_bit ? i2c_min_half_bit : dev->scll;
+
+	return sclh + scll;
+}
+
+static void i2c_dev_event(mcu_t mcu, void* context)
+{
+	i2c_dev_t dev = context;
+
+	dev->stat = dev->next_stat;
+
+	if (dev->next_dat_valid) {
+		dev->dat = dev->next_dat;
+		dev->next_dat_valid = false;
+	}
+
+	dev->con |= CON_SI;
+	mcu_do_irq(mcu, dev->irq);
+}
+
+// Lets the bus run and sets SI with the given state once done
+static void i2c_dev_transfer(mcu_t mcu, i2c_dev_t dev, uint32_t next_stat, uint64_t cycles)
+{
+	dev->next_stat = next_stat;
+	mcu_event_schedule(mcu, &dev->event, cycles);
+}
+
+static i2c_slave_t i2c_dev_find_slave(i2c_dev_t dev, uint8_t addr)
+{
+	for (i2c_slave_t slave = dev->slaves; slave != NULL; slave = slave->next)
+		if ((slave->addr & 0xFE) == (addr & 0xFE))
+			return slave;
+
+	return NULL;
+}
+
+static void i2c_dev_stop(mcu_t mcu, i2c_dev_t dev)
+{
+	if (dev->selected && dev->selected->stop)
+		dev->selected->stop(mcu, dev->selected);
+
+	dev->selected = NULL;
+}
+
+// Called when SI is cleared, the controller continues with
+// whatever the firmware set up in CON and DAT
+static void i2c_dev_continue(mcu_t mcu, i2c_dev_t dev)
+{
+	uint64_t bit = i2c_dev_bit_time(dev);
+
+	if (dev->con & CON_STO) {
+		i2c_dev_stop(mcu, dev);
+		dev->con &= ~CON_STO;
+		dev->stat = STAT_IDLE;
+
+		// A pending start is sent after the stop
+		if (dev->con & CON_STA)
+			i2c_dev_transfer(mcu, dev, STAT_START, 2 * bit);
+
+		return;
+	}
+
+	if (dev->con & CON_STA) {
+		// The slave sees a repeated start, not a stop
+		dev->selected = NULL;
+		i2c_dev_transfer(mcu, dev, STAT_REPEATED_START, bit);
+		return;
+	}
+
+	switch (dev->stat) {
+		case STAT_START:
+		case STAT_REPEATED_START:
+		{
+			bool read = dev->dat & 0x1;
+			i2c_slave_t slave = i2c_dev_find_slave(dev, dev->dat);
+			bool ack = slave && (!slave->start || slave->start(mcu, slave, read));
+
+			dev->selected = ack ? slave : NULL;
+
+			if (read)
+				i2c_dev_transfer(mcu, dev, ack ? STAT_SLA_R_ACK : STAT_SLA_R_NACK, 9 * bit);
+			else
+				i2c_dev_transfer(mcu, dev, ack ? STAT_SLA_W_ACK : STAT_SLA_W_NACK, 9 * bit);
+			break;
+		}
+		case STAT_SLA_W_ACK:
+		case STAT_DATA_W_ACK:
+		case STAT_DATA_W_NACK:
+		{
+			i2c_slave_t slave = dev->selected;
+			bool ack = slave && (!slave->write || slave->write(mcu, slave, dev->dat & 0xFF));
+
+			i2c_dev_transfer(mcu, dev, ack ? STAT_DATA_W_ACK : STAT_DATA_W_NACK, 9 * bit);
+			break;
+		}
+		case STAT_SLA_R_ACK:
+		case STAT_DATA_R_ACK:
+		{
+			i2c_slave_t slave = dev->selected;
+			uint64_t stretch = 0;
+
+			dev->next_dat = 0xFF;
+			if (slave && slave->read)
+				dev->next_dat = slave->read(mcu, slave, &stretch);
+			dev->next_dat_valid = true;
+
+			i2c_dev_transfer(mcu, dev, (dev->con & CON_AA) ? STAT_DATA_R_ACK : STAT_DATA_R_NACK, 9 * bit + stretch);
+			break;
+		}
+		default:
+			// Nothing more to do on the bus until a start or stop is requested
+			break;
+	}
+}
+
+static bool i2c_dev_read32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t* temp)
+{
+	i2c_dev_t dev = (i2c_dev_t)mem_dev;
+
+	switch (addr) {
+		case CONSET:
+			*temp = dev->con;
+			break;
+		case STAT:
+			*temp = dev->stat;
+			break;
+		case DAT:
+			*temp = dev->dat;
+			break;
+		case ADR0:
+			*temp = dev->adr0;
+			break;
+		case SCLH:
+			*temp = dev->sclh;
+			break;
+		case SCLL:
+			*temp = dev->scll;
+			break;
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+static bool i2c_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp)
+{
+	i2c_dev_t dev = (i2c_dev_t)mem_dev;
+
+	switch (addr) {
+		case CONSET:
+		{
+			bool idle = dev->stat == STAT_IDLE && dev->selected == NULL &&
+				!(dev->con & CON_SI);
+
+			dev->con |= temp & CON_MASK;
+
+			// Start on an idle bus happens right away
+			if ((dev->con & CON_I2EN) && (temp & CON_STA) && idle)
+				i2c_dev_transfer(mcu, dev, STAT_START, i2c_dev_bit_time(dev));
+			break;
+		}
+		case CONCLR:
+			dev->con &= ~(temp & (CON_AA | CON_SI | CON_STA | CON_I2EN));
+
+			if (!(dev->con & CON_I2EN)) {
+				mcu_event_cancel(mcu, &dev->event);
+				dev->selected = NULL;
+				dev->stat = STAT_IDLE;
+			}
+			else if (temp & CON_SI) {
+				i2c_dev_continue(mcu, dev);
+			}
+			break;
+		case DAT:
+			dev->dat = temp & 0xFF;
+			break;
+		case ADR0:
+			dev->adr0 = temp & 0xFF;
+			break;
+		case SCLH:
+			dev->sclh = temp & 0xFFFF;
+			break;
+		case SCLL:
+			dev->scll = temp & 0xFFFF;
+			break;
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+static void i2c_dev_destroy(mem_dev_t mem_dev)
+{
+	i2c_dev_t dev = (i2c_dev_t)mem_dev;
+
+	// Attached slaves belong to the bus
+	while (dev->slaves) {
+		i2c_slave_t next = dev->slaves->next;
+
+		free(dev->slaves);
+		dev->slaves = next;
+	}
+
+	free(dev);
+}
+
+void i2c_dev_attach(i2c_dev_t dev, i2c_slave_t slave)
+{
+	slave->next = dev->slaves;
+	dev->slaves = slave;
+}
+
+i2c_dev_t i2c_dev_create(irq_t irq)
+{
+	i2c_dev_t dev = calloc(1, sizeof(struct i2c_dev));
+
+	if (!dev) {
+		perror("Could not allocate i2c_dev structure");
+		return NULL;
+	}
+
+	dev->mem_dev.class = mem_class_io;
+	dev->mem_dev.type = i2c_mem_type;
+	dev->mem_dev.fetch16 = mcu_emu_fetch16;
+	dev->mem_dev.fetch32 = i2c_dev_read32;
+	dev->mem_dev.write16 = mcu_emu_write16;
+	dev->mem_dev.write32 = i2c_dev_write32;
+	dev->mem_dev.length = 0x4000;
+	dev->mem_dev.destroy = i2c_dev_destroy;
+
+	dev->irq = irq;
+	dev->stat = STAT_IDLE;
+	dev->sclh = 0x4;
+	dev->scll = 0x4;
+
+	dev->event.fire = i2c_dev_event;
+	dev->event.context = dev;
+
+	return dev;
+}
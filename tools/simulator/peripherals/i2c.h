@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <mcu.h>
+
+typedef struct i2c_dev* i2c_dev_t;
+typedef struct i2c_slave* i2c_slave_t;
+static const uint32_t i2c_mem_type = 1;
+
+/// A device on the simulated i2c bus
+///
+/// Slaves embed this structure as their first member. Every
+/// callback is optional.
+///
+struct i2c_slave {
+	i2c_slave_t next;
+
+	/// 8-bit bus address, the r/w bit is ignored
+	uint8_t addr;
+
+	/// Called when the slave is addressed. Returning false NACKs the address.
+	bool (*start)(mcu_t mcu, i2c_slave_t slave, bool read);
+
+	/// Called for every byte written by the master. Returning false NACKs the byte.
+	bool (*write)(mcu_t mcu, i2c_slave_t slave, uint8_t byte);
+
+	/// Called for every byte read by the master
+	///
+	/// The slave can hold SCL low by setting stretch to the number
+	/// of cycles the transfer should be delayed.
+	///
+	uint8_t (*read)(mcu_t mcu, i2c_slave_t slave, uint64_t* stretch);
+
+	/// Called when the master sends a stop condition
+	void (*stop)(mcu_t mcu, i2c_slave_t slave);
+};
+
+/// Creates the LPC11xx i2c controller in master mode
+i2c_dev_t i2c_dev_create(irq_t irq);
+
+/// Connects a slave to the bus, the bus frees it when destroyed
+void i2c_dev_attach(i2c_dev_t dev, i2c_slave_t slave);
@@ -27,11 +27,15 @@
 #include <mcu.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 struct ram_dev {
 	struct mem_dev mem_dev;
 
 	uint32_t* ram;
+
+	// Set once the ram lives in memory the device does not own
+	bool shared;
 };
 
 bool ram_dev_read16(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint16_t* temp) {
@@ -58,6 +62,27 @@ bool ram_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp)
 	return true;
 }
 
+static void ram_dev_share(mem_dev_t mem_dev, uint32_t* storage)
+{
+	ram_dev_t dev = (ram_dev_t)mem_dev;
+
+	memcpy(storage, dev->ram, mem_dev->length);
+
+	if (!dev->shared)
+		free(dev->ram);
+
+	dev->ram = storage;
+	dev->shared = true;
+	mem_dev->direct = storage;
+}
+
+static void ram_dev_destroy(mem_dev_t mem_dev)
+{
+	if (!((ram_dev_t)mem_dev)->shared)
+		free(((ram_dev_t)mem_dev)->ram);
+	free(mem_dev);
+}
+
 ram_dev_t ram_dev_create(size_t size)
 {
 	assert((size & 0x3FF) == 0 && "Ram size must be multiple of 1024");
@@ -76,6 +101,8 @@ ram_dev_t ram_dev_create(size_t size)
 	dev->mem_dev.write16 = ram_dev_write16;
 	dev->mem_dev.write32 = ram_dev_write32;
 	dev->mem_dev.length = size;
+	dev->mem_dev.destroy = ram_dev_destroy;
+	dev->mem_dev.share = ram_dev_share;
 	dev->ram = malloc(size);
 
 	if (!dev->ram) {
@@ -84,5 +111,7 @@ ram_dev_t ram_dev_create(size_t size)
 		return NULL;
 	}
 
+	dev->mem_dev.direct = dev->ram;
+
 	return dev;
 }
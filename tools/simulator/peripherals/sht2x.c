@@ -0,0 +1,261 @@
+//
+// Copyright (c) 2014, Christian Speich
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "sht2x.h"
+
+#include <i2c.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	SHT2X_ADDRESS          = 0x80,
+
+	SHT2X_TRIG_T_HOLD      = 0xE3,
+	SHT2X_TRIG_RH_HOLD     = 0xE5,
+	SHT2X_WRITE_USER_REG   = 0xE6,
+	SHT2X_READ_USER_REG    = 0xE7,
+	SHT2X_SOFT_RESET       = 0xFE,
+	SHT2X_READ_SERIAL1     = 0xFA,
+	SHT2X_READ_SERIAL2     = 0xFC,
+
+	// Resolution bits 7 and 0, the others are reserved or read only
+	SHT2X_USER_REG_WRITABLE = 0x87,
+	SHT2X_USER_REG_DEFAULT  = 0x02,
+};
+
+// Typical conversion times in us, indexed by the resolution bits
+// (bit 7 << 1 | bit 0) of the user register
+static const uint64_t sht2x_t_conversion_us[4] = { 66000, 17000, 33000, 9000 };
+static const uint64_t sht2x_rh_conversion_us[4] = { 22000, 3000, 7000, 12000 };
+static const uint64_t sht2x_reset_us = 15000;
+
+static const uint8_t sht2x_serial[8] = { 0x00, 0x80, 0x5A, 0x0F, 0x12, 0x34, 0x56, 0x78 };
+
+struct sht2x_dev {
+	struct i2c_slave slave;
+
+	int32_t temp;
+	int32_t humidity;
+
+	uint8_t user_reg;
+
+	uint8_t cmd[2];
+	uint8_t cmd_length;
+
+	// Response to the last command
+	uint8_t out[8];
+	uint8_t out_length;
+	uint8_t out_pos;
+
+	// Measurement result is available at this cycle
+	uint64_t ready_at;
+	uint64_t busy_until;
+};
+
+static uint8_t sht2x_crc(const uint8_t* data, size_t length)
+{
+	uint8_t crc = 0;
+
+	for (size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			if (crc & 0x80)
+				crc = (crc << 1) ^ 0x31;
+			else
+				crc <<= 1;
+		}
+	}
+
+	return crc;
+}
+
+static uint8_t sht2x_resolution(sht2x_dev_t dev)
+{
+	return ((dev->user_reg >> 6) & 0x2) | (dev->user_reg & 0x1);
+}
+
+static void sht2x_respond_measurement(sht2x_dev_t dev, uint16_t raw)
+{
+	dev->out[0] = raw >> 8;
+	dev->out[1] = raw & 0xFF;
+	dev->out[2] = sht2x_crc(dev->out, 2);
+	dev->out_length = 3;
+}
+
+static void sht2x_measure_t(mcu_t mcu, sht2x_dev_t dev)
+{
+	int64_t raw = ((int64_t)dev->temp + 46850) * 65536 / 175720;
+
+	if (raw < 0)
+		raw = 0;
+	if (raw > 0xFFFF)
+		raw = 0xFFFF;
+
+	// Status bit 1 is cleared for temperature
+	sht2x_respond_measurement(dev, raw & ~0x3);
+	dev->ready_at = mcu->cycles + mcu_us_to_cycles(mcu, sht2x_t_conversion_us[sht2x_resolution(dev)]);
+}
+
+static void sht2x_measure_rh(mcu_t mcu, sht2x_dev_t dev)
+{
+	int64_t raw = ((int64_t)dev->humidity + 6000) * 65536 / 125000;
+
+	if (raw < 0)
+		raw = 0;
+	if (raw > 0xFFFF)
+		raw = 0xFFFF;
+
+	sht2x_respond_measurement(dev, (raw & ~0x3) | 0x2);
+	dev->ready_at = mcu->cycles + mcu_us_to_cycles(mcu, sht2x_rh_conversion_us[sht2x_resolution(dev)]);
+}
+
+static void sht2x_respond_serial(sht2x_dev_t dev, uint8_t cmd)
+{
+	if (cmd == SHT2X_READ_SERIAL1) {
+		// SNB_3..SNB_0, each followed by its crc
+		for (uint8_t i = 0; i < 4; i++) {
+			dev->out[i * 2] = sht2x_serial[2 + i];
+			dev->out[i * 2 + 1] = sht2x_crc(&sht2x_serial[2 + i], 1);
+		}
+		dev->out_length = 8;
+	}
+	else {
+		// SNC_1, SNC_0, crc, SNA_1, SNA_0, crc
+		dev->out[0] = sht2x_serial[6];
+		dev->out[1] = sht2x_serial[7];
+		dev->out[2] = sht2x_crc(&dev->out[0], 2);
+		dev->out[3] = sht2x_serial[0];
+		dev->out[4] = sht2x_serial[1];
+		dev->out[5] = sht2x_crc(&dev->out[3], 2);
+		dev->out_length = 6;
+	}
+}
+
+static bool sht2x_start(mcu_t mcu, i2c_slave_t slave, bool read)
+{
+	sht2x_dev_t dev = (sht2x_dev_t)slave;
+
+	if (mcu->cycles < dev->busy_until)
+		return false;
+
+	if (read)
+		dev->out_pos = 0;
+	else
+		dev->cmd_length = 0;
+
+	return true;
+}
+
+static bool sht2x_write(mcu_t mcu, i2c_slave_t slave, uint8_t byte)
+{
+	sht2x_dev_t dev = (sht2x_dev_t)slave;
+
+	if (dev->cmd_length >= sizeof(dev->cmd))
+		return false;
+
+	dev->cmd[dev->cmd_length++] = byte;
+
+	if (dev->cmd_length == 1) {
+		dev->out_length = 0;
+		dev->ready_at = 0;
+
+		switch (byte) {
+			case SHT2X_TRIG_T_HOLD:
+				sht2x_measure_t(mcu, dev);
+				return true;
+			case SHT2X_TRIG_RH_HOLD:
+				sht2x_measure_rh(mcu, dev);
+				return true;
+			case SHT2X_READ_USER_REG:
+				dev->out[0] = dev->user_reg;
+				dev->out_length = 1;
+				return true;
+			case SHT2X_WRITE_USER_REG:
+			case SHT2X_READ_SERIAL1:
+			case SHT2X_READ_SERIAL2:
+				return true;
+			case SHT2X_SOFT_RESET:
+				dev->user_reg = SHT2X_USER_REG_DEFAULT;
+				dev->busy_until = mcu->cycles + mcu_us_to_cycles(mcu, sht2x_reset_us);
+				return true;
+			default:
+				printf("[SHT2x] Unknown command 0x%02x\n", byte);
+				return false;
+		}
+	}
+
+	switch (dev->cmd[0]) {
+		case SHT2X_WRITE_USER_REG:
+			dev->user_reg = (dev->user_reg & ~SHT2X_USER_REG_WRITABLE) | (byte & SHT2X_USER_REG_WRITABLE);
+			return true;
+		case SHT2X_READ_SERIAL1:
+		case SHT2X_READ_SERIAL2:
+			sht2x_respond_serial(dev, dev->cmd[0]);
+			return true;
+		default:
+			return false;
+	}
+}
+
+static uint8_t sht2x_read(mcu_t mcu, i2c_slave_t slave, uint64_t* stretch)
+{
+	sht2x_dev_t dev = (sht2x_dev_t)slave;
+
+	// Hold master mode keeps SCL low until the measurement is done
+	if (dev->out_pos == 0 && dev->ready_at > mcu->cycles)
+		*stretch = dev->ready_at - mcu->cycles;
+
+	if (dev->out_pos >= dev->out_length)
+		return 0xFF;
+
+	return dev->out[dev->out_pos++];
+}
+
+void sht2x_dev_set(sht2x_dev_t dev, int32_t temp, int32_t humidity)
+{
+	dev->temp = temp;
+	dev->humidity = humidity;
+}
+
+sht2x_dev_t sht2x_dev_create()
+{
+	sht2x_dev_t dev = calloc(1, sizeof(struct sht2x_dev));
+
+	if (!dev) {
+		perror("Could not allocate sht2x_dev structure");
+		return NULL;
+	}
+
+	dev->slave.addr = SHT2X_ADDRESS;
+	dev->slave.start = sht2x_start;
+	dev->slave.write = sht2x_write;
+	dev->slave.read = sht2x_read;
+
+	dev->user_reg = SHT2X_USER_REG_DEFAULT;
+	dev->temp = 21500;
+	dev->humidity = 45000;
+
+	return dev;
+}
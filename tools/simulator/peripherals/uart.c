@@ -50,7 +50,7 @@ bool uart_dev_write32(mcu_t mcu, mem_dev_t mem_dev, uint32_t addr, uint32_t temp
 		case 0x0:
 		{
 			char c = temp & 0xFF;
-			putchar(c);
+			mcu_output(mcu, &c, 1);
 			break;
 		}
 	}
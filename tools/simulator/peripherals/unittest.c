@@ -42,7 +42,14 @@ enum {
 	STATUS_OFFSET       = 0x12,
 	STATUS_DESC_OFFSET  = 0x16,
 
-	SIZE                = 0x20,
+	// Cycles executed by the mcu, reading the low word
+	// latches the high word
+	CYCLES_LOW_OFFSET   = 0x20,
+	CYCLES_HIGH_OFFSET  = 0x24,
+	// Cycles the current test measured, printed with its result
+	REPORT_CYCLES_OFFSET = 0x28,
+
+	SIZE                = 0x30,
 };
 
 enum {
@@ -66,6 +73,10 @@ struct unittest_dev {
 	char* desc;
 	uint32_t status;
 	char* status_desc;
+
+	uint32_t cycles_high;
+	bool cycles_reported;
+	uint32_t reported_cycles;
 };
 
 static void unittest_update_progress(unittest_dev_t unittest_dev)
@@ -98,6 +109,10 @@ static void unittest_update_progress(unittest_dev_t unittest_dev)
 	if (display_status_desc && unittest_dev->status_desc) {
 		printf("\t%s\n", unittest_dev->status_desc);
 	}
+
+	if (display_status_desc && unittest_dev->cycles_reported) {
+		printf("\t%u cycles\n", unittest_dev->reported_cycles);
+	}
 	fflush(stdout);
 }
 
@@ -143,6 +158,13 @@ static bool unittest_dev_read32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, ui
 		case TOTAL_TESTS_OFFSET:
 			*temp = mem_dev->total_tests;
 			break;
+		case CYCLES_LOW_OFFSET:
+			*temp = mcu->cycles & 0xFFFFFFFF;
+			mem_dev->cycles_high = mcu->cycles >> 32;
+			break;
+		case CYCLES_HIGH_OFFSET:
+			*temp = mem_dev->cycles_high;
+			break;
 		default:
 			return false;
 	}
@@ -150,7 +172,7 @@ static bool unittest_dev_read32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, ui
 	return true;
 }
 
-static bool unittest_done(unittest_dev_t mem_dev)
+static bool unittest_done(mcu_t mcu, unittest_dev_t mem_dev)
 {
 	if (mem_dev->tests_failed > 0)
 		printf(COLOR_RED);
@@ -158,7 +180,9 @@ static bool unittest_done(unittest_dev_t mem_dev)
 		printf(COLOR_GREEN);
 
 	printf("%d run, %d skipped, %d failed\n"COLOR_RESET, mem_dev->total_tests, mem_dev->tests_skipped, mem_dev->tests_failed);
-	exit(mem_dev->tests_failed > 0 ? -1 : 0);
+
+	mcu->exit_code = mem_dev->tests_failed > 0 ? -1 : 0;
+	return mcu_halt(mcu, HALT_EXIT);
 }
 
 static bool unittest_dev_write32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, uint32_t temp)
@@ -182,6 +206,7 @@ static bool unittest_dev_write32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, u
 				mem_dev->desc = NULL;
 			}
 			mem_dev->desc = unittest_fetch_str(mcu, temp);
+			mem_dev->cycles_reported = false;
 			break;
 		case STATUS_OFFSET:
 			mem_dev->status = temp;
@@ -200,7 +225,7 @@ static bool unittest_dev_write32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, u
 					mcu_reset(mcu);
 				}
 				else {
-					unittest_done(mem_dev);
+					unittest_done(mcu, mem_dev);
 				}
 			}
 			break;
@@ -211,6 +236,10 @@ static bool unittest_dev_write32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, u
 			}
 			mem_dev->status_desc = unittest_fetch_str(mcu, temp);
 			break;
+		case REPORT_CYCLES_OFFSET:
+			mem_dev->reported_cycles = temp;
+			mem_dev->cycles_reported = true;
+			break;
 		default:
 			return false;
 	}
@@ -218,6 +247,15 @@ static bool unittest_dev_write32(mcu_t mcu, mem_dev_t _mem_dev, uint32_t addr, u
 	return true;
 }
 
+static void unittest_dev_destroy(mem_dev_t mem_dev)
+{
+	unittest_dev_t dev = (unittest_dev_t)mem_dev;
+
+	free(dev->desc);
+	free(dev->status_desc);
+	free(dev);
+}
+
 unittest_dev_t unittest_dev_create()
 {
 	unittest_dev_t dev = calloc(1, sizeof(struct unittest_dev));
@@ -234,6 +272,7 @@ unittest_dev_t unittest_dev_create()
 	dev->mem_dev.write16 = mcu_emu_write16;
 	dev->mem_dev.write32 = unittest_dev_write32;
 	dev->mem_dev.length = SIZE;
+	dev->mem_dev.destroy = unittest_dev_destroy;
 
 	dev->current_test = -1;
 	dev->total_tests = 0;
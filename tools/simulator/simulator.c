@@ -30,20 +30,33 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <assert.h>
-#include <string.h>
 #include <unistd.h>
 #include <ev.h>
 
-#include <time.h>
+#include <mcusim.h>
 
-#include <mcu.h>
-#include <gdb.h>
-#include <elf.h>
+// Reports written when the firmware exits
+struct simulator_reports {
+	const char* coverage_file;
+	const char* heap_file;
+};
 
-bool mcu_flash_file(mcu_t mcu, const char* filename)
+static void simulator_halted(mcusim_t sim, mcusim_stop_t reason, void* context)
 {
-	return elf_load(mcu, filename);
+	struct simulator_reports* reports = context;
+
+	if (reason == mcusim_stop_exit) {
+		if (reports->coverage_file)
+			mcusim_coverage_write(sim, reports->coverage_file);
+		if (reports->heap_file)
+			mcusim_heap_write_report(sim, reports->heap_file);
+
+		int code = mcusim_exit_code(sim);
+
+		// Also removes the shared memory object
+		mcusim_destroy(sim);
+		exit(code);
+	}
 }
 
 int main(int argc, char** argv) {
@@ -51,13 +64,16 @@ int main(int argc, char** argv) {
 
 	bool wait_for_gdb = false;
 	int gdb_port = 1234;
+	uint32_t speed = 0;
 	const char* firmware_file = NULL;
-	char ch;
+	struct simulator_reports reports = {};
+	const char* shm_name = NULL;
+	bool hle = false;
+	int ch;
 
-	mcu_t mcu;
-	gdb_t gdb;
+	mcusim_t sim;
 
-	while ((ch = getopt(argc, argv, "gp:f:")) != -1) {
+	while ((ch = getopt(argc, argv, "gp:f:s:c:H:m:E")) != -1) {
 		switch (ch) {
 			case 'g':
 				wait_for_gdb = true;
@@ -68,45 +84,92 @@ int main(int argc, char** argv) {
 			case 'f':
 				firmware_file = optarg;
 				break;
+			case 's':
+				speed = atol(optarg);
+				break;
+			case 'c':
+				reports.coverage_file = optarg;
+				break;
+			case 'H':
+				reports.heap_file = optarg;
+				break;
+			case 'm':
+				shm_name = optarg;
+				break;
+			case 'E':
+				hle = true;
+				break;
 			case '?':
 				printf("%s - MCU Simulator\n", argv[0]);
 				printf("  -g wait for debugger when mcu halts\n");
 				printf("  -G wait for debugger to attach\n");
+				printf("  -s factor run factor times faster than real time, 0 as fast as possible\n");
+				printf("  -c file write lcov coverage to file when the firmware exits\n");
+				printf("  -H file write a heap report to file when the firmware exits\n");
+				printf("  -m name share ram and flash as POSIX shared memory object\n");
+				printf("  -E run memcpy, strlen and friends natively\n");
 				break;
 		}
 	}
 
-	mcu = mcu_cortex_m0p_create(loop, 8 * 1024);
+	sim = mcusim_create_with_loop(loop, 8 * 1024);
 
-	if (!mcu) {
+	if (!sim) {
 		printf("Could not create mcu\n");
 		return -1;
 	}
 
-	gdb = gdb_create(loop, gdb_port, mcu);
+	mcusim_set_halt_handler(sim, simulator_halted, &reports);
+	mcusim_set_speed(sim, speed);
 
-	if (!gdb) {
+	if (!mcusim_gdb_listen(sim, gdb_port)) {
 		printf("Could not create gdb\n");
 		return -1;
 	}
-	
+
 	if (firmware_file) {
-		if (!mcu_flash_file(mcu, firmware_file)) {
+		if (!mcusim_load_elf_file(sim, firmware_file)) {
 			printf("Flash faild");
 			return -1;
 		}
 	}
 
-	if (!mcu_reset(mcu)) {
+	if (shm_name && !mcusim_share_memory(sim, shm_name)) {
+		printf("Could not share memory\n");
+		return -1;
+	}
+
+	if (hle && !mcusim_hle_start(sim)) {
+		printf("Could not start high level emulation\n");
+		return -1;
+	}
+
+	if (reports.coverage_file && !mcusim_coverage_start(sim)) {
+		printf("Could not start coverage\n");
+		return -1;
+	}
+
+	if (reports.heap_file && !mcusim_heap_start(sim)) {
+		printf("Could not start heap analysis\n");
+		return -1;
+	}
+
+	if (!mcusim_reset(sim)) {
 		printf("MCU reset failed");
 		return -1;
 	}
 
+	if (!mcusim_start_thread(sim)) {
+		printf("Could not start mcu thread\n");
+		return -1;
+	}
+
 	if (!wait_for_gdb)
-		mcu_resume(mcu);
+		mcusim_resume(sim);
 
 	ev_run(loop, 0);
 
+	mcusim_destroy(sim);
+
 	return 0;
 }
-